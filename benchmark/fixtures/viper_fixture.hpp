@@ -8,11 +8,11 @@
 namespace viper {
 namespace kv_bm {
 
-template <typename KeyT = KeyType16, typename ValueT = ValueType200>
+template <typename KeyT = KeyType16, typename ValueT = ValueType200, typename IndexT = cceh::CCEH<KeyT>>
 class ViperFixture : public BaseFixture {
   public:
     typedef KeyT KeyType;
-    using ViperT = Viper<KeyT, ValueT>;
+    using ViperT = Viper<KeyT, ValueT, IndexT>;
 
     void InitMap(const uint64_t num_prefill_inserts = 0, const bool re_init = true) override;
     void InitMap(const uint64_t num_prefill_inserts, ViperConfig v_config);
@@ -41,8 +41,8 @@ class ViperFixture : public BaseFixture {
     std::string pool_file_;
 };
 
-template <typename KeyT, typename ValueT>
-void ViperFixture<KeyT, ValueT>::InitMap(uint64_t num_prefill_inserts, const bool re_init) {
+template <typename KeyT, typename ValueT, typename IndexT>
+void ViperFixture<KeyT, ValueT, IndexT>::InitMap(uint64_t num_prefill_inserts, const bool re_init) {
     if (viper_initialized_ && !re_init) {
         return;
     }
@@ -50,8 +50,8 @@ void ViperFixture<KeyT, ValueT>::InitMap(uint64_t num_prefill_inserts, const boo
     return InitMap(num_prefill_inserts, ViperConfig{});
 }
 
-template <typename KeyT, typename ValueT>
-void ViperFixture<KeyT, ValueT>::InitMap(uint64_t num_prefill_inserts, ViperConfig v_config) {
+template <typename KeyT, typename ValueT, typename IndexT>
+void ViperFixture<KeyT, ValueT, IndexT>::InitMap(uint64_t num_prefill_inserts, ViperConfig v_config) {
 #ifdef CCEH_PERSISTENT
     PMemAllocator::get().initialize();
 #endif
@@ -66,8 +66,8 @@ void ViperFixture<KeyT, ValueT>::InitMap(uint64_t num_prefill_inserts, ViperConf
     viper_initialized_ = true;
 }
 
-template <typename KeyT, typename ValueT>
-void ViperFixture<KeyT, ValueT>::DeInitMap() {
+template <typename KeyT, typename ValueT, typename IndexT>
+void ViperFixture<KeyT, ValueT, IndexT>::DeInitMap() {
     BaseFixture::DeInitMap();
     viper_ = nullptr;
     viper_initialized_ = false;
@@ -76,8 +76,8 @@ void ViperFixture<KeyT, ValueT>::DeInitMap() {
     }
 }
 
-template <typename KeyT, typename ValueT>
-uint64_t ViperFixture<KeyT, ValueT>::insert(uint64_t start_idx, uint64_t end_idx) {
+template <typename KeyT, typename ValueT, typename IndexT>
+uint64_t ViperFixture<KeyT, ValueT, IndexT>::insert(uint64_t start_idx, uint64_t end_idx) {
     uint64_t insert_counter = 0;
     auto v_client = viper_->get_client();
     for (uint64_t key = start_idx; key < end_idx; ++key) {
@@ -102,13 +102,13 @@ uint64_t ViperFixture<std::string, std::string>::insert(uint64_t start_idx, uint
     return insert_counter;
 }
 
-template <typename KeyT, typename ValueT>
-uint64_t ViperFixture<KeyT, ValueT>::setup_and_insert(uint64_t start_idx, uint64_t end_idx) {
+template <typename KeyT, typename ValueT, typename IndexT>
+uint64_t ViperFixture<KeyT, ValueT, IndexT>::setup_and_insert(uint64_t start_idx, uint64_t end_idx) {
     return insert(start_idx, end_idx);
 }
 
-template <typename KeyT, typename ValueT>
-uint64_t ViperFixture<KeyT, ValueT>::setup_and_find(uint64_t start_idx, uint64_t end_idx, uint64_t num_finds) {
+template <typename KeyT, typename ValueT, typename IndexT>
+uint64_t ViperFixture<KeyT, ValueT, IndexT>::setup_and_find(uint64_t start_idx, uint64_t end_idx, uint64_t num_finds) {
     std::random_device rnd{};
     auto rnd_engine = std::default_random_engine(rnd());
     std::uniform_int_distribution<> distrib(start_idx, end_idx);
@@ -147,8 +147,8 @@ uint64_t ViperFixture<std::string, std::string>::setup_and_find(uint64_t start_i
     return found_counter;
 }
 
-template <typename KeyT, typename ValueT>
-uint64_t ViperFixture<KeyT, ValueT>::setup_and_delete(uint64_t start_idx, uint64_t end_idx, uint64_t num_deletes) {
+template <typename KeyT, typename ValueT, typename IndexT>
+uint64_t ViperFixture<KeyT, ValueT, IndexT>::setup_and_delete(uint64_t start_idx, uint64_t end_idx, uint64_t num_deletes) {
     std::random_device rnd{};
     auto rnd_engine = std::default_random_engine(rnd());
     std::uniform_int_distribution<> distrib(start_idx, end_idx);
@@ -180,8 +180,8 @@ uint64_t ViperFixture<std::string, std::string>::setup_and_delete(uint64_t start
     return delete_counter;
 }
 
-template <typename KeyT, typename ValueT>
-uint64_t ViperFixture<KeyT, ValueT>::setup_and_update(uint64_t start_idx, uint64_t end_idx, uint64_t num_updates) {
+template <typename KeyT, typename ValueT, typename IndexT>
+uint64_t ViperFixture<KeyT, ValueT, IndexT>::setup_and_update(uint64_t start_idx, uint64_t end_idx, uint64_t num_updates) {
     std::random_device rnd{};
     auto rnd_engine = std::default_random_engine(rnd());
     std::uniform_int_distribution<> distrib(start_idx, end_idx);
@@ -207,8 +207,8 @@ uint64_t ViperFixture<std::string, std::string>::setup_and_update(uint64_t start
     throw std::runtime_error("Not supported");
 }
 
-template <typename KeyT, typename ValueT>
-uint64_t ViperFixture<KeyT, ValueT>::setup_and_get_update(uint64_t start_idx, uint64_t end_idx, uint64_t num_updates) {
+template <typename KeyT, typename ValueT, typename IndexT>
+uint64_t ViperFixture<KeyT, ValueT, IndexT>::setup_and_get_update(uint64_t start_idx, uint64_t end_idx, uint64_t num_updates) {
     std::random_device rnd{};
     auto rnd_engine = std::default_random_engine(rnd());
     std::uniform_int_distribution<> distrib(start_idx, end_idx);
@@ -232,8 +232,8 @@ uint64_t ViperFixture<std::string, std::string>::setup_and_get_update(uint64_t,
     throw std::runtime_error("Not supported");
 }
 
-template <typename KeyT, typename ValueT>
-uint64_t ViperFixture<KeyT, ValueT>::run_ycsb(uint64_t, uint64_t, const std::vector<ycsb::Record>&, hdr_histogram*) {
+template <typename KeyT, typename ValueT, typename IndexT>
+uint64_t ViperFixture<KeyT, ValueT, IndexT>::run_ycsb(uint64_t, uint64_t, const std::vector<ycsb::Record>&, hdr_histogram*) {
     throw std::runtime_error{"YCSB not implemented for non-ycsb key/value types."};
 }
 
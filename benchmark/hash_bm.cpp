@@ -0,0 +1,115 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+
+#include "benchmark.hpp"
+#include "viper/cceh.hpp"
+
+using namespace viper::kv_bm;
+using namespace viper::cceh;
+
+constexpr size_t HASH_NUM_KEYS = 10'000'000;
+constexpr size_t HASH_NUM_SEGMENT_BITS = 12;
+
+#define GENERAL_ARGS \
+            ->Iterations(1) \
+            ->Unit(benchmark::TimeUnit::kMillisecond) \
+            ->UseRealTime()
+
+/** Keys of the benchmarks: sequential ids, random ids, fixed-size records, and variable-size strings. */
+template <typename KeyT>
+std::vector<KeyT> generate_keys(const bool is_random) {
+    std::vector<KeyT> keys;
+    keys.reserve(HASH_NUM_KEYS);
+    std::mt19937_64 rng{42};
+    if constexpr (std::is_same_v<KeyT, std::string>) {
+        static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+        std::normal_distribution<> length_dist(is_random ? 100 : 16, is_random ? 20 : 3);
+        std::uniform_int_distribution<> char_dist(0, sizeof(alphabet) - 2);
+        for (size_t i = 0; i < HASH_NUM_KEYS; ++i) {
+            std::string key(std::max(1l, std::lround(length_dist(rng))), 'a');
+            for (char& c : key) {
+                c = alphabet[char_dist(rng)];
+            }
+            keys.push_back(std::move(key));
+        }
+    } else {
+        for (uint64_t i = 0; i < HASH_NUM_KEYS; ++i) {
+            keys.emplace_back(is_random ? rng() : i);
+        }
+    }
+    return keys;
+}
+
+template <typename HashPolicy, typename KeyT>
+inline size_t hash_key(const KeyT& key) {
+    if constexpr (std::is_same_v<KeyT, std::string>) {
+        return HashPolicy::Hash(key.data(), key.length());
+    } else {
+        return HashPolicy::Hash(&key, sizeof(key));
+    }
+}
+
+/** Largest bucket divided by the average bucket. 1.0 is a perfect balance. */
+inline double max_to_mean(const std::vector<size_t>& buckets) {
+    const size_t max_bucket = *std::max_element(buckets.begin(), buckets.end());
+    return static_cast<double>(max_bucket) * buckets.size() / HASH_NUM_KEYS;
+}
+
+/**
+ * Measures the hash throughput and how evenly the hashes spread over CCEH's segments (top bits) and over the cache
+ * lines of a segment (lowest bits). A weak hash shows up as skewed segments, which split earlier.
+ */
+template <typename HashPolicy, typename KeyT>
+void bm_hash(benchmark::State& state, const bool is_random) {
+    const std::vector<KeyT> keys = generate_keys<KeyT>(is_random);
+    std::vector<size_t> hashes(HASH_NUM_KEYS);
+
+    uint64_t duration_ns = 0;
+    for (auto _ : state) {
+        const auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < HASH_NUM_KEYS; ++i) {
+            hashes[i] = hash_key<HashPolicy>(keys[i]);
+        }
+        benchmark::DoNotOptimize(hashes.data());
+        benchmark::ClobberMemory();
+        const auto end = std::chrono::high_resolution_clock::now();
+        duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    }
+
+    std::vector<size_t> segments(1ul << HASH_NUM_SEGMENT_BITS);
+    std::vector<size_t> lines(kMask + 1);
+    for (const size_t hash : hashes) {
+        segments[hash >> (8 * sizeof(hash) - HASH_NUM_SEGMENT_BITS)]++;
+        lines[hash & kMask]++;
+    }
+
+    state.SetItemsProcessed(HASH_NUM_KEYS);
+    state.counters["ns_per_hash"] = static_cast<double>(duration_ns) / HASH_NUM_KEYS;
+    state.counters["segment_skew"] = max_to_mean(segments);
+    state.counters["line_skew"] = max_to_mean(lines);
+}
+
+#define DEFINE_HASH_BM(policy, key_type, name) \
+    void policy ##_ ##name(benchmark::State& state, const bool is_random) { \
+        bm_hash<policy, key_type>(state, is_random); } \
+    BENCHMARK_CAPTURE(policy ##_ ##name, sequential, false) GENERAL_ARGS; \
+    BENCHMARK_CAPTURE(policy ##_ ##name, random, true) GENERAL_ARGS;
+
+#define DEFINE_POLICY_BMS(policy) \
+    DEFINE_HASH_BM(policy, uint64_t, u64) \
+    DEFINE_HASH_BM(policy, KeyType16, k16) \
+    DEFINE_HASH_BM(policy, KeyType32, k32) \
+    DEFINE_HASH_BM(policy, KeyType100, k100) \
+    DEFINE_HASH_BM(policy, std::string, str)  // sequential: ~16 chars, random: ~100 chars
+
+DEFINE_POLICY_BMS(StdHash);
+DEFINE_POLICY_BMS(MultiplyShiftHash);
+DEFINE_POLICY_BMS(Crc32cHash);
+DEFINE_POLICY_BMS(WideBlockHash);
+
+int main(int argc, char** argv) {
+    std::string exec_name = argv[0];
+    const std::string arg = get_output_file("hash/hash");
+    return bm_main({exec_name, arg});
+}
@@ -0,0 +1,143 @@
+#include <benchmark/benchmark.h>
+
+#include "benchmark.hpp"
+#include "fixtures/viper_fixture.hpp"
+#include "viper/dash_index.hpp"
+
+using namespace viper::kv_bm;
+
+constexpr size_t INDEX_NUM_REPETITIONS = 1;
+constexpr size_t INDEX_NUM_PREFILLS = 100'000'000;
+constexpr size_t INDEX_NUM_INSERTS = 50'000'000;
+constexpr size_t INDEX_NUM_FINDS = 50'000'000;
+constexpr size_t INDEX_NUM_DELETES = 50'000'000;
+
+using CcehFixture = ViperFixture<KeyType16, ValueType200, viper::cceh::CCEH<KeyType16>>;
+using DashFixture = ViperFixture<KeyType16, ValueType200, viper::dash::DashIndex<KeyType16>>;
+
+#define GENERAL_ARGS \
+              Repetitions(INDEX_NUM_REPETITIONS) \
+            ->Iterations(1) \
+            ->Unit(BM_TIME_UNIT) \
+            ->UseRealTime() \
+            ->ThreadRange(1, NUM_MAX_THREADS) \
+            ->Threads(24)
+
+#define DEFINE_BM(fixture, method) \
+            BENCHMARK_DEFINE_F(fixture, method)(benchmark::State& state) { \
+                bm_##method(state, *this); \
+            } \
+            BENCHMARK_REGISTER_F(fixture, method)->GENERAL_ARGS
+
+#define ALL_BMS(fixture) \
+            DEFINE_BM(fixture, insert)->Args({INDEX_NUM_PREFILLS, INDEX_NUM_INSERTS}); \
+            DEFINE_BM(fixture, get)   ->Args({INDEX_NUM_PREFILLS, INDEX_NUM_FINDS}); \
+            DEFINE_BM(fixture, delete)->Args({INDEX_NUM_PREFILLS, INDEX_NUM_DELETES})
+
+/** Reports how densely the index is filled, i.e., how many keys share a segment and how much DRAM a key needs. */
+template <typename FixtureT>
+void log_index_stats(benchmark::State& state, FixtureT& fixture) {
+    const viper::cceh::IndexStats stats = fixture.getViper()->get_client().get_stats().index;
+    state.counters["segments"] = stats.num_segments;
+    state.counters["keys_per_segment"] = static_cast<double>(stats.num_keys) / stats.num_segments;
+    state.counters["load_factor"] = static_cast<double>(stats.num_keys) / stats.num_slots;
+    state.counters["bytes_per_key"] = static_cast<double>(stats.allocated_bytes) / stats.num_keys;
+}
+
+template <typename FixtureT>
+void bm_insert(benchmark::State& state, FixtureT& fixture) {
+    const uint64_t num_total_prefill = state.range(0);
+    const uint64_t num_total_inserts = state.range(1);
+
+    set_cpu_affinity(state.thread_index);
+
+    if (is_init_thread(state)) {
+        fixture.InitMap(num_total_prefill);
+    }
+
+    const uint64_t num_inserts_per_thread = (num_total_inserts / state.threads) + 1;
+    const uint64_t start_idx = (state.thread_index * num_inserts_per_thread) + num_total_prefill;
+    const uint64_t end_idx = std::min(start_idx + num_inserts_per_thread, num_total_prefill + num_total_inserts);
+
+    uint64_t insert_counter = 0;
+    for (auto _ : state) {
+        insert_counter = fixture.setup_and_insert(start_idx, end_idx);
+    }
+
+    state.SetItemsProcessed(num_inserts_per_thread);
+
+    if (is_init_thread(state)) {
+        log_index_stats(state, fixture);
+        fixture.DeInitMap();
+    }
+
+    BaseFixture::log_find_count(state, insert_counter, end_idx - start_idx);
+}
+
+template <typename FixtureT>
+void bm_get(benchmark::State& state, FixtureT& fixture) {
+    const uint64_t num_total_prefills = state.range(0);
+    const uint64_t num_total_finds = state.range(1);
+
+    set_cpu_affinity(state.thread_index);
+
+    if (is_init_thread(state)) {
+        fixture.InitMap(num_total_prefills);
+    }
+
+    const uint64_t num_finds_per_thread = (num_total_finds / state.threads) + 1;
+    const uint64_t start_idx = 0;
+    const uint64_t end_idx = num_total_prefills - state.threads;
+
+    uint64_t found_counter = 0;
+    for (auto _ : state) {
+        found_counter = fixture.setup_and_find(start_idx, end_idx, num_finds_per_thread);
+    }
+
+    state.SetItemsProcessed(num_finds_per_thread);
+
+    if (is_init_thread(state)) {
+        log_index_stats(state, fixture);
+        fixture.DeInitMap();
+    }
+
+    BaseFixture::log_find_count(state, found_counter, num_finds_per_thread);
+}
+
+template <typename FixtureT>
+void bm_delete(benchmark::State& state, FixtureT& fixture) {
+    const uint64_t num_total_prefills = state.range(0);
+    const uint64_t num_total_deletes = state.range(1);
+
+    set_cpu_affinity(state.thread_index);
+
+    if (is_init_thread(state)) {
+        fixture.InitMap(num_total_prefills);
+    }
+
+    const uint64_t num_deletes_per_thread = (num_total_deletes / state.threads) + 1;
+    const uint64_t start_idx = 0;
+    const uint64_t end_idx = num_total_prefills - state.threads;
+
+    uint64_t found_counter = 0;
+    for (auto _ : state) {
+        found_counter = fixture.setup_and_delete(start_idx, end_idx, num_deletes_per_thread);
+    }
+
+    state.SetItemsProcessed(found_counter);
+
+    if (is_init_thread(state)) {
+        fixture.DeInitMap();
+    }
+
+    BaseFixture::log_find_count(state, found_counter, found_counter);
+}
+
+ALL_BMS(CcehFixture);
+ALL_BMS(DashFixture);
+
+int main(int argc, char** argv) {
+    std::string exec_name = argv[0];
+    const std::string arg = get_output_file("index/index_backend");
+    return bm_main({exec_name, arg});
+}
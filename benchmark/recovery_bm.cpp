@@ -12,6 +12,7 @@ constexpr size_t RECLAIM_NUM_PREFILLS = 100'000'000;
 inline void bm_recovery(benchmark::State& state, VFixture& fixture) {
     const uint64_t num_total_prefill = RECLAIM_NUM_PREFILLS;
     const uint64_t recovery_threads = state.range(0);
+    const bool bulk_recovery = state.range(1);
 
     fixture.InitMap(num_total_prefill);
     fixture.DeInitMap();
@@ -19,6 +20,8 @@ inline void bm_recovery(benchmark::State& state, VFixture& fixture) {
     std::unique_ptr<VFixture::ViperT> viper;
     viper::ViperConfig v_config{};
     v_config.num_recovery_threads = recovery_threads;
+    v_config.enable_bulk_recovery = bulk_recovery;
+    v_config.enable_ordered_index = bulk_recovery;
 
     set_cpu_affinity(0, 36);
     uint64_t rec_time_ms = 0;
@@ -39,8 +42,10 @@ BENCHMARK_TEMPLATE2_DEFINE_F(ViperFixture, recovery, KeyType16, ValueType200)(be
 
 BENCHMARK_REGISTER_F(ViperFixture, recovery)
     ->Iterations(1)->Unit(BM_TIME_UNIT)->UseRealTime()
-    ->Arg(1)->Arg(2)->Arg(4)->Arg(8)
-    ->Arg(16)->Arg(24)->Arg(32)->Arg(36);
+    ->Args({1, 0})->Args({2, 0})->Args({4, 0})->Args({8, 0})
+    ->Args({16, 0})->Args({24, 0})->Args({32, 0})->Args({36, 0})
+    ->Args({1, 1})->Args({2, 1})->Args({4, 1})->Args({8, 1})
+    ->Args({16, 1})->Args({24, 1})->Args({32, 1})->Args({36, 1});
 
 int main(int argc, char** argv) {
     std::string exec_name = argv[0];
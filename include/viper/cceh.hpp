@@ -17,23 +17,39 @@
 /**
  * Define this to use CCEH in PMem instead of DRAM.
  * Change the file location (CCEH_PMEM_POOL_FILE) above the PMemAllocator definition to a location of your choice.
+ * For a persistent index inside a Viper pool, use `ViperConfig::enable_persistent_index` instead (see PersistentArena).
  */
 //#define CCEH_PERSISTENT
 
 #include <cstring>
+#include <string_view>
 #include <cmath>
 #include <vector>
 #include <stdint.h>
 #include <iostream>
 #include <cmath>
 #include <thread>
+#include <array>
 #include <bitset>
 #include <cassert>
 #include <unordered_map>
+#include <map>
 #include <atomic>
 #include <stdlib.h>
-
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <immintrin.h>
+#include <memory>
+#include <string>
+#include <typeinfo>
+#include <algorithm>
+
+#include "epoch.hpp"
 #include "hash.hpp"
+#include "numa.hpp"
 
 #ifdef CCEH_PERSISTENT
 #include <libpmemobj++/allocator.hpp>
@@ -97,6 +113,369 @@ class PMemAllocator {
     pmem::obj::pool_base pmem_pool_;
     bool pool_is_open_;
 };
+#else
+/**
+ * Allocates the volatile segments from 2 MiB huge pages, so that probes into many segments need few TLB entries.
+ * Chunks are mapped with MAP_HUGETLB if huge pages are reserved, else transparent huge pages are requested.
+ * Freed segments are kept in a free list per size and reused. Their whole pages are returned to the OS, so
+ * that memory shrinks after segments were merged. Inside a numa::NodeScope, memory comes from chunks on that node.
+ */
+class SegmentArena {
+  public:
+    static constexpr size_t kHugePageSize = 2ul * 1024 * 1024;
+    static constexpr size_t kChunkSize = 16 * kHugePageSize;
+    static constexpr size_t kAlignment = 64;
+    static constexpr size_t kPageSize = 4096;
+
+    static SegmentArena& get() {
+        static SegmentArena instance{};
+        return instance;
+    }
+
+    void* allocate(size_t size) {
+        size = (size + kAlignment - 1) & ~(kAlignment - 1);
+        const size_t node = numa::AllocationNode();
+        std::lock_guard lock{lock_};
+        NodeChunks& chunks = node_chunks_[node == numa::kAnyNode ? numa::kMaxNodes : node];
+        std::vector<void*>& free_list = chunks.free_lists[size];
+        if (!free_list.empty()) {
+            void* ret = free_list.back();
+            free_list.pop_back();
+            return ret;
+        }
+
+        if (chunks.chunk_pos + size > chunks.chunk_end) {
+            const size_t chunk_size = std::max(kChunkSize, (size + kHugePageSize - 1) & ~(kHugePageSize - 1));
+            chunks.chunk_pos = map_chunk(chunk_size);
+            chunks.chunk_end = chunks.chunk_pos + chunk_size;
+            if (node != numa::kAnyNode) {
+                // Before the first access, so that all pages are allocated on the node.
+                numa::PreferNode(chunks.chunk_pos, chunk_size, node);
+            }
+            chunk_starts_[reinterpret_cast<uintptr_t>(chunks.chunk_pos)] = &chunks - node_chunks_;
+        }
+        void* ret = chunks.chunk_pos;
+        chunks.chunk_pos += size;
+        return ret;
+    }
+
+    void free(void* addr, size_t size) {
+        size = (size + kAlignment - 1) & ~(kAlignment - 1);
+        const uintptr_t start = reinterpret_cast<uintptr_t>(addr);
+        const uintptr_t page_start = (start + kPageSize - 1) & ~(kPageSize - 1);
+        const uintptr_t page_end = (start + size) & ~(kPageSize - 1);
+        if (page_end > page_start) {
+            // Fails for MAP_HUGETLB chunks, whose pages are then only reused.
+            madvise(reinterpret_cast<void*>(page_start), page_end - page_start, MADV_DONTNEED);
+        }
+        std::lock_guard lock{lock_};
+        // Memory is freed by any thread, so its node is the one of the chunk it belongs to.
+        const size_t chunks_num = std::prev(chunk_starts_.upper_bound(start))->second;
+        node_chunks_[chunks_num].free_lists[size].push_back(addr);
+    }
+
+  protected:
+    static char* map_chunk(const size_t chunk_size) {
+        void* addr = mmap(nullptr, chunk_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (addr != MAP_FAILED) {
+            return static_cast<char*>(addr);
+        }
+
+        // No reserved huge pages. Over-allocate to align the chunk to a huge page for THP.
+        const size_t mapped_size = chunk_size + kHugePageSize;
+        addr = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            throw std::bad_alloc{};
+        }
+        const uintptr_t start = reinterpret_cast<uintptr_t>(addr);
+        const uintptr_t aligned_start = (start + kHugePageSize - 1) & ~(kHugePageSize - 1);
+        if (aligned_start > start) {
+            munmap(addr, aligned_start - start);
+        }
+        const size_t tail_size = (start + mapped_size) - (aligned_start + chunk_size);
+        if (tail_size > 0) {
+            munmap(reinterpret_cast<void*>(aligned_start + chunk_size), tail_size);
+        }
+        madvise(reinterpret_cast<void*>(aligned_start), chunk_size, MADV_HUGEPAGE);
+        return reinterpret_cast<char*>(aligned_start);
+    }
+
+    struct NodeChunks {
+        char* chunk_pos = nullptr;
+        char* chunk_end = nullptr;
+        std::unordered_map<size_t, std::vector<void*>> free_lists;
+    };
+
+    std::mutex lock_;
+    // One per node and a last one for allocations outside of a NodeScope.
+    NodeChunks node_chunks_[numa::kMaxNodes + 1];
+    std::map<uintptr_t, size_t> chunk_starts_;
+};
+#endif
+
+/**
+ * Allocates index memory from a file, e.g., in the directory of a Viper pool, so that an index survives a restart.
+ * The file is always mapped at the address it was created at, so pointers between segments and the directory stay
+ * valid and the index is used in place after reopening it. Memory is only written back on Close, so the content is
+ * only valid after a clean close. After a crash, or if the address range is taken, the content is discarded.
+ * Inside a PersistentArena::Scope, CCEH allocates its segments and directory from the arena.
+ */
+class PersistentArena {
+  public:
+    static constexpr uint64_t kMagic = 0x5649504552494458; // "VIPERIDX"
+    static constexpr size_t kHeaderSize = 4096;
+    static constexpr size_t kGrowSize = 64ul * 1024 * 1024;
+    static constexpr size_t kAlignment = 64;
+    // Address space reserved for each arena and the candidate addresses, far away from where the OS maps memory.
+    static constexpr uintptr_t kFirstBase = 0x100000000000;
+    static constexpr size_t kReservedSize = 1ul << 40;
+    static constexpr size_t kNumBases = 16;
+    static constexpr size_t kNumFreeLists = 64;
+
+    /**
+     * Opens the arena in `file` or creates it. With `discard`, or if the file is not a cleanly closed arena or its
+     * address range is in use, it is emptied. Returns nullptr if none of the candidate address ranges is free.
+     */
+    static std::unique_ptr<PersistentArena> Open(const std::string& file, const bool discard) {
+        const int fd = ::open(file.c_str(), O_CREAT | O_RDWR, 0600);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open index file " + file + ": " + std::strerror(errno));
+        }
+
+        Header header{};
+        struct stat file_stat{};
+        const bool has_header = fstat(fd, &file_stat) == 0 && file_stat.st_size >= static_cast<off_t>(kHeaderSize) &&
+                                pread(fd, &header, sizeof(header), 0) == sizeof(header);
+        if (!discard && has_header && header.magic == kMagic && header.is_clean &&
+            header.mapped_size <= static_cast<size_t>(file_stat.st_size)) {
+            char* base = Reserve(header.base_address);
+            if (base != nullptr) {
+                return std::unique_ptr<PersistentArena>{new PersistentArena{fd, base, header.mapped_size}};
+            }
+        }
+
+        // Start over with an empty arena at the first free address.
+        char* base = nullptr;
+        for (size_t i = 0; i < kNumBases && base == nullptr; ++i) {
+            base = Reserve(kFirstBase + i * kReservedSize);
+        }
+        if (base == nullptr) {
+            ::close(fd);
+            return nullptr;
+        }
+        if (ftruncate(fd, 0) != 0 || ftruncate(fd, kGrowSize) != 0) {
+            munmap(base, kReservedSize);
+            ::close(fd);
+            throw std::runtime_error("Cannot resize index file " + file + ": " + std::strerror(errno));
+        }
+        auto arena = std::unique_ptr<PersistentArena>{new PersistentArena{fd, base, kGrowSize}};
+        *arena->header_ = Header{.magic = kMagic, .base_address = reinterpret_cast<uintptr_t>(base),
+                                 .mapped_size = kGrowSize, .used_size = kHeaderSize, .is_clean = false,
+                                 .root = 0, .free_lists = {}};
+        return arena;
+    }
+
+    ~PersistentArena() {
+        {
+            std::lock_guard lock{registry_lock_};
+            registry_.erase(std::find(registry_.begin(), registry_.end(), this));
+            num_open_.fetch_sub(1);
+        }
+        munmap(header_, kReservedSize);
+        ::close(fd_);
+    }
+
+    PersistentArena(const PersistentArena&) = delete;
+    PersistentArena& operator=(const PersistentArena&) = delete;
+
+    void* allocate(size_t size) {
+        size = (size + kAlignment - 1) & ~(kAlignment - 1);
+        std::lock_guard lock{lock_};
+        FreeList* free_list = FindFreeList(size);
+        if (free_list != nullptr && free_list->head != 0) {
+            void* ret = reinterpret_cast<void*>(free_list->head);
+            free_list->head = *static_cast<uintptr_t*>(ret);
+            return ret;
+        }
+
+        if (header_->used_size + size > header_->mapped_size) {
+            Grow(header_->used_size + size);
+        }
+        void* ret = reinterpret_cast<char*>(header_) + header_->used_size;
+        header_->used_size += size;
+        return ret;
+    }
+
+    /** Freed memory is kept in a list per size, which is stored in the freed memory itself. */
+    void free(void* addr, size_t size) {
+        size = (size + kAlignment - 1) & ~(kAlignment - 1);
+        std::lock_guard lock{lock_};
+        FreeList* free_list = FindFreeList(size);
+        if (free_list == nullptr) {
+            // More sizes than lists. The memory is only reused after the arena is emptied.
+            return;
+        }
+        *static_cast<uintptr_t*>(addr) = free_list->head;
+        free_list->head = reinterpret_cast<uintptr_t>(addr);
+    }
+
+    /** True if the arena was closed cleanly and its content was not discarded on open. */
+    bool IsClean() const { return header_->is_clean; }
+
+    /** Object from which the owner finds all others, e.g., the directory of an index. */
+    void* Root() const { return reinterpret_cast<void*>(header_->root); }
+    void SetRoot(void* root) { header_->root = reinterpret_cast<uintptr_t>(root); }
+
+    /** Marks the content as modified, so that it is discarded if the process exits before the next Close. */
+    void MarkDirty() {
+        header_->is_clean = false;
+        Sync(header_, kHeaderSize);
+    }
+
+    /** Writes all memory back to the file and marks it clean. No memory may be modified afterwards. */
+    void Close() {
+        Sync(header_, header_->mapped_size);
+        header_->is_clean = true;
+        Sync(header_, kHeaderSize);
+    }
+
+    /** Arena that `addr` was allocated from, or nullptr. Memory is freed by any thread, e.g., after an epoch. */
+    static PersistentArena* Owner(const void* addr) {
+        if (num_open_.load(std::memory_order_acquire) == 0) {
+            return nullptr;
+        }
+        const uintptr_t address = reinterpret_cast<uintptr_t>(addr);
+        std::lock_guard lock{registry_lock_};
+        for (PersistentArena* arena : registry_) {
+            const uintptr_t base = reinterpret_cast<uintptr_t>(arena->header_);
+            if (address >= base && address < base + kReservedSize) {
+                return arena;
+            }
+        }
+        return nullptr;
+    }
+
+    /** Arena that the calling thread allocates index memory from, or nullptr. See Scope. */
+    static PersistentArena*& Current() {
+        thread_local PersistentArena* arena = nullptr;
+        return arena;
+    }
+
+    /** Sets the arena that the calling thread allocates index memory from for its lifetime. */
+    class Scope {
+      public:
+        explicit Scope(PersistentArena* arena) : previous_arena_{Current()} { Current() = arena; }
+        ~Scope() { Current() = previous_arena_; }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+      private:
+        PersistentArena* const previous_arena_;
+    };
+
+  protected:
+    struct FreeList {
+        uint64_t size;
+        uintptr_t head;
+    };
+
+    struct Header {
+        uint64_t magic;
+        uintptr_t base_address;
+        uint64_t mapped_size;
+        uint64_t used_size;
+        uint64_t is_clean;
+        uintptr_t root;
+        FreeList free_lists[kNumFreeLists];
+    };
+    static_assert(sizeof(Header) <= kHeaderSize);
+
+    PersistentArena(const int fd, char* base, const size_t mapped_size) : fd_{fd} {
+        MapFile(base, 0, mapped_size);
+        header_ = reinterpret_cast<Header*>(base);
+        std::lock_guard lock{registry_lock_};
+        registry_.push_back(this);
+        num_open_.fetch_add(1);
+    }
+
+    /** Reserves kReservedSize bytes of address space at `address`. Returns nullptr if they are in use. */
+    static char* Reserve(const uintptr_t address) {
+        void* hint = reinterpret_cast<void*>(address);
+        void* addr = mmap(hint, kReservedSize, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+        if (addr == MAP_FAILED) {
+            return nullptr;
+        }
+        if (addr != hint) {
+            // Kernels before 4.17 treat the address as a hint.
+            munmap(addr, kReservedSize);
+            return nullptr;
+        }
+        return static_cast<char*>(addr);
+    }
+
+    void MapFile(char* base, const size_t offset, const size_t length) {
+        void* addr = mmap(base + offset, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd_, offset);
+        if (addr == MAP_FAILED) {
+            throw std::bad_alloc{};
+        }
+    }
+
+    void Grow(const size_t min_size) {
+        const size_t new_size = (min_size + kGrowSize - 1) & ~(kGrowSize - 1);
+        if (new_size > kReservedSize || ftruncate(fd_, new_size) != 0) {
+            throw std::bad_alloc{};
+        }
+        MapFile(reinterpret_cast<char*>(header_), header_->mapped_size, new_size - header_->mapped_size);
+        header_->mapped_size = new_size;
+    }
+
+    /** Free list for `size`, which is created if there is none yet. Returns nullptr if all lists are used. */
+    FreeList* FindFreeList(const size_t size) {
+        for (FreeList& free_list : header_->free_lists) {
+            if (free_list.size == size) {
+                return &free_list;
+            }
+            if (free_list.size == 0) {
+                free_list.size = size;
+                return &free_list;
+            }
+        }
+        return nullptr;
+    }
+
+    static void Sync(void* addr, const size_t length) {
+        if (msync(addr, length, MS_SYNC) != 0) {
+            throw std::runtime_error(std::string("Cannot write back index file: ") + std::strerror(errno));
+        }
+    }
+
+    const int fd_;
+    Header* header_;
+    std::mutex lock_;
+
+    static inline std::mutex registry_lock_;
+    static inline std::vector<PersistentArena*> registry_;
+    static inline std::atomic<size_t> num_open_ = 0;
+};
+
+#ifndef CCEH_PERSISTENT
+/** Allocates index memory from the PersistentArena of the calling thread's scope or else from the SegmentArena. */
+inline void* allocate_index_memory(const size_t size) {
+    if (PersistentArena* arena = PersistentArena::Current()) {
+        return arena->allocate(size);
+    }
+    return SegmentArena::get().allocate(size);
+}
+
+inline void free_index_memory(void* addr, const size_t size) {
+    if (PersistentArena* arena = PersistentArena::Owner(addr)) {
+        arena->free(addr, size);
+    } else {
+        SegmentArena::get().free(addr, size);
+    }
+}
 #endif
 
 
@@ -185,6 +564,8 @@ constexpr size_t kNumPairPerCacheLine = 4;
 constexpr size_t kNumCacheLine = 4;
 
 constexpr uint64_t SPLIT_REQUEST_BIT = 1ul << 63;
+// Set while a split copies the upper half of the keys. Writers of keys in the lower half may still enter.
+constexpr uint64_t SPLIT_COPY_BIT = 1ul << 62;
 constexpr uint64_t EXCLUSIVE_LOCK = -1;
 
 struct Pair {
@@ -208,9 +589,179 @@ inline void persist(void* data, size_t len) {
 #endif
 }
 
-template <typename KeyType>
+/**
+ * Counter that many threads update on every operation and that is read rarely, e.g., by a metrics scraper. Each
+ * thread adds to one of kNumStripes cache lines, so updates do not contend. Reading sums all stripes.
+ */
+class StripedCounter {
+  public:
+    static constexpr size_t kNumStripes = 16;
+
+    void Add(const int64_t delta) {
+        stripes_[ThreadStripe()].value.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    /** Not a snapshot while other threads update the counter, so it may briefly be off by their pending updates. */
+    size_t Load() const {
+        int64_t sum = 0;
+        for (const Stripe& stripe : stripes_) {
+            sum += stripe.value.load(std::memory_order_relaxed);
+        }
+        return std::max<int64_t>(sum, 0);
+    }
+
+  private:
+    static size_t ThreadStripe() {
+        static std::atomic<size_t> next_stripe = 0;
+        thread_local const size_t stripe = next_stripe.fetch_add(1, std::memory_order_relaxed) % kNumStripes;
+        return stripe;
+    }
+
+    struct alignas(64) Stripe {
+        std::atomic<int64_t> value = 0;
+    };
+
+    Stripe stripes_[kNumStripes];
+};
+
+/** Statistics of an index. The index maintains them on every change, so reading them does not scan it. */
+struct IndexStats {
+    size_t num_segments = 0;
+    size_t directory_depth = 0;
+    // Number of directory entries.
+    size_t directory_size = 0;
+    size_t num_slots = 0;
+    size_t num_keys = 0;
+    // Slots that still hold keys moved away by a split. They are freed by later inserts into the same window.
+    size_t num_stale_slots = 0;
+    // `num_keys` + `num_stale_slots`.
+    size_t num_occupied_slots = 0;
+    size_t num_splits = 0;
+    size_t num_merges = 0;
+    // DRAM (or PMem if CCEH_PERSISTENT) of the live segments and the directory.
+    size_t allocated_bytes = 0;
+};
+
+/** Counters from which an index computes its IndexStats. */
+struct IndexCounters {
+    StripedCounter num_keys;
+    StripedCounter num_stale_slots;
+    std::atomic<size_t> num_segments = 0;
+    std::atomic<size_t> num_splits = 0;
+    std::atomic<size_t> num_merges = 0;
+
+    /** Adds the change of one insert or delete that replaced `old_entry` with `new_entry`. */
+    void CountReplace(const IndexV old_entry, const IndexV new_entry) {
+        const int64_t delta = int64_t{!new_entry.is_tombstone()} - int64_t{!old_entry.is_tombstone()};
+        if (delta != 0) {
+            num_keys.Add(delta);
+        }
+    }
+
+    template <typename SegmentT, typename DirectoryT>
+    IndexStats Stats(const DirectoryT* dir) const {
+        IndexStats stats{};
+        stats.num_segments = num_segments.load(std::memory_order_relaxed);
+        stats.directory_depth = ATOMIC_LOAD(&dir->depth);
+        stats.directory_size = ATOMIC_LOAD(&dir->capacity);
+        stats.num_slots = stats.num_segments * (SegmentT::kNumSlot + SegmentT::kNumStashSlot);
+        stats.num_keys = num_keys.Load();
+        stats.num_stale_slots = num_stale_slots.Load();
+        stats.num_occupied_slots = stats.num_keys + stats.num_stale_slots;
+        stats.num_splits = num_splits.load(std::memory_order_relaxed);
+        stats.num_merges = num_merges.load(std::memory_order_relaxed);
+        stats.allocated_bytes = stats.num_segments * sizeof(SegmentT) + stats.directory_size * sizeof(SegmentT*) +
+                                sizeof(DirectoryT);
+        return stats;
+    }
+};
+
+/**
+ * Computes the hash of a key. The top bits select the segment and the lowest kSegmentBits select the bucket.
+ * By default, this is `HashPolicy::Hash()` (see hash.hpp). For keys without fingerprints, a CDF model of the keys can
+ * be trained instead. The CDF position then selects the segment, so segments cover equally many keys and split
+ * evenly, e.g., for sequential ids. Keys outside of the trained range are still hashed with `HashPolicy::Hash()`.
+ */
+template <typename KeyType, typename HashPolicy = StdHash>
+class KeyHasher {
+  public:
+    size_t operator()(const KeyType& key) const {
+        if constexpr (std::is_same_v<KeyType, std::string>) {
+            return HashPolicy::Hash(key.data(), key.length());
+        } else if constexpr (!using_fp_) {
+            if (cdf_.is_trained()) {
+                return learned_hash(model_key(key));
+            }
+        }
+        return HashPolicy::Hash(&key, sizeof(key));
+    }
+
+    /** Returns the hash of a key stored in a slot. Only used for keys without fingerprints. */
+    size_t stored_hash(const IndexK stored_key) const {
+        if constexpr (!using_fp_) {
+            if (cdf_.is_trained()) {
+                uint64_t key = 0;
+                memcpy(&key, &stored_key, sizeof(KeyType));
+                return learned_hash(key);
+            }
+        }
+        return HashPolicy::Hash(&stored_key, sizeof(IndexK));
+    }
+
+    /** Returns the hash of a key from its raw bytes, e.g., as stored in a record. Only used without a CDF model. */
+    size_t bytes_hash(const std::string_view key_bytes) const {
+        return HashPolicy::Hash(key_bytes.data(), key_bytes.size());
+    }
+
+    /** Trains the CDF model on a sample of the keys. Must not be called after keys were inserted with the old hash. */
+    bool Train(const std::vector<std::pair<KeyType, IndexV>>& entries) {
+        if constexpr (using_fp_) {
+            return false;
+        } else {
+            const size_t step = std::max(1ul, entries.size() / kMaxSampleSize);
+            std::vector<uint64_t> sample;
+            sample.reserve(entries.size() / step + 1);
+            for (size_t i = 0; i < entries.size(); i += step) {
+                sample.push_back(model_key(entries[i].first));
+            }
+            std::sort(sample.begin(), sample.end());
+            return cdf_.train(sample);
+        }
+    }
+
+    bool IsLearned() const {
+        return cdf_.is_trained();
+    }
+
+  private:
+    static constexpr bool using_fp_ = requires_fingerprint(KeyType);
+    static constexpr size_t kMaxSampleSize = 1 << 20;
+
+    static uint64_t model_key(const KeyType& key) {
+        uint64_t model_key = 0;
+        memcpy(&model_key, &key, sizeof(KeyType));
+        return model_key;
+    }
+
+    size_t learned_hash(const uint64_t key) const {
+        if (!cdf_.covers(key)) {
+            return HashPolicy::Hash(&key, sizeof(key));
+        }
+        // The CDF of neighbouring keys is nearly the same, so the bucket comes from a cheap multiplicative hash.
+        const size_t bucket = (key * 0x9E3779B97F4A7C15ul) >> (8 * sizeof(size_t) - kSegmentBits);
+        return (cdf_.predict(key) & ~kMask) | bucket;
+    }
+
+    CdfModel cdf_;
+};
+
+template <typename KeyType, bool kInlineKeys = false>
 struct Segment {
     static const size_t kNumSlot = kSegmentSize / sizeof(Pair);
+    static const size_t kNumWindowSlot = kNumPairPerCacheLine * kNumCacheLine;
+    // Keys whose first and second probe window are full go to the stash, which is one more window after the slots.
+    static const size_t kNumStashSlot = kNumWindowSlot;
+    static const size_t kNumWindow = 3;
 
     Segment(void)
         : local_depth{0}
@@ -226,29 +777,128 @@ struct Segment {
         PMemAllocator::get().allocate(&ret, size);
         return pmemobj_direct(ret);
 #else
-        void* ret;
-        if (posix_memalign(&ret, 64, size) != 0) throw std::runtime_error("bad memalign");
-        return ret;
+        return allocate_index_memory(size);
 #endif
     }
 
-    template <typename KeyCheckFn>
-    int Insert(const KeyType&, IndexV, size_t, size_t, IndexV* old_entry, KeyCheckFn);
+#ifdef CCEH_PERSISTENT
+    void operator delete(void* addr) {
+        PMEMoid oid = pmemobj_oid(addr);
+        pmemobj_free(&oid);
+    }
+#else
+    void operator delete(void* addr, size_t size) {
+        free_index_memory(addr, size);
+    }
+#endif
+
+    /** Decrements `counters.num_stale_slots` for each stale slot it frees. */
+    template <typename KeyCheckFn, typename Hasher>
+    int Insert(const KeyType&, IndexV, size_t key_hash, IndexV* old_entry, KeyCheckFn, const Hasher&,
+               IndexCounters& counters);
+
+    /**
+     * First slot of the `window`-th probe window of a key: its first window, a second one at a distance derived from
+     * other hash bits, and the stash. Each window has kNumWindowSlot slots and starts at a cache line.
+     */
+    static size_t WindowLoc(size_t key_hash, size_t window);
+
+    /** Slot of the `i`-th pair in the window at `loc`. Windows in the regular slots wrap around, the stash does not. */
+    static size_t WindowSlot(size_t loc, size_t i) {
+        return loc < kNumSlot ? (loc + i) % kNumSlot : loc + i;
+    }
+
+    /** Number of windows that may hold the key, i.e., 1 unless a key of its first window overflowed. */
+    size_t NumWindows(size_t key_hash) const {
+        const size_t line = key_hash & kMask;
+        return (overflow_bits[line / 64].load(std::memory_order_acquire) >> (line % 64)) & 1 ? kNumWindow : 1;
+    }
+
+    void MarkOverflow(size_t key_hash) {
+        const size_t line = key_hash & kMask;
+        if (((overflow_bits[line / 64].load() >> (line % 64)) & 1) == 0) {
+            overflow_bits[line / 64].fetch_or(1ul << (line % 64));
+        }
+    }
+
+    /**
+     * Returns a mask with bit i set if the i-th slot of the `line`-th cache line of the probe window at `loc` holds
+     * `key_checker`. With AVX-512 (AVX2), one (two) compare(s) check all keys of the line.
+     */
+    uint32_t ProbeLine(IndexK key_checker, size_t loc, size_t line) const;
+
+    /**
+     * Inserts into a segment that no other thread accesses. Returns false if all windows of the key are full.
+     * With kInlineKeys, `inline_key` is the key to store with the slot.
+     */
+    bool Insert4split(IndexK, IndexV, size_t key_hash, const KeyType* inline_key = nullptr);
+
+    /** Inline copy of the key in `slot` to pass to Insert4split, or nullptr without kInlineKeys. */
+    const KeyType* InlineKey(size_t slot) const {
+        if constexpr (kInlineKeys) {
+            return &inline_keys[slot];
+        } else {
+            return nullptr;
+        }
+    }
 
-    void Insert4split(IndexK, IndexV, size_t);
-    Segment** Split(void);
+    /** For keys with fingerprints: true if `slot`, whose fingerprint matches, holds `key` and not just its hash. */
+    template <typename KeyCheckFn>
+    bool HoldsKey(size_t slot, const KeyType& key, IndexV slot_value, KeyCheckFn key_check_fn) const {
+        if constexpr (kInlineKeys) {
+            return inline_keys[slot] == key;
+        } else {
+            return key_check_fn(key, slot_value);
+        }
+    }
 
-    Pair _[kNumSlot];
+    /**
+     * Moves the upper half of the keys to a new sibling and returns it, or nullptr if the segment cannot be split now.
+     * Only writers of moved keys wait while the keys are copied. Until the caller updates the directory, the sibling
+     * is reachable through `sibling`, so no other thread waits for the directory update. The moved keys stay behind
+     * as stale slots and are added to `counters.num_stale_slots`.
+     */
+    template <typename Hasher>
+    Segment* Split(size_t key_hash, const Hasher&, IndexCounters& counters);
+
+    /** True if the key with `key_hash` belongs to this segment. Merged segments do not cover any key. */
+    bool Covers(size_t key_hash) const;
+
+    /** Number of slots that hold a key of this segment, i.e., excluding keys left behind by a split. */
+    template <typename Hasher>
+    size_t NumLiveKeys(const Hasher&) const;
+
+    /**
+     * Returns the segment the key with `key_hash` belongs to. This is the sibling if the directory still points to
+     * this segment after a split. Returns nullptr if neither covers the key, i.e., the directory entry is outdated.
+     */
+    Segment* Resolve(size_t key_hash);
+
+    Pair _[kNumSlot + kNumStashSlot];
+    // Everything a lookup reads besides the slots is in the first cache line after them.
     size_t local_depth;
-    std::atomic<uint64_t> sema = 0;
+    // Odd while the segment is exclusively locked for a split. Readers validate it instead of taking `sema`.
+    std::atomic<uint64_t> version = 0;
     size_t pattern = 0;
+    // Set when the segment was merged with its buddy. `sibling` then points to the merged segment.
+    std::atomic<bool> is_retired = false;
+    // Bit i is set once a key whose first window starts at line i was placed in its second window or the stash.
+    std::atomic<uint64_t> overflow_bits[(kMask + 1) / 64] = {};
+    std::atomic<uint64_t> sema = 0;
+    // Set by a split until the directory points to the sibling.
+    std::atomic<Segment*> sibling = nullptr;
+    // A segment is not split again until the directory update of its last split is done.
+    std::atomic<bool> is_dir_pending = false;
     static constexpr bool using_fp_ = requires_fingerprint(KeyType);
+    // With kInlineKeys, the full key of each slot. It is written before the slot's fingerprint is, like the value.
+    std::array<KeyType, kInlineKeys ? kNumSlot + kNumStashSlot : 0> inline_keys;
 };
 
-template <typename KeyType>
+/** Maps the top `depth` bits of a hash to segments. `SegmentT` is the segment type of the index. */
+template <typename KeyType, typename SegmentT = Segment<KeyType>>
 struct Directory {
     static const size_t kDefaultDepth = 10;
-    Segment<KeyType>** _;
+    SegmentT** _;
     size_t capacity;
     size_t depth;
     bool lock;
@@ -256,21 +906,17 @@ struct Directory {
     PMEMoid pmem_seg_loc_;
 #endif
 
-    Directory(void) {
-        depth = kDefaultDepth;
-        capacity = pow(2, depth);
-        _ = new Segment<KeyType>*[capacity];
-        lock = false;
-    }
+    Directory(void) : Directory(kDefaultDepth) {}
 
     Directory(size_t _depth) {
         depth = _depth;
         capacity = pow(2, depth);
 #ifdef CCEH_PERSISTENT
-        PMemAllocator::get().allocate(&pmem_seg_loc_, sizeof(Segment<KeyType>*) * capacity);
-        _ = (Segment<KeyType>**) pmemobj_direct(pmem_seg_loc_);
+        PMemAllocator::get().allocate(&pmem_seg_loc_, sizeof(SegmentT*) * capacity);
+        _ = (SegmentT**) pmemobj_direct(pmem_seg_loc_);
 #else
-        _ = new Segment<KeyType>*[capacity];
+        // Like the segments, so that a directory is on the same node as its segments.
+        _ = static_cast<SegmentT**>(allocate_index_memory(sizeof(SegmentT*) * capacity));
 #endif
         lock = false;
     }
@@ -279,7 +925,7 @@ struct Directory {
 #ifdef CCEH_PERSISTENT
         pmemobj_free(&pmem_seg_loc_);
 #else
-        delete [] _;
+        free_index_memory(_, sizeof(SegmentT*) * capacity);
 #endif
     }
 
@@ -299,6 +945,9 @@ struct Directory {
         PMemAllocator::get().allocate(&ret, size);
         return pmemobj_direct(ret);
 #else
+        if (PersistentArena* arena = PersistentArena::Current()) {
+            return arena->allocate(size);
+        }
         void* ret;
         if (posix_memalign(&ret, 64, size) != 0) throw std::runtime_error("bad memalign");
         return ret;
@@ -307,57 +956,245 @@ struct Directory {
 
 #ifdef CCEH_PERSISTENT
     void operator delete(void* addr) {}
+#else
+    void operator delete(void* addr, size_t size) {
+        if (PersistentArena* arena = PersistentArena::Owner(addr)) {
+            arena->free(addr, size);
+        } else {
+            ::free(addr);
+        }
+    }
 #endif
 };
 
-template <typename KeyType>
+/**
+ * Points the directory to `sibling` after `target` was split and doubles the directory if needed. Only threads that
+ * split wait for the directory lock. All others reach the sibling through `target` until the directory is updated.
+ */
+template <typename KeyType, typename SegmentT>
+void PublishSplit(Directory<KeyType, SegmentT>*& dir, SegmentT* target, SegmentT* sibling, const size_t key_hash) {
+    while (!dir->Acquire()) {
+        asm("nop");
+    }
+
+    { // CRITICAL SECTION - directory update
+        size_t x = (key_hash >> (8 * sizeof(key_hash) - dir->depth));
+        if (dir->_[x]->local_depth - 1 < dir->depth) {  // normal split
+            unsigned depth_diff = dir->depth - target->local_depth;
+            if (depth_diff == 0) {
+                if (x % 2 == 0) {
+                    dir->_[x + 1] = sibling;
+                    persist((char*) &dir->_[x + 1], 8);
+                } else {
+                    dir->_[x] = sibling;
+                    persist((char*) &dir->_[x], 8);
+                }
+            } else {
+                int chunk_size = pow(2, dir->depth - (target->local_depth - 1));
+                x = x - (x % chunk_size);
+                for (unsigned i = 0; i < chunk_size / 2; ++i) {
+                    dir->_[x + chunk_size / 2 + i] = sibling;
+                }
+                persist((char*) &dir->_[x + chunk_size / 2], sizeof(void*) * chunk_size / 2);
+            }
+            dir->Release();
+        } else {  // directory doubling
+            auto dir_old = dir;
+            auto d = dir->_;
+            auto _dir = new Directory<KeyType, SegmentT>(dir->depth + 1);
+            for (unsigned i = 0; i < dir->capacity; ++i) {
+                if (i == x) {
+                    _dir->_[2 * i] = target;
+                    _dir->_[2 * i + 1] = sibling;
+                } else {
+                    _dir->_[2 * i] = d[i];
+                    _dir->_[2 * i + 1] = d[i];
+                }
+            }
+            persist((char*) &_dir->_[0], sizeof(SegmentT*) * _dir->capacity);
+            persist((char*) &_dir, sizeof(Directory<KeyType, SegmentT>));
+            if (!CAS(&dir, &dir_old, _dir)) {
+                throw std::runtime_error("Could not swap dirs. This should never happen!");
+            }
+            persist((char*) &dir, sizeof(void*));
+            // Concurrent operations may still read the old directory.
+            epoch::EpochManager::get().Retire(dir_old, [](void* old_dir) {
+                delete static_cast<Directory<KeyType, SegmentT>*>(old_dir);
+            });
+        }
+    }  // End of critical section
+
+    target->sibling.store(nullptr);
+    sibling->is_dir_pending.store(false);
+    target->is_dir_pending.store(false);
+}
+
+/**
+ * With `kInlineKeys`, each segment also stores the full keys of its slots (see Segment::inline_keys), so that a
+ * fingerprint match is confirmed in DRAM instead of by reading the record. This is for fixed-size keys wider than
+ * 8 bytes, e.g., 16-byte UUIDs, and costs sizeof(KeyType) more index memory per slot. See InlineKeyCCEH.
+ */
+template <typename KeyType, typename HashPolicy = StdHash, bool kInlineKeys = false>
 class CCEH {
   public:
+    static_assert(!kInlineKeys || (std::is_trivially_copyable_v<KeyType> && sizeof(KeyType) > sizeof(IndexK)),
+                  "Inline keys are only needed for fixed-size keys that do not fit into a slot's key word.");
+
+    static constexpr bool kIsOrdered = false;
+    using SegmentT = Segment<KeyType, kInlineKeys>;
+    using DirectoryT = Directory<KeyType, SegmentT>;
+
     static constexpr auto dummy_key_check = [](const KeyType&, IndexV) {
         throw std::runtime_error("Dummy key check should never be used!");
         return true;
     };
 
-    CCEH(size_t);
+    /** Creates a CCEH with `initCap` segments, rounded down to a power of two. */
+    CCEH(size_t initCap);
+
+    /**
+     * Allocates all segments and the directory from `arena`. If the arena holds an index of this type that was
+     * persisted before, that index is used as is instead of creating a new one (see IsRecovered).
+     * The learned hash is not stored in the arena, so TrainHash returns false.
+     */
+    CCEH(size_t initCap, PersistentArena* arena);
     ~CCEH();
 
+    /** True if the index was taken over from a persisted arena, i.e., it already holds all keys. */
+    bool IsRecovered() const { return is_recovered_; }
+
+    /**
+     * Writes the index back to its arena and marks it clean, so that the next CCEH on the arena recovers it.
+     * Does nothing without an arena. The index must not be modified afterwards.
+     */
+    void Persist();
+
+    /** Number of segments to hold `num_keys` keys at kPresizeLoadFactor, so that they can be inserted without splits. */
+    static size_t NumSegmentsFor(size_t num_keys);
+
     template <typename KeyCheckFn>
     IndexV Insert(const KeyType&, IndexV, KeyCheckFn);
 
     template <typename KeyCheckFn>
     IndexV Get(const KeyType&, KeyCheckFn);
 
+    /**
+     * Looks up `num_keys` keys and writes their offsets (or tombstones) to `offsets`. The keys are processed in
+     * batches of kMultiGetBatchSize. Each stage (hash, directory, segment lines, probe) runs for the whole batch
+     * and prefetches what the next stage needs, so that the cache misses of different keys overlap.
+     */
+    template <typename KeyCheckFn>
+    void MultiGet(const KeyType* keys, size_t num_keys, IndexV* offsets, KeyCheckFn);
+
     template <typename KeyCheckFn>
     bool Delete(const KeyType&, KeyCheckFn);
 
+    template <typename KeyCheckFn>
+    void BulkLoad(const std::vector<std::pair<KeyType, IndexV>>&, KeyCheckFn, size_t num_threads = 1);
+
+    /**
+     * Replaces the hash function with a CDF model trained on the keys of `entries` (see KeyHasher).
+     * Only allowed while the index is empty. Returns false if the model cannot be used for these keys.
+     */
+    bool TrainHash(const std::vector<std::pair<KeyType, IndexV>>& entries);
+
+    /**
+     * Merges buddy segments whose live keys fit into one segment at kMergeLoadFactor and halves the directory while
+     * all segments are shallower than it, so that memory shrinks again after many deletes. Segments that are in use
+     * are skipped. Safe to call concurrently with all other operations. Returns the number of merges.
+     */
+    size_t Shrink();
+
     IndexV Insert(const KeyType&, IndexV);
     bool Delete(const KeyType&);
     IndexV Get(const KeyType&);
+    void MultiGet(const KeyType* keys, size_t num_keys, IndexV* offsets);
     void Remove(IndexV* offset);
     size_t Capacity(void);
 
+    /** Reads the counters that all operations maintain, so this is cheap enough to call periodically. */
+    IndexStats GetStats() const;
+
+    static constexpr size_t kMultiGetBatchSize = 64;
+    static constexpr double kPresizeLoadFactor = 0.7;
+    // Lower than the load at which segments split, so that a merged segment does not split again right away.
+    static constexpr double kMergeLoadFactor = 0.4;
+
   private:
-    Directory<KeyType>* dir;
+    template <typename KeyCheckFn>
+    IndexV GetHashed(const KeyType&, size_t key_hash, KeyCheckFn);
+
+    /** Returns a new segment with the keys of both buddies or nullptr if they are in use or do not fit into one. */
+    SegmentT* MergeBuddies(SegmentT* left, SegmentT* right);
+
+    /**
+     * Frees merged segments once no reader can access them anymore. Retiring forces a fence on all threads, so the
+     * segments of a whole shrink are retired at once.
+     */
+    static void RetireSegments(std::vector<SegmentT*> segments);
+
+    /** Root object in a PersistentArena. The counters are only up to date after Persist. */
+    struct PersistentRoot {
+        size_t type_hash;
+        DirectoryT* dir;
+        size_t num_keys;
+        size_t num_stale_slots;
+        size_t num_segments;
+        size_t num_splits;
+        size_t num_merges;
+    };
+
+    /** Identifies the segment layout, so that an arena is not recovered by an index of another type. */
+    static size_t TypeHash() { return std::hash<std::string_view>{}(typeid(CCEH).name()); }
+
+    DirectoryT* dir;
+    KeyHasher<KeyType, HashPolicy> hasher_;
+    IndexCounters counters_;
+    PersistentArena* arena_ = nullptr;
+    bool is_recovered_ = false;
     static constexpr bool using_fp_ = requires_fingerprint(KeyType);
 };
 
+/** CCEH that confirms fingerprint matches with the inline copies of the keys instead of the records. */
+template <typename KeyType, typename HashPolicy = StdHash>
+using InlineKeyCCEH = CCEH<KeyType, HashPolicy, true>;
+
 extern size_t perfCounter;
 
-template <typename KeyType>
-template <typename KeyCheckFn>
-int Segment<KeyType>::Insert(const KeyType& key, IndexV value, size_t loc, size_t key_hash,
-                             IndexV* old_entry, KeyCheckFn key_check_fn) {
+template <typename KeyType, bool kInlineKeys>
+template <typename KeyCheckFn, typename Hasher>
+int Segment<KeyType, kInlineKeys>::Insert(const KeyType& key, IndexV value, size_t key_hash,
+                             IndexV* old_entry, KeyCheckFn key_check_fn, const Hasher& hasher,
+                             IndexCounters& counters) {
   uint64_t lock = sema.load();
   if (lock == EXCLUSIVE_LOCK) return 2;
-  if (IS_BIT_SET(lock, SPLIT_REQUEST_BIT)) return 1;
 
-  const size_t pattern_shift = 8 * sizeof(key_hash) - local_depth;
-  if ((key_hash >> pattern_shift) != pattern) return 2;
+  if ((key_hash >> (8 * sizeof(key_hash) - local_depth)) != pattern) return 2;
+  if (IS_BIT_SET(lock, SPLIT_REQUEST_BIT)) return 1;
+  // Writers of moved keys do not enter during the copy, so they do not delay the end of the split.
+  auto is_moving = [&](const uint64_t lock_state) {
+      return IS_BIT_SET(lock_state, SPLIT_COPY_BIT) && ((key_hash >> (8 * sizeof(key_hash) - local_depth - 1)) & 1);
+  };
+  if (is_moving(lock)) return 2;
 
   int ret = 1;
   while (!sema.compare_exchange_weak(lock, lock+1)) {
       if (lock == EXCLUSIVE_LOCK) return 2;
       if (IS_BIT_SET(lock, SPLIT_REQUEST_BIT)) return 1;
+      if (is_moving(lock)) return 2;
+  }
+
+  // A split may have finished between the check above and taking the lock. The depth is only stable from here on,
+  // and keys of other patterns are invalidated below.
+  const size_t pattern_shift = 8 * sizeof(key_hash) - local_depth;
+  if ((key_hash >> pattern_shift) != pattern) {
+      sema.fetch_sub(1);
+      return 2;
+  }
+  if (is_moving(lock)) {
+      // The key moves to the sibling that is being filled. Its writer waits until the split is done.
+      sema.fetch_sub(1);
+      return 2;
   }
 
   IndexK LOCK = INVALID;
@@ -368,53 +1205,94 @@ int Segment<KeyType>::Insert(const KeyType& key, IndexV value, size_t loc, size_
       key_checker = *reinterpret_cast<const IndexK*>(&key);
   }
 
-  for (unsigned i = 0; i < kNumPairPerCacheLine * kNumCacheLine; ++i) {
-    auto slot = (loc + i) % kNumSlot;
-    auto _key = _[slot].key;
+  auto update_slot = [&](const size_t slot) {
+      IndexV old_value = _[slot].value;
+      while (!CAS(&_[slot].value.offset, &old_value.offset, value.offset)) {}
+      if (value.is_tombstone()) {
+          IndexK expected = key_checker;
+          CAS(&_[slot].key, &expected, INVALID);
+      }
+      old_entry->offset = old_value.offset;
+      persist(&_[slot].key, sizeof(Pair));
+  };
+
+  // Look for an existing entry first. Otherwise, a free slot in front of it would lead to a duplicate key.
+  const size_t num_windows = NumWindows(key_hash);
+  for (size_t window = 0; window < num_windows; ++window) {
+      const size_t loc = WindowLoc(key_hash, window);
+      for (unsigned line = 0; line < kNumCacheLine; ++line) {
+          for (uint32_t matches = ProbeLine(key_checker, loc, line); matches != 0; matches &= matches - 1) {
+              const size_t slot = WindowSlot(loc, line * kNumPairPerCacheLine + __builtin_ctz(matches));
+              if (ATOMIC_LOAD(&_[slot].key) != key_checker) continue;
+              if constexpr (using_fp_) {
+                  // FPs matched but not necessarily the actual key.
+                  const bool keys_match = HoldsKey(slot, key, _[slot].value, key_check_fn);
+                  if (!keys_match) continue;
+              }
+              update_slot(slot);
+              sema.fetch_sub(1);
+              return 0;
+          }
+      }
+  }
 
-    bool invalidate = _key != INVALID;
-    if constexpr (using_fp_) {
-        invalidate &= (_key >> pattern_shift) != pattern;
-    } else {
-        invalidate &= (h(&_key, sizeof(IndexK)) >> pattern_shift) != pattern;
-    }
+  if (value.is_tombstone()) {
+      // Deleting a key that does not exist.
+      sema.fetch_sub(1);
+      return 0;
+  }
 
-    if (invalidate && CAS(&_[slot].key, &_key, INVALID)) {
-        _[slot].value = IndexV::Tombstone();
+  // Fill the first window before the second one and the stash, so that most lookups only probe one window.
+  for (size_t window = 0; window < kNumWindow && ret != 0; ++window) {
+    const size_t loc = WindowLoc(key_hash, window);
+    if (window == 1) {
+        // Set before the key is written, so that lookups after this insert probe all windows.
+        MarkOverflow(key_hash);
     }
 
-    if (CAS(&_[slot].key, &LOCK, SENTINEL)) {
-        old_entry->offset = _[slot].value.offset;
-        _[slot].value = value;
-        if (value.is_tombstone()) {
-            // Inserted tombstone
-            _[slot].key = INVALID;
-        }
-        else {
-            _[slot].key = key_checker;
-        }
-        persist(&_[slot], sizeof(Pair));
-        ret = 0;
-        break;
-    } else if (ATOMIC_LOAD(&_[slot].key) == key_checker) {
-        if constexpr (using_fp_) {
-            // FPs matched but not necessarily the actual key.
-            const bool keys_match = key_check_fn(key, _[slot].value);
-            if (!keys_match) continue;
-        }
+    for (unsigned i = 0; i < kNumWindowSlot; ++i) {
+      auto slot = WindowSlot(loc, i);
+      auto _key = _[slot].key;
 
-        IndexV old_value = _[slot].value;
-        while (!CAS(&_[slot].value.offset, &old_value.offset, value.offset)) {}
-        if (value.is_tombstone()) {
-            IndexK expected = key_checker;
-            CAS(&_[slot].key, &expected, INVALID);
-        }
-        old_entry->offset = old_value.offset;
-        persist(&_[slot].key, sizeof(Pair));
-        ret = 0;
-        break;
-    } else {
-        LOCK = INVALID;
+      // A SENTINEL slot is being written by another inserter and must not be reused.
+      bool invalidate = _key != INVALID && _key != SENTINEL;
+      if constexpr (using_fp_) {
+          invalidate &= (_key >> pattern_shift) != pattern;
+      } else {
+          invalidate &= (hasher.stored_hash(_key) >> pattern_shift) != pattern;
+      }
+
+      // The slot is claimed while its old value is cleared. Otherwise, another inserter could take the slot in
+      // between and its value would be overwritten.
+      if (invalidate && CAS(&_[slot].key, &_key, SENTINEL)) {
+          _[slot].value = IndexV::Tombstone();
+          ATOMIC_STORE(&_[slot].key, INVALID);
+          counters.num_stale_slots.Add(-1);
+      }
+
+      if (CAS(&_[slot].key, &LOCK, SENTINEL)) {
+          old_entry->offset = _[slot].value.offset;
+          _[slot].value = value;
+          if constexpr (kInlineKeys) {
+              inline_keys[slot] = key;
+          }
+          _[slot].key = key_checker;
+          persist(&_[slot], sizeof(Pair));
+          ret = 0;
+          break;
+      } else if (ATOMIC_LOAD(&_[slot].key) == key_checker) {
+          if constexpr (using_fp_) {
+              // FPs matched but not necessarily the actual key.
+              const bool keys_match = HoldsKey(slot, key, _[slot].value, key_check_fn);
+              if (!keys_match) continue;
+          }
+
+          update_slot(slot);
+          ret = 0;
+          break;
+      } else {
+          LOCK = INVALID;
+      }
     }
   }
 
@@ -422,24 +1300,83 @@ int Segment<KeyType>::Insert(const KeyType& key, IndexV value, size_t loc, size_
   return ret;
 }
 
-template <typename KeyType>
-void Segment<KeyType>::Insert4split(IndexK key, IndexV value, size_t loc) {
-    for (unsigned i = 0; i < kNumPairPerCacheLine * kNumCacheLine; ++i) {
-        auto slot = (loc+i) % kNumSlot;
-        if (_[slot].key == INVALID) {
-            _[slot].key = key;
-            _[slot].value = value;
-            persist(&_[slot], sizeof(Pair));
-            return;
+template <typename KeyType, bool kInlineKeys>
+size_t Segment<KeyType, kInlineKeys>::WindowLoc(const size_t key_hash, const size_t window) {
+    const size_t first_line = key_hash & kMask;
+    if (window == 0) {
+        return first_line * kNumPairPerCacheLine;
+    }
+    if (window == 1) {
+        // The second window does not overlap the first one. Its distance uses the bits above the first line.
+        constexpr size_t kNumDistances = kMask + 2 - 2 * kNumCacheLine;
+        const size_t mixed_hash = (key_hash >> kSegmentBits) * 0x9E3779B97F4A7C15ull;
+        const size_t distance = kNumCacheLine + (mixed_hash >> 32) % kNumDistances;
+        return ((first_line + distance) & kMask) * kNumPairPerCacheLine;
+    }
+    return kNumSlot;
+}
+
+template <typename KeyType, bool kInlineKeys>
+uint32_t Segment<KeyType, kInlineKeys>::ProbeLine(const IndexK key_checker, const size_t loc, const size_t line) const {
+    static_assert(sizeof(Pair) == 2 * sizeof(uint64_t) && kNumPairPerCacheLine == 4,
+                  "SIMD probing expects four 16-byte pairs per cache line.");
+    // `loc` is the first slot of a cache line, so the line is read with full vectors.
+    const size_t first_slot = WindowSlot(loc, line * kNumPairPerCacheLine);
+    const Pair* pairs = &_[first_slot];
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#if defined(__AVX512F__)
+    const uint32_t word_matches = _mm512_cmpeq_epu64_mask(_mm512_loadu_si512(pairs), _mm512_set1_epi64(key_checker));
+#else
+    const __m256i search_key = _mm256_set1_epi64x(key_checker);
+    const auto* words = reinterpret_cast<const __m256i*>(pairs);
+    const __m256i low = _mm256_cmpeq_epi64(_mm256_loadu_si256(words), search_key);
+    const __m256i high = _mm256_cmpeq_epi64(_mm256_loadu_si256(words + 1), search_key);
+    const uint32_t word_matches = _mm256_movemask_pd(_mm256_castsi256_pd(low)) |
+                                  (_mm256_movemask_pd(_mm256_castsi256_pd(high)) << 4);
+#endif
+    // Only the even words are keys, so every other bit of the word mask is dropped.
+    return (word_matches & 0x1) | ((word_matches >> 1) & 0x2) | ((word_matches >> 2) & 0x4) |
+           ((word_matches >> 3) & 0x8);
+#else
+    uint32_t matches = 0;
+    for (unsigned i = 0; i < kNumPairPerCacheLine; ++i) {
+        matches |= static_cast<uint32_t>(pairs[i].key == key_checker) << i;
+    }
+    return matches;
+#endif
+}
+
+template <typename KeyType, bool kInlineKeys>
+bool Segment<KeyType, kInlineKeys>::Insert4split(IndexK key, IndexV value, size_t key_hash,
+                                                const KeyType* inline_key) {
+    for (size_t window = 0; window < kNumWindow; ++window) {
+        const size_t loc = WindowLoc(key_hash, window);
+        for (unsigned i = 0; i < kNumWindowSlot; ++i) {
+            auto slot = WindowSlot(loc, i);
+            if (_[slot].key == INVALID) {
+                if (window > 0) {
+                    MarkOverflow(key_hash);
+                }
+                _[slot].key = key;
+                _[slot].value = value;
+                if constexpr (kInlineKeys) {
+                    inline_keys[slot] = *inline_key;
+                }
+                persist(&_[slot], sizeof(Pair));
+                return true;
+            }
         }
     }
+    return false;
 }
 
-template <typename KeyType>
-Segment<KeyType>** Segment<KeyType>::Split(void) {
+template <typename KeyType, bool kInlineKeys>
+template <typename Hasher>
+Segment<KeyType, kInlineKeys>* Segment<KeyType, kInlineKeys>::Split(const size_t key_hash, const Hasher& hasher, IndexCounters& counters) {
   uint64_t lock = 0;
   if (!sema.compare_exchange_strong(lock, EXCLUSIVE_LOCK)) {
-      if (lock == EXCLUSIVE_LOCK) {
+      if (lock == EXCLUSIVE_LOCK || IS_BIT_SET(lock, SPLIT_COPY_BIT)) {
           return nullptr;
       }
 
@@ -453,164 +1390,485 @@ Segment<KeyType>** Segment<KeyType>::Split(void) {
       }
   }
 
-  Segment<KeyType>** split = new Segment<KeyType>*[2];
-  split[0] = this;
-  split[1] = new Segment<KeyType>(local_depth + 1);
+  // The caller may have read an outdated directory entry. Only split if this segment covers its key and the
+  // directory already points to the sibling of the last split, which is only linked from this segment until then.
+  if (!Covers(key_hash) || is_dir_pending.load()) {
+      sema.store(0);
+      return nullptr;
+  }
+
+  // The keys are not modified while they are copied, so readers still probe this segment. They only retry if the
+  // split finished in between, as later inserts invalidate the moved keys.
+  version.fetch_add(1);
+
+  // Writers of the lower half continue while the upper half is copied. They only touch slots of their own keys,
+  // free slots, and slots left behind by earlier splits, none of which are copied.
+  sema.store(SPLIT_COPY_BIT);
+
+  // This segment keeps the lower half of the keys and the new sibling gets the upper half.
+  Segment<KeyType, kInlineKeys>* new_sibling = new Segment<KeyType, kInlineKeys>(local_depth + 1);
+  new_sibling->pattern = (pattern << 1) + 1;
+  new_sibling->is_dir_pending.store(true);
 
-  for (unsigned i = 0; i < kNumSlot; ++i) {
-    size_t key_hash;
+  size_t num_moved = 0;
+  for (unsigned i = 0; i < kNumSlot + kNumStashSlot; ++i) {
+    const IndexK slot_key = ATOMIC_LOAD(&_[i].key);
+    if (slot_key == INVALID || slot_key == SENTINEL) continue;
+    size_t slot_hash;
     if constexpr (using_fp_) {
-        key_hash = _[i].key;
+        slot_hash = slot_key;
     } else {
-        key_hash = h(&_[i].key, sizeof(IndexK));
+        slot_hash = hasher.stored_hash(slot_key);
     }
-    if (key_hash & ((size_t) 1 << ((sizeof(IndexK)*8 - local_depth - 1)))) {
-      split[1]->Insert4split(_[i].key, _[i].value, (key_hash & kMask)*kNumPairPerCacheLine);
+    // Keys left behind by an earlier split are not copied.
+    const bool is_live = (slot_hash >> (8 * sizeof(slot_hash) - local_depth)) == pattern;
+    if (is_live && (slot_hash & ((size_t) 1 << ((sizeof(IndexK)*8 - local_depth - 1))))) {
+      new_sibling->Insert4split(slot_key, _[i].value, slot_hash, InlineKey(i));
+      ++num_moved;
     }
   }
-
-    persist((char*) split[1], sizeof(Segment));
+  counters.num_stale_slots.Add(num_moved);
+
+    persist((char*) new_sibling, sizeof(Segment));
+    // Writers of the lower half rely on the old depth and pattern, so they must leave before these change. The
+    // request bit keeps new ones out meanwhile.
+    sema.fetch_or(SPLIT_REQUEST_BIT);
+    uint64_t drained = SPLIT_COPY_BIT | SPLIT_REQUEST_BIT;
+    while (!sema.compare_exchange_weak(drained, EXCLUSIVE_LOCK)) {
+        drained = SPLIT_COPY_BIT | SPLIT_REQUEST_BIT;
+        asm("nop");
+    }
+    is_dir_pending.store(true);
+    sibling.store(new_sibling);
+    // Keys of the upper half do not match the new pattern anymore and are looked up in the sibling.
     local_depth = local_depth + 1;
+    pattern = pattern << 1;
     persist((char*) &local_depth, sizeof(size_t));
+    persist((char*) &pattern, sizeof(size_t));
+    version.fetch_add(1);
+    sema.store(0);
 
-    return split;
+    return new_sibling;
 }
 
-template <typename KeyType>
-CCEH<KeyType>::CCEH(size_t initCap)
-    : dir{new Directory<KeyType>(static_cast<size_t>(log2(initCap)))}
+template <typename KeyType, bool kInlineKeys>
+bool Segment<KeyType, kInlineKeys>::Covers(const size_t key_hash) const {
+    return (key_hash >> (8 * sizeof(key_hash) - ATOMIC_LOAD(&local_depth))) == ATOMIC_LOAD(&pattern) &&
+           !is_retired.load();
+}
+
+template <typename KeyType, bool kInlineKeys>
+template <typename Hasher>
+size_t Segment<KeyType, kInlineKeys>::NumLiveKeys(const Hasher& hasher) const {
+    size_t num_live_keys = 0;
+    for (const Pair& pair : _) {
+        if (pair.key == INVALID || pair.key == SENTINEL || pair.value.is_tombstone()) {
+            continue;
+        }
+        size_t slot_hash;
+        if constexpr (using_fp_) {
+            slot_hash = pair.key;
+        } else {
+            slot_hash = hasher.stored_hash(pair.key);
+        }
+        num_live_keys += (slot_hash >> (8 * sizeof(slot_hash) - local_depth)) == pattern;
+    }
+    return num_live_keys;
+}
+
+template <typename KeyType, bool kInlineKeys>
+Segment<KeyType, kInlineKeys>* Segment<KeyType, kInlineKeys>::Resolve(const size_t key_hash) {
+    if (Covers(key_hash)) {
+        return this;
+    }
+    Segment* pending_sibling = sibling.load(std::memory_order_acquire);
+    if (pending_sibling != nullptr && pending_sibling->Covers(key_hash)) {
+        return pending_sibling;
+    }
+    return nullptr;
+}
+
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+CCEH<KeyType, HashPolicy, kInlineKeys>::CCEH(size_t initCap)
+    : CCEH(initCap, nullptr)
+{ }
+
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+CCEH<KeyType, HashPolicy, kInlineKeys>::CCEH(size_t initCap, PersistentArena* arena)
+    : arena_{arena}
 {
-    for (unsigned i = 0; i < dir->capacity; ++i) {
-        dir->_[i] = new Segment<KeyType>(static_cast<size_t>(log2(initCap)));
-        dir->_[i]->pattern = i;
+    const PersistentArena::Scope arena_scope{arena_};
+    auto* root = arena_ != nullptr ? static_cast<PersistentRoot*>(arena_->Root()) : nullptr;
+    if (arena_ != nullptr && arena_->IsClean() && root != nullptr && root->type_hash == TypeHash()) {
+        dir = root->dir;
+        counters_.num_keys.Add(root->num_keys);
+        counters_.num_stale_slots.Add(root->num_stale_slots);
+        counters_.num_segments.store(root->num_segments);
+        counters_.num_splits.store(root->num_splits);
+        counters_.num_merges.store(root->num_merges);
+        is_recovered_ = true;
+    } else {
+        dir = new DirectoryT(static_cast<size_t>(log2(initCap)));
+        for (unsigned i = 0; i < dir->capacity; ++i) {
+            dir->_[i] = new SegmentT(static_cast<size_t>(log2(initCap)));
+            dir->_[i]->pattern = i;
+        }
+        counters_.num_segments.store(dir->capacity);
+        if (arena_ != nullptr) {
+            root = new (arena_->allocate(sizeof(PersistentRoot))) PersistentRoot{
+                .type_hash = TypeHash(), .dir = nullptr, .num_keys = 0, .num_stale_slots = 0, .num_segments = 0,
+                .num_splits = 0, .num_merges = 0};
+            arena_->SetRoot(root);
+        }
+    }
+
+    if (arena_ != nullptr) {
+        // Until Persist, the arena does not match the index anymore.
+        arena_->MarkDirty();
     }
 }
 
-template <typename KeyType>
-IndexV CCEH<KeyType>::Insert(const KeyType& key, IndexV value) {
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+size_t CCEH<KeyType, HashPolicy, kInlineKeys>::NumSegmentsFor(const size_t num_keys) {
+    const double keys_per_segment = SegmentT::kNumSlot * kPresizeLoadFactor;
+    const size_t num_segments = std::ceil(num_keys / keys_per_segment);
+    // At least two segments, as the hash is shifted by (64 - depth).
+    size_t power_of_two = 2;
+    while (power_of_two < num_segments) {
+        power_of_two <<= 1;
+    }
+    return power_of_two;
+}
+
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+IndexV CCEH<KeyType, HashPolicy, kInlineKeys>::Insert(const KeyType& key, IndexV value) {
     return Insert(key, value, dummy_key_check);
 }
 
-template <typename KeyType>
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
 template <typename KeyCheckFn>
-IndexV CCEH<KeyType>::Insert(const KeyType& key, IndexV value, KeyCheckFn key_check_fn) {
-    size_t key_hash;
-    if constexpr (std::is_same_v<KeyType, std::string>) { key_hash = h(key.data(), key.length()); }
-    else { key_hash = h(&key, sizeof(key)); }
-    auto loc = (key_hash & kMask) * kNumPairPerCacheLine;
+IndexV CCEH<KeyType, HashPolicy, kInlineKeys>::Insert(const KeyType& key, IndexV value, KeyCheckFn key_check_fn) {
+    const size_t key_hash = hasher_(key);
+    const epoch::EpochGuard epoch_guard;
 
     while (true) {
-        auto x = (key_hash >> (8 * sizeof(key_hash) - dir->depth));
-        auto target = dir->_[x];
+        const DirectoryT* directory = ATOMIC_LOAD(&dir);
+        auto x = (key_hash >> (8 * sizeof(key_hash) - directory->depth));
+        auto target = directory->_[x]->Resolve(key_hash);
+        if (target == nullptr) {
+            // The directory was updated after it was read.
+            continue;
+        }
         IndexV old_entry{};
-        auto ret = target->Insert(key, value, loc, key_hash, &old_entry, key_check_fn);
+        auto ret = target->Insert(key, value, key_hash, &old_entry, key_check_fn, hasher_, counters_);
 
         if (ret == 0) {
+            counters_.CountReplace(old_entry, value);
             return old_entry;
         } else if (ret == 2) {
             continue;
         }
 
         // Segment is full, need to split.
-        Segment<KeyType>** s = target->Split();
-        if (s == nullptr) {
+        const PersistentArena::Scope arena_scope{arena_};
+        SegmentT* sibling = target->Split(key_hash, hasher_, counters_);
+        if (sibling == nullptr) {
             // another thread is doing split
             continue;
         }
+        counters_.num_segments.fetch_add(1);
+        counters_.num_splits.fetch_add(1);
+
+        PublishSplit(dir, target, sibling, key_hash);
+    }
+}
+
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+bool CCEH<KeyType, HashPolicy, kInlineKeys>::Delete(const KeyType& key) {
+    return Delete(key, dummy_key_check);
+}
+
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+template <typename KeyCheckFn>
+bool CCEH<KeyType, HashPolicy, kInlineKeys>::Delete(const KeyType& key, KeyCheckFn key_check_fn) {
+    // Inserting a tombstone removes the key.
+    const IndexV old_entry = Insert(key, IndexV::NONE(), key_check_fn);
+    return !old_entry.is_tombstone();
+}
+
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+template <typename KeyCheckFn>
+void CCEH<KeyType, HashPolicy, kInlineKeys>::BulkLoad(const std::vector<std::pair<KeyType, IndexV>>& entries, KeyCheckFn key_check_fn,
+                             size_t num_threads) {
+    num_threads = std::max(1ul, std::min(num_threads, entries.size()));
+    const size_t num_entries_per_thread = (entries.size() / num_threads) + 1;
+
+    // Segments of the loading threads are allocated on the same node as those of the caller.
+    const size_t allocation_node = numa::AllocationNode();
+    std::vector<std::thread> load_threads;
+    load_threads.reserve(num_threads);
+    for (size_t thread_num = 0; thread_num < num_threads; ++thread_num) {
+        const size_t start = std::min(thread_num * num_entries_per_thread, entries.size());
+        const size_t end = std::min(start + num_entries_per_thread, entries.size());
+        load_threads.emplace_back([&, start, end] {
+            const numa::NodeScope node_scope{allocation_node};
+            for (size_t i = start; i < end; ++i) {
+                Insert(entries[i].first, entries[i].second, key_check_fn);
+            }
+        });
+    }
 
-        s[0]->pattern = (key_hash >> (8 * sizeof(key_hash) - s[0]->local_depth + 1)) << 1;
-        s[1]->pattern = ((key_hash >> (8 * sizeof(key_hash) - s[1]->local_depth + 1)) << 1) + 1;
+    for (std::thread& thread : load_threads) {
+        thread.join();
+    }
+}
 
-        // Directory management
-        while (!dir->Acquire()) {
-            asm("nop");
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+bool CCEH<KeyType, HashPolicy, kInlineKeys>::TrainHash(const std::vector<std::pair<KeyType, IndexV>>& entries) {
+    if (arena_ != nullptr) {
+        // The model would be lost on restart, so the persisted keys could not be found anymore.
+        return false;
+    }
+    for (size_t i = 0; i < dir->capacity; ++i) {
+        for (const Pair& pair : dir->_[i]->_) {
+            if (pair.key != INVALID) {
+                throw std::runtime_error("Cannot train the hash of a non-empty index.");
+            }
         }
+    }
+    return hasher_.Train(entries);
+}
 
-        { // CRITICAL SECTION - directory update
-            x = (key_hash >> (8 * sizeof(key_hash) - dir->depth));
-            if (dir->_[x]->local_depth - 1 < dir->depth) {  // normal split
-                unsigned depth_diff = dir->depth - s[0]->local_depth;
-                if (depth_diff == 0) {
-                    if (x % 2 == 0) {
-                        dir->_[x + 1] = s[1];
-                        persist((char*) &dir->_[x + 1], 8);
-                    } else {
-                        dir->_[x] = s[1];
-                        persist((char*) &dir->_[x], 8);
-                    }
-                } else {
-                    int chunk_size = pow(2, dir->depth - (s[0]->local_depth - 1));
-                    x = x - (x % chunk_size);
-                    for (unsigned i = 0; i < chunk_size / 2; ++i) {
-                        dir->_[x + chunk_size / 2 + i] = s[1];
-                    }
-                    persist((char*) &dir->_[x + chunk_size / 2], sizeof(void*) * chunk_size / 2);
-                }
-                dir->Release();
-            } else {  // directory doubling
-                auto dir_old = dir;
-                auto d = dir->_;
-                auto _dir = new Directory<KeyType>(dir->depth + 1);
-                for (unsigned i = 0; i < dir->capacity; ++i) {
-                    if (i == x) {
-                        _dir->_[2 * i] = s[0];
-                        _dir->_[2 * i + 1] = s[1];
-                    } else {
-                        _dir->_[2 * i] = d[i];
-                        _dir->_[2 * i + 1] = d[i];
-                    }
-                }
-                persist((char*) &_dir->_[0], sizeof(Segment<KeyType>*) * _dir->capacity);
-                persist((char*) &_dir, sizeof(Directory<KeyType>));
-                if (!CAS(&dir, &dir_old, _dir)) {
-                    throw std::runtime_error("Could not swap dirs. This should never happen!");
-                }
-                persist((char*) &dir, sizeof(void*));
-                delete dir_old;
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+size_t CCEH<KeyType, HashPolicy, kInlineKeys>::Shrink() {
+    // No epoch is needed, as the directory cannot change while its lock is held. Entering one would also delay the
+    // reclamation of the merged segments.
+    const PersistentArena::Scope arena_scope{arena_};
+    while (!dir->Acquire()) {
+        asm("nop");
+    }
+
+    // Retired after the directory lock is released, as retiring is expensive and splits wait for the lock.
+    std::vector<SegmentT*> merged_segments;
+    std::vector<DirectoryT*> old_dirs;
+    size_t num_merges = 0;
+    bool has_merged = true;
+    while (has_merged) {
+        has_merged = false;
+        size_t chunk_size = 1;
+        for (size_t x = 0; x < dir->capacity; x += chunk_size) {
+            SegmentT* left = dir->_[x];
+            // A segment with a pending split is deeper than its directory entries. It is not merged anyway.
+            chunk_size = 1;
+            const size_t local_depth = ATOMIC_LOAD(&left->local_depth);
+            if (local_depth > dir->depth || local_depth <= 1) {
+                continue;
+            }
+            chunk_size = (size_t) 1 << (dir->depth - local_depth);
+            if (x % (2 * chunk_size) != 0) {
+                // Right buddies are merged from their left one.
+                continue;
             }
-            s[0]->sema.store(0);
-        }  // End of critical section
 
-        delete s;
+            SegmentT* right = dir->_[x + chunk_size];
+            SegmentT* merged = MergeBuddies(left, right);
+            if (merged == nullptr) {
+                continue;
+            }
+            for (size_t i = 0; i < 2 * chunk_size; ++i) {
+                dir->_[x + i] = merged;
+            }
+            persist((char*) &dir->_[x], sizeof(void*) * 2 * chunk_size);
+            merged_segments.push_back(left);
+            merged_segments.push_back(right);
+            counters_.num_segments.fetch_sub(1);
+            counters_.num_merges.fetch_add(1);
+            chunk_size *= 2;
+            has_merged = true;
+            ++num_merges;
+        }
+    }
+
+    // Halve the directory while each segment has at least two entries. These are always neighbors.
+    while (dir->depth > 1) {
+        bool can_halve = true;
+        for (size_t x = 0; x < dir->capacity && can_halve; ++x) {
+            can_halve = ATOMIC_LOAD(&dir->_[x]->local_depth) < dir->depth;
+        }
+        if (!can_halve) {
+            break;
+        }
+
+        auto dir_old = dir;
+        auto _dir = new DirectoryT(dir->depth - 1);
+        // Splits wait for the new directory until shrinking is done.
+        _dir->lock = true;
+        for (unsigned i = 0; i < _dir->capacity; ++i) {
+            _dir->_[i] = dir_old->_[2 * i];
+        }
+        persist((char*) &_dir->_[0], sizeof(SegmentT*) * _dir->capacity);
+        persist((char*) &_dir, sizeof(DirectoryT));
+        if (!CAS(&dir, &dir_old, _dir)) {
+            throw std::runtime_error("Could not swap dirs. This should never happen!");
+        }
+        persist((char*) &dir, sizeof(void*));
+        old_dirs.push_back(dir_old);
     }
+
+    dir->Release();
+    RetireSegments(std::move(merged_segments));
+    for (DirectoryT* old_dir : old_dirs) {
+        epoch::EpochManager::get().Retire(old_dir, [](void* retired_dir) {
+            delete static_cast<DirectoryT*>(retired_dir);
+        });
+    }
+    if (num_merges > 0) {
+        epoch::EpochManager::get().Synchronize();
+    }
+    return num_merges;
 }
 
-template <typename KeyType>
-void CCEH<KeyType>::Remove(IndexV* offset) {
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+Segment<KeyType, kInlineKeys>* CCEH<KeyType, HashPolicy, kInlineKeys>::MergeBuddies(SegmentT* left, SegmentT* right) {
+    // Only try to lock, as splitting threads hold their segment while they wait for the directory lock.
+    uint64_t lock = 0;
+    if (left == right || !left->sema.compare_exchange_strong(lock, EXCLUSIVE_LOCK)) {
+        return nullptr;
+    }
+    lock = 0;
+    if (!right->sema.compare_exchange_strong(lock, EXCLUSIVE_LOCK)) {
+        left->sema.store(0);
+        return nullptr;
+    }
+
+    const bool are_buddies = left->local_depth == right->local_depth && right->pattern == (left->pattern | 1) &&
+                             !left->is_dir_pending.load() && !right->is_dir_pending.load();
+    const size_t max_num_keys = SegmentT::kNumSlot * kMergeLoadFactor;
+    if (!are_buddies || left->NumLiveKeys(hasher_) + right->NumLiveKeys(hasher_) > max_num_keys) {
+        left->sema.store(0);
+        right->sema.store(0);
+        return nullptr;
+    }
+
+    SegmentT* merged = new SegmentT(left->local_depth - 1);
+    merged->pattern = left->pattern >> 1;
+    size_t num_stale_slots = 0;
+    for (const SegmentT* segment : {left, right}) {
+        for (const Pair& pair : segment->_) {
+            if (pair.key == INVALID || pair.value.is_tombstone()) {
+                continue;
+            }
+            size_t slot_hash;
+            if constexpr (using_fp_) {
+                slot_hash = pair.key;
+            } else {
+                slot_hash = hasher_.stored_hash(pair.key);
+            }
+            if ((slot_hash >> (8 * sizeof(slot_hash) - segment->local_depth)) != segment->pattern) {
+                // Left behind by an earlier split.
+                ++num_stale_slots;
+                continue;
+            }
+            if (!merged->Insert4split(pair.key, pair.value, slot_hash, segment->InlineKey(&pair - segment->_))) {
+                // All windows of a key are full.
+                delete merged;
+                left->sema.store(0);
+                right->sema.store(0);
+                return nullptr;
+            }
+        }
+    }
+    persist((char*) merged, sizeof(SegmentT));
+    counters_.num_stale_slots.Add(-static_cast<int64_t>(num_stale_slots));
+
+    // Both buddies stay locked. Threads that still reach them through an outdated directory entry are forwarded to
+    // the merged segment, and readers that probed them retry as the version changed.
+    for (SegmentT* segment : {left, right}) {
+        segment->sibling.store(merged);
+        segment->is_retired.store(true);
+        segment->version.fetch_add(1);
+    }
+    return merged;
+}
+
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+void CCEH<KeyType, HashPolicy, kInlineKeys>::RetireSegments(std::vector<SegmentT*> segments) {
+    if (segments.empty()) {
+        return;
+    }
+    auto* retired = new std::vector<SegmentT*>(std::move(segments));
+    epoch::EpochManager::get().Retire(retired, [](void* retired_segments) {
+        auto* segments = static_cast<std::vector<SegmentT*>*>(retired_segments);
+        for (SegmentT* segment : *segments) {
+            delete segment;
+        }
+        delete segments;
+    });
+}
+
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+void CCEH<KeyType, HashPolicy, kInlineKeys>::Remove(IndexV* offset) {
     offset_size_t expected_value = offset->offset;
-    CAS(&offset->offset, &expected_value, IndexV::Tombstone().offset);
+    if (CAS(&offset->offset, &expected_value, IndexV::Tombstone().offset)) {
+        counters_.CountReplace(IndexV{expected_value}, IndexV::Tombstone());
+    }
     IndexK* key_slot = reinterpret_cast<IndexK*>(offset) - 1;
     ATOMIC_STORE(key_slot, INVALID);
 }
 
-template <typename KeyType>
-IndexV CCEH<KeyType>::Get(const KeyType& key) {
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+IndexV CCEH<KeyType, HashPolicy, kInlineKeys>::Get(const KeyType& key) {
     return Get(key, dummy_key_check);
 }
 
-template <typename KeyType>
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
 template <typename KeyCheckFn>
-IndexV CCEH<KeyType>::Get(const KeyType& key, KeyCheckFn key_check_fn) {
-    size_t key_hash;
-    if constexpr (std::is_same_v<KeyType, std::string>) { key_hash = h(key.data(), key.length()); }
-    else { key_hash = h(&key, sizeof(key)); }
-    const size_t loc = (key_hash & kMask) * kNumPairPerCacheLine;
+IndexV CCEH<KeyType, HashPolicy, kInlineKeys>::Get(const KeyType& key, KeyCheckFn key_check_fn) {
+    return GetHashed(key, hasher_(key), key_check_fn);
+}
 
-    Segment<KeyType>* segment;
-    while (true) {
-        const size_t seg_num = (key_hash >> (8 * sizeof(key_hash) - dir->depth));
-        segment = dir->_[seg_num];
-        auto& sema = segment->sema;
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+void CCEH<KeyType, HashPolicy, kInlineKeys>::MultiGet(const KeyType* keys, const size_t num_keys, IndexV* offsets) {
+    MultiGet(keys, num_keys, offsets, dummy_key_check);
+}
 
-        uint64_t lock = sema.load();
-        if ((lock & SPLIT_REQUEST_BIT) != 0 || !sema.compare_exchange_weak(lock, lock + 1)) {
-            continue;
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+template <typename KeyCheckFn>
+void CCEH<KeyType, HashPolicy, kInlineKeys>::MultiGet(const KeyType* keys, const size_t num_keys, IndexV* offsets, KeyCheckFn key_check_fn) {
+    size_t key_hashes[kMultiGetBatchSize];
+    const epoch::EpochGuard epoch_guard;
+    for (size_t batch_start = 0; batch_start < num_keys; batch_start += kMultiGetBatchSize) {
+        const KeyType* batch_keys = keys + batch_start;
+        const size_t batch_size = std::min(kMultiGetBatchSize, num_keys - batch_start);
+        const DirectoryT* directory = ATOMIC_LOAD(&dir);
+        const size_t dir_shift = 8 * sizeof(size_t) - directory->depth;
+
+        for (size_t i = 0; i < batch_size; ++i) {
+            key_hashes[i] = hasher_(batch_keys[i]);
+            _mm_prefetch(reinterpret_cast<const char*>(&directory->_[key_hashes[i] >> dir_shift]), _MM_HINT_T0);
         }
 
-        // Could acquire lock
-        break;
+        for (size_t i = 0; i < batch_size; ++i) {
+            const SegmentT* segment = directory->_[key_hashes[i] >> dir_shift];
+            // Only the first window, as the other ones rarely hold the key.
+            const size_t loc = SegmentT::WindowLoc(key_hashes[i], 0);
+            for (size_t line = 0; line < kNumCacheLine; ++line) {
+                const size_t slot = SegmentT::WindowSlot(loc, line * kNumPairPerCacheLine);
+                _mm_prefetch(reinterpret_cast<const char*>(&segment->_[slot]), _MM_HINT_T0);
+            }
+            _mm_prefetch(reinterpret_cast<const char*>(&segment->version), _MM_HINT_T0);
+        }
+
+        // Probing validates the segment, so a directory change after the prefetches only costs extra misses.
+        for (size_t i = 0; i < batch_size; ++i) {
+            offsets[batch_start + i] = GetHashed(batch_keys[i], key_hashes[i], key_check_fn);
+        }
     }
+}
 
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+template <typename KeyCheckFn>
+IndexV CCEH<KeyType, HashPolicy, kInlineKeys>::GetHashed(const KeyType& key, const size_t key_hash, KeyCheckFn key_check_fn) {
     IndexK key_checker;
     if constexpr (using_fp_) {
         key_checker = key_hash;
@@ -618,38 +1876,100 @@ IndexV CCEH<KeyType>::Get(const KeyType& key, KeyCheckFn key_check_fn) {
         key_checker = *reinterpret_cast<const IndexK*>(&key);
     }
 
-    for (unsigned i = 0; i < kNumPairPerCacheLine * kNumCacheLine; ++i) {
-        auto slot = (loc+i) % Segment<KeyType>::kNumSlot;
-        if (segment->_[slot].key == key_checker) {
-          if constexpr (using_fp_) {
-              const bool keys_match = key_check_fn(key, segment->_[slot].value);
-              if (!keys_match) continue;
-          }
+    // Readers do not write to the segment. They validate its version after probing and retry if it was split.
+    const epoch::EpochGuard epoch_guard;
+    while (true) {
+        const DirectoryT* directory = ATOMIC_LOAD(&dir);
+        const size_t seg_num = (key_hash >> (8 * sizeof(key_hash) - directory->depth));
+        SegmentT* segment = directory->_[seg_num]->Resolve(key_hash);
+        if (segment == nullptr) {
+            continue;
+        }
+        // A segment is not modified while it is split, so an odd version is still valid if it does not change.
+        const uint64_t version = segment->version.load(std::memory_order_acquire);
+
+        // A split that finished before the version was read may have moved the key to the new segment.
+        if (!segment->Covers(key_hash)) {
+            continue;
+        }
+
+        auto probe_window = [&](const size_t loc) {
+            // Each cache line is compared at once and only slots whose key matches are visited.
+            for (unsigned line = 0; line < kNumCacheLine; ++line) {
+                for (uint32_t matches = segment->ProbeLine(key_checker, loc, line); matches != 0;
+                     matches &= matches - 1) {
+                    const size_t slot =
+                        SegmentT::WindowSlot(loc, line * kNumPairPerCacheLine + __builtin_ctz(matches));
+                    const IndexV slot_value{ATOMIC_LOAD(&segment->_[slot].value.offset)};
+                    if (ATOMIC_LOAD(&segment->_[slot].key) != key_checker) {
+                        // Slot was reused for another key after the probe.
+                        continue;
+                    }
+                    if constexpr (using_fp_) {
+                        const bool keys_match = segment->HoldsKey(slot, key, slot_value, key_check_fn);
+                        if (!keys_match) continue;
+                    }
+                    return slot_value;
+                }
+            }
+            return IndexV::NONE();
+        };
 
-          IndexV offset = segment->_[slot].value;
-          segment->sema.fetch_sub(1);
-          return offset;
+        // The first window does not depend on the overflow bits, so that its probe does not wait for them.
+        IndexV offset = probe_window(SegmentT::WindowLoc(key_hash, 0));
+        if (offset.is_tombstone()) {
+            const size_t num_windows = segment->NumWindows(key_hash);
+            for (size_t window = 1; window < num_windows && offset.is_tombstone(); ++window) {
+                offset = probe_window(SegmentT::WindowLoc(key_hash, window));
+            }
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (segment->version.load(std::memory_order_relaxed) == version) {
+            return offset;
         }
     }
+}
 
-    segment->sema.fetch_sub(1);
-    return IndexV::NONE();
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+size_t CCEH<KeyType, HashPolicy, kInlineKeys>::Capacity(void) {
+    return counters_.num_segments.load() * (SegmentT::kNumSlot + SegmentT::kNumStashSlot);
 }
 
-template <typename KeyType>
-size_t CCEH<KeyType>::Capacity(void) {
-    std::unordered_map<Segment<KeyType>*, bool> set;
-    for (size_t i = 0; i < dir->capacity; ++i) {
-        set[dir->_[i]] = true;
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+IndexStats CCEH<KeyType, HashPolicy, kInlineKeys>::GetStats() const {
+    // The directory may be replaced concurrently.
+    const epoch::EpochGuard epoch_guard;
+    return counters_.Stats<SegmentT>(ATOMIC_LOAD(&dir));
+}
+
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+void CCEH<KeyType, HashPolicy, kInlineKeys>::Persist() {
+    if (arena_ == nullptr) {
+        return;
     }
-    return set.size() * Segment<KeyType>::kNumSlot;
+    // Frees the retired segments and directories into the arena, so that no reader holds one anymore.
+    epoch::EpochManager::get().Synchronize();
+    auto* root = static_cast<PersistentRoot*>(arena_->Root());
+    root->dir = dir;
+    root->num_keys = counters_.num_keys.Load();
+    root->num_stale_slots = counters_.num_stale_slots.Load();
+    root->num_segments = counters_.num_segments.load();
+    root->num_splits = counters_.num_splits.load();
+    root->num_merges = counters_.num_merges.load();
+    arena_->Close();
 }
 
-template <typename KeyType>
-CCEH<KeyType>::~CCEH() {
+template <typename KeyType, typename HashPolicy, bool kInlineKeys>
+CCEH<KeyType, HashPolicy, kInlineKeys>::~CCEH() {
+    if (arena_ != nullptr) {
+        // The segments stay in the arena. Retired ones must be freed before the arena is unmapped.
+        epoch::EpochManager::get().Synchronize();
+        return;
+    }
 #ifndef CCEH_PERSISTENT
     // Only clean up in volatile mode
-    std::unordered_map<Segment<KeyType>*, bool> set;
+    std::unordered_map<SegmentT*, bool> set;
     for (size_t i = 0; i < dir->capacity; ++i) {
         set[dir->_[i]] = true;
     }
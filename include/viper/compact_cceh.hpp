@@ -0,0 +1,613 @@
+#pragma once
+
+#include "cceh.hpp"
+
+namespace viper {
+namespace cceh {
+
+/**
+ * An 8-byte slot of CompactCCEH. The upper 16 bits are a tag of the key's hash and the lower 48 bits are the
+ * record's KeyValueOffset with the block number narrowed to 29 bits. All bits set marks an empty slot. Tags are
+ * never all ones, so probing for a tag does not match empty slots.
+ */
+struct CompactSlot {
+    using word_t = uint64_t;
+    static constexpr word_t kEmpty = -1;
+    static constexpr size_t kTagShift = 48;
+    static constexpr size_t kBlockBits = 29;
+    static constexpr size_t kPageShift = kBlockBits;
+    static constexpr size_t kDataOffsetShift = 32;
+    static constexpr word_t kBlockMask = (1ul << kBlockBits) - 1;
+    // The largest block number is reserved, so that no slot with an offset is all ones.
+    static constexpr block_size_t kMaxNumBlocks = kBlockMask;
+
+    /** The tag uses the bits above the first line, as all keys of a window share the lowest ones. */
+    static uint16_t Tag(const size_t key_hash) {
+        const uint16_t tag = key_hash >> kSegmentBits;
+        return tag == UINT16_MAX ? UINT16_MAX - 1 : tag;
+    }
+
+    static word_t Make(const uint16_t tag, const IndexV offset) {
+        if (offset.block_number >= kMaxNumBlocks) {
+            throw std::runtime_error("Record offset does not fit into a compact index slot.");
+        }
+        return ((word_t) tag << kTagShift) | ((word_t) offset.data_offset << kDataOffsetShift) |
+               ((word_t) offset.page_number << kPageShift) | offset.block_number;
+    }
+
+    static uint16_t TagOf(const word_t word) {
+        return word >> kTagShift;
+    }
+
+    static IndexV OffsetOf(const word_t word) {
+        return IndexV{word & kBlockMask, static_cast<page_size_t>((word >> kPageShift) & 0x7),
+                      static_cast<data_offset_size_t>(word >> kDataOffsetShift)};
+    }
+};
+
+/**
+ * A CCEH segment of 8-byte slots. It has the same size and windows as Segment but twice the slots, i.e., eight per
+ * cache line. Keys are identified by their tag and verified with the key check, which reads the record in PMem.
+ * As slots do not hold the key or its full hash, a split reads the key of each slot from its record to rehash it.
+ */
+template <typename KeyType>
+struct CompactSegment {
+    using word_t = CompactSlot::word_t;
+    static const size_t kNumSlot = kSegmentSize / sizeof(word_t);
+    static const size_t kNumSlotPerCacheLine = CACHE_LINE_SIZE / sizeof(word_t);
+    static const size_t kNumWindowSlot = kNumSlotPerCacheLine * kNumCacheLine;
+    static const size_t kNumStashSlot = kNumWindowSlot;
+    static const size_t kNumWindow = 3;
+    static_assert(kNumSlot / kNumSlotPerCacheLine == kMask + 1, "The lowest hash bits select the first line.");
+
+    CompactSegment(size_t depth)
+        : local_depth{depth}
+    {
+        std::fill(std::begin(_), std::end(_), CompactSlot::kEmpty);
+    }
+
+    void* operator new(size_t size) {
+#ifdef CCEH_PERSISTENT
+        PMEMoid ret;
+        PMemAllocator::get().allocate(&ret, size);
+        return pmemobj_direct(ret);
+#else
+        return SegmentArena::get().allocate(size);
+#endif
+    }
+
+#ifdef CCEH_PERSISTENT
+    void operator delete(void* addr) {
+        PMEMoid oid = pmemobj_oid(addr);
+        pmemobj_free(&oid);
+    }
+#else
+    void operator delete(void* addr, size_t size) {
+        SegmentArena::get().free(addr, size);
+    }
+#endif
+
+    /** Returns 0 on success, 1 if the segment is full, and 2 if the key belongs to another segment by now. */
+    template <typename KeyCheckFn>
+    int Insert(const KeyType&, IndexV, size_t key_hash, IndexV* old_entry, KeyCheckFn);
+
+    /** See Segment::WindowLoc. */
+    static size_t WindowLoc(size_t key_hash, size_t window);
+
+    static size_t WindowSlot(size_t loc, size_t i) {
+        return loc < kNumSlot ? (loc + i) % kNumSlot : loc + i;
+    }
+
+    size_t NumWindows(size_t key_hash) const {
+        const size_t line = key_hash & kMask;
+        return (overflow_bits[line / 64].load(std::memory_order_acquire) >> (line % 64)) & 1 ? kNumWindow : 1;
+    }
+
+    void MarkOverflow(size_t key_hash) {
+        const size_t line = key_hash & kMask;
+        if (((overflow_bits[line / 64].load() >> (line % 64)) & 1) == 0) {
+            overflow_bits[line / 64].fetch_or(1ul << (line % 64));
+        }
+    }
+
+    /** Returns a mask with bit i set if the i-th slot of the `line`-th cache line of the window at `loc` has `tag`. */
+    uint32_t ProbeLine(uint16_t tag, size_t loc, size_t line) const;
+
+    /** Inserts into a segment that no other thread accesses. Returns false if all windows of the key are full. */
+    bool Insert4split(word_t word, size_t key_hash);
+
+    /**
+     * Moves the upper half of the keys to a new sibling and returns it, or nullptr if the segment cannot be split now.
+     * Unlike Segment::Split, the moved keys are removed before the segment is unlocked, as later inserts cannot tell
+     * them apart without reading their records.
+     */
+    template <typename KeyCheckFn, typename Hasher>
+    CompactSegment* Split(size_t key_hash, KeyCheckFn, const Hasher&);
+
+    bool Covers(size_t key_hash) const {
+        return (key_hash >> (8 * sizeof(key_hash) - ATOMIC_LOAD(&local_depth))) == ATOMIC_LOAD(&pattern);
+    }
+
+    CompactSegment* Resolve(size_t key_hash) {
+        if (Covers(key_hash)) {
+            return this;
+        }
+        CompactSegment* pending_sibling = sibling.load(std::memory_order_acquire);
+        if (pending_sibling != nullptr && pending_sibling->Covers(key_hash)) {
+            return pending_sibling;
+        }
+        return nullptr;
+    }
+
+    word_t _[kNumSlot + kNumStashSlot];
+    size_t local_depth;
+    std::atomic<uint64_t> version = 0;
+    size_t pattern = 0;
+    std::atomic<uint64_t> overflow_bits[(kMask + 1) / 64] = {};
+    std::atomic<uint64_t> sema = 0;
+    std::atomic<CompactSegment*> sibling = nullptr;
+    std::atomic<bool> is_dir_pending = false;
+};
+
+/**
+ * CCEH with 8-byte slots (see CompactSlot), which halves the index memory compared to CCEH's 16-byte pairs. Every
+ * tag match costs a PMem read to verify the key, so this pays off for keys that need fingerprints in CCEH anyway.
+ * The key check must also provide `stored_key(offset)`, which returns the bytes of the key of a record, so that
+ * splits can rehash keys. Offsets need a block number below CompactSlot::kMaxNumBlocks, else inserts throw.
+ * Segments are not merged and the hash is not learned.
+ */
+template <typename KeyType, typename HashPolicy = StdHash>
+class CompactCCEH {
+  public:
+    static constexpr bool kIsOrdered = false;
+
+    /** Creates a CompactCCEH with `initCap` segments, rounded down to a power of two. */
+    CompactCCEH(size_t initCap);
+    ~CompactCCEH();
+
+    /** Number of segments to hold `num_keys` keys at kPresizeLoadFactor. */
+    static size_t NumSegmentsFor(size_t num_keys);
+
+    template <typename KeyCheckFn>
+    IndexV Insert(const KeyType&, IndexV, KeyCheckFn);
+
+    template <typename KeyCheckFn>
+    IndexV Get(const KeyType&, KeyCheckFn);
+
+    /** See CCEH::MultiGet. */
+    template <typename KeyCheckFn>
+    void MultiGet(const KeyType* keys, size_t num_keys, IndexV* offsets, KeyCheckFn);
+
+    template <typename KeyCheckFn>
+    bool Delete(const KeyType&, KeyCheckFn);
+
+    template <typename KeyCheckFn>
+    void BulkLoad(const std::vector<std::pair<KeyType, IndexV>>&, KeyCheckFn, size_t num_threads = 1);
+
+    size_t Capacity(void);
+
+    /** See CCEH::GetStats. Moved keys are removed by splits, so there are no stale slots. */
+    IndexStats GetStats() const;
+
+    static constexpr size_t kMultiGetBatchSize = 64;
+    static constexpr double kPresizeLoadFactor = CCEH<KeyType>::kPresizeLoadFactor;
+
+  private:
+    template <typename KeyCheckFn>
+    IndexV GetHashed(const KeyType&, size_t key_hash, KeyCheckFn);
+
+    Directory<KeyType, CompactSegment<KeyType>>* dir;
+    KeyHasher<KeyType, HashPolicy> hasher_;
+    IndexCounters counters_;
+};
+
+template <typename KeyType>
+template <typename KeyCheckFn>
+int CompactSegment<KeyType>::Insert(const KeyType& key, IndexV value, size_t key_hash, IndexV* old_entry,
+                                    KeyCheckFn key_check_fn) {
+    uint64_t lock = sema.load();
+    if (lock == EXCLUSIVE_LOCK) return 2;
+    if (IS_BIT_SET(lock, SPLIT_REQUEST_BIT)) return 1;
+    while (!sema.compare_exchange_weak(lock, lock + 1)) {
+        if (lock == EXCLUSIVE_LOCK) return 2;
+        if (IS_BIT_SET(lock, SPLIT_REQUEST_BIT)) return 1;
+    }
+
+    if (!Covers(key_hash)) {
+        sema.fetch_sub(1);
+        return 2;
+    }
+
+    const uint16_t tag = CompactSlot::Tag(key_hash);
+    const word_t new_word = value.is_tombstone() ? CompactSlot::kEmpty : CompactSlot::Make(tag, value);
+
+    // Replaces the word of `key` in `slot`. Returns false if the slot does not hold the key (anymore).
+    auto update_slot = [&](const size_t slot) {
+        word_t word = ATOMIC_LOAD(&_[slot]);
+        while (CompactSlot::TagOf(word) == tag && key_check_fn(key, CompactSlot::OffsetOf(word))) {
+            if (CAS(&_[slot], &word, new_word)) {
+                *old_entry = CompactSlot::OffsetOf(word);
+                persist(&_[slot], sizeof(word_t));
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // Look for an existing entry first. Otherwise, a free slot in front of it would lead to a duplicate key.
+    const size_t num_windows = NumWindows(key_hash);
+    for (size_t window = 0; window < num_windows; ++window) {
+        const size_t loc = WindowLoc(key_hash, window);
+        for (unsigned line = 0; line < kNumCacheLine; ++line) {
+            for (uint32_t matches = ProbeLine(tag, loc, line); matches != 0; matches &= matches - 1) {
+                const size_t slot = WindowSlot(loc, line * kNumSlotPerCacheLine + __builtin_ctz(matches));
+                if (update_slot(slot)) {
+                    sema.fetch_sub(1);
+                    return 0;
+                }
+            }
+        }
+    }
+
+    if (value.is_tombstone()) {
+        // Deleting a key that does not exist.
+        sema.fetch_sub(1);
+        return 0;
+    }
+
+    // A slot is claimed with a single CAS, so there are no half-written slots to skip.
+    for (size_t window = 0; window < kNumWindow; ++window) {
+        const size_t loc = WindowLoc(key_hash, window);
+        if (window == 1) {
+            MarkOverflow(key_hash);
+        }
+        for (unsigned i = 0; i < kNumWindowSlot; ++i) {
+            const size_t slot = WindowSlot(loc, i);
+            word_t word = ATOMIC_LOAD(&_[slot]);
+            if (word == CompactSlot::kEmpty && CAS(&_[slot], &word, new_word)) {
+                *old_entry = IndexV::NONE();
+                persist(&_[slot], sizeof(word_t));
+                sema.fetch_sub(1);
+                return 0;
+            }
+            // Another thread may have inserted the same key since the search above.
+            if (CompactSlot::TagOf(word) == tag && update_slot(slot)) {
+                sema.fetch_sub(1);
+                return 0;
+            }
+        }
+    }
+
+    sema.fetch_sub(1);
+    return 1;
+}
+
+template <typename KeyType>
+size_t CompactSegment<KeyType>::WindowLoc(const size_t key_hash, const size_t window) {
+    const size_t first_line = key_hash & kMask;
+    if (window == 0) {
+        return first_line * kNumSlotPerCacheLine;
+    }
+    if (window == 1) {
+        constexpr size_t kNumDistances = kMask + 2 - 2 * kNumCacheLine;
+        const size_t mixed_hash = (key_hash >> kSegmentBits) * 0x9E3779B97F4A7C15ull;
+        const size_t distance = kNumCacheLine + (mixed_hash >> 32) % kNumDistances;
+        return ((first_line + distance) & kMask) * kNumSlotPerCacheLine;
+    }
+    return kNumSlot;
+}
+
+template <typename KeyType>
+uint32_t CompactSegment<KeyType>::ProbeLine(const uint16_t tag, const size_t loc, const size_t line) const {
+    static_assert(kNumSlotPerCacheLine == 8, "SIMD probing expects eight 8-byte slots per cache line.");
+    const word_t* words = &_[WindowSlot(loc, line * kNumSlotPerCacheLine)];
+
+#if defined(__AVX512F__)
+    const __m512i tags = _mm512_srli_epi64(_mm512_loadu_si512(words), CompactSlot::kTagShift);
+    return _mm512_cmpeq_epu64_mask(tags, _mm512_set1_epi64(tag));
+#elif defined(__AVX2__)
+    const __m256i search_tag = _mm256_set1_epi64x(tag);
+    const auto* vectors = reinterpret_cast<const __m256i*>(words);
+    const __m256i low = _mm256_srli_epi64(_mm256_loadu_si256(vectors), CompactSlot::kTagShift);
+    const __m256i high = _mm256_srli_epi64(_mm256_loadu_si256(vectors + 1), CompactSlot::kTagShift);
+    return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(low, search_tag))) |
+           (_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(high, search_tag))) << 4);
+#else
+    uint32_t matches = 0;
+    for (unsigned i = 0; i < kNumSlotPerCacheLine; ++i) {
+        matches |= static_cast<uint32_t>(CompactSlot::TagOf(words[i]) == tag) << i;
+    }
+    return matches;
+#endif
+}
+
+template <typename KeyType>
+bool CompactSegment<KeyType>::Insert4split(const word_t word, const size_t key_hash) {
+    for (size_t window = 0; window < kNumWindow; ++window) {
+        const size_t loc = WindowLoc(key_hash, window);
+        for (unsigned i = 0; i < kNumWindowSlot; ++i) {
+            const size_t slot = WindowSlot(loc, i);
+            if (_[slot] == CompactSlot::kEmpty) {
+                if (window > 0) {
+                    MarkOverflow(key_hash);
+                }
+                _[slot] = word;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+template <typename KeyType>
+template <typename KeyCheckFn, typename Hasher>
+CompactSegment<KeyType>* CompactSegment<KeyType>::Split(const size_t key_hash, KeyCheckFn key_check_fn,
+                                                        const Hasher& hasher) {
+    uint64_t lock = 0;
+    if (!sema.compare_exchange_strong(lock, EXCLUSIVE_LOCK)) {
+        if (lock == EXCLUSIVE_LOCK) {
+            return nullptr;
+        }
+
+        lock = SPLIT_REQUEST_BIT;
+        if (!sema.compare_exchange_strong(lock, EXCLUSIVE_LOCK)) {
+            if ((lock & SPLIT_REQUEST_BIT) != 0) {
+                return nullptr;
+            }
+            sema.compare_exchange_strong(lock, lock | SPLIT_REQUEST_BIT);
+            return nullptr;
+        }
+    }
+
+    if (!Covers(key_hash) || is_dir_pending.load()) {
+        sema.store(0);
+        return nullptr;
+    }
+
+    // Readers still probe this segment while the keys are copied. They retry if the version changed in between.
+    version.fetch_add(1);
+
+    CompactSegment* new_sibling = new CompactSegment(local_depth + 1);
+    new_sibling->pattern = (pattern << 1) + 1;
+    new_sibling->is_dir_pending.store(true);
+
+    const size_t split_bit = (size_t) 1 << (8 * sizeof(size_t) - local_depth - 1);
+    std::bitset<kNumSlot + kNumStashSlot> is_moved;
+    for (size_t i = 0; i < kNumSlot + kNumStashSlot; ++i) {
+        if (_[i] == CompactSlot::kEmpty) continue;
+        const size_t slot_hash = hasher.bytes_hash(key_check_fn.stored_key(CompactSlot::OffsetOf(_[i])));
+        if ((slot_hash & split_bit) == 0) continue;
+        if (!new_sibling->Insert4split(_[i], slot_hash)) {
+            throw std::runtime_error("Could not move key to new segment. This should never happen!");
+        }
+        is_moved[i] = true;
+    }
+    persist((char*) new_sibling, sizeof(CompactSegment));
+
+    is_dir_pending.store(true);
+    sibling.store(new_sibling);
+    local_depth = local_depth + 1;
+    pattern = pattern << 1;
+    persist((char*) &local_depth, sizeof(size_t));
+    persist((char*) &pattern, sizeof(size_t));
+    // Readers that checked the old pattern retry. Readers with the new version do not cover the moved keys anymore,
+    // so they never probe this segment for a key that is removed below.
+    version.fetch_add(1);
+
+    for (size_t i = 0; i < kNumSlot + kNumStashSlot; ++i) {
+        if (is_moved[i]) {
+            _[i] = CompactSlot::kEmpty;
+        }
+    }
+    persist((char*) _, sizeof(_));
+    sema.store(0);
+
+    return new_sibling;
+}
+
+template <typename KeyType, typename HashPolicy>
+CompactCCEH<KeyType, HashPolicy>::CompactCCEH(size_t initCap)
+    : dir{new Directory<KeyType, CompactSegment<KeyType>>(static_cast<size_t>(log2(initCap)))}
+{
+    for (unsigned i = 0; i < dir->capacity; ++i) {
+        dir->_[i] = new CompactSegment<KeyType>(static_cast<size_t>(log2(initCap)));
+        dir->_[i]->pattern = i;
+    }
+    counters_.num_segments.store(dir->capacity);
+}
+
+template <typename KeyType, typename HashPolicy>
+size_t CompactCCEH<KeyType, HashPolicy>::NumSegmentsFor(const size_t num_keys) {
+    const double keys_per_segment = CompactSegment<KeyType>::kNumSlot * kPresizeLoadFactor;
+    const size_t num_segments = std::ceil(num_keys / keys_per_segment);
+    size_t power_of_two = 2;
+    while (power_of_two < num_segments) {
+        power_of_two <<= 1;
+    }
+    return power_of_two;
+}
+
+template <typename KeyType, typename HashPolicy>
+template <typename KeyCheckFn>
+IndexV CompactCCEH<KeyType, HashPolicy>::Insert(const KeyType& key, IndexV value, KeyCheckFn key_check_fn) {
+    const size_t key_hash = hasher_(key);
+    const epoch::EpochGuard epoch_guard;
+
+    while (true) {
+        const Directory<KeyType, CompactSegment<KeyType>>* directory = ATOMIC_LOAD(&dir);
+        const size_t x = (key_hash >> (8 * sizeof(key_hash) - directory->depth));
+        CompactSegment<KeyType>* target = directory->_[x]->Resolve(key_hash);
+        if (target == nullptr) {
+            continue;
+        }
+        IndexV old_entry{};
+        const int ret = target->Insert(key, value, key_hash, &old_entry, key_check_fn);
+        if (ret == 0) {
+            counters_.CountReplace(old_entry, value);
+            return old_entry;
+        } else if (ret == 2) {
+            continue;
+        }
+
+        CompactSegment<KeyType>* sibling = target->Split(key_hash, key_check_fn, hasher_);
+        if (sibling == nullptr) {
+            continue;
+        }
+        counters_.num_segments.fetch_add(1);
+        counters_.num_splits.fetch_add(1);
+        PublishSplit(dir, target, sibling, key_hash);
+    }
+}
+
+template <typename KeyType, typename HashPolicy>
+template <typename KeyCheckFn>
+bool CompactCCEH<KeyType, HashPolicy>::Delete(const KeyType& key, KeyCheckFn key_check_fn) {
+    const IndexV old_entry = Insert(key, IndexV::NONE(), key_check_fn);
+    return !old_entry.is_tombstone();
+}
+
+template <typename KeyType, typename HashPolicy>
+template <typename KeyCheckFn>
+void CompactCCEH<KeyType, HashPolicy>::BulkLoad(const std::vector<std::pair<KeyType, IndexV>>& entries, KeyCheckFn key_check_fn,
+                                    size_t num_threads) {
+    num_threads = std::max(1ul, std::min(num_threads, entries.size()));
+    const size_t num_entries_per_thread = (entries.size() / num_threads) + 1;
+
+    // Segments of the loading threads are allocated on the same node as those of the caller.
+    const size_t allocation_node = numa::AllocationNode();
+    std::vector<std::thread> load_threads;
+    load_threads.reserve(num_threads);
+    for (size_t thread_num = 0; thread_num < num_threads; ++thread_num) {
+        const size_t start = std::min(thread_num * num_entries_per_thread, entries.size());
+        const size_t end = std::min(start + num_entries_per_thread, entries.size());
+        load_threads.emplace_back([&, start, end] {
+            const numa::NodeScope node_scope{allocation_node};
+            for (size_t i = start; i < end; ++i) {
+                Insert(entries[i].first, entries[i].second, key_check_fn);
+            }
+        });
+    }
+
+    for (std::thread& thread : load_threads) {
+        thread.join();
+    }
+}
+
+template <typename KeyType, typename HashPolicy>
+template <typename KeyCheckFn>
+IndexV CompactCCEH<KeyType, HashPolicy>::Get(const KeyType& key, KeyCheckFn key_check_fn) {
+    return GetHashed(key, hasher_(key), key_check_fn);
+}
+
+template <typename KeyType, typename HashPolicy>
+template <typename KeyCheckFn>
+void CompactCCEH<KeyType, HashPolicy>::MultiGet(const KeyType* keys, const size_t num_keys, IndexV* offsets,
+                                    KeyCheckFn key_check_fn) {
+    size_t key_hashes[kMultiGetBatchSize];
+    const epoch::EpochGuard epoch_guard;
+    for (size_t batch_start = 0; batch_start < num_keys; batch_start += kMultiGetBatchSize) {
+        const KeyType* batch_keys = keys + batch_start;
+        const size_t batch_size = std::min(kMultiGetBatchSize, num_keys - batch_start);
+        const Directory<KeyType, CompactSegment<KeyType>>* directory = ATOMIC_LOAD(&dir);
+        const size_t dir_shift = 8 * sizeof(size_t) - directory->depth;
+
+        for (size_t i = 0; i < batch_size; ++i) {
+            key_hashes[i] = hasher_(batch_keys[i]);
+            _mm_prefetch(reinterpret_cast<const char*>(&directory->_[key_hashes[i] >> dir_shift]), _MM_HINT_T0);
+        }
+
+        for (size_t i = 0; i < batch_size; ++i) {
+            const CompactSegment<KeyType>* segment = directory->_[key_hashes[i] >> dir_shift];
+            const size_t loc = CompactSegment<KeyType>::WindowLoc(key_hashes[i], 0);
+            for (size_t line = 0; line < kNumCacheLine; ++line) {
+                const size_t slot =
+                    CompactSegment<KeyType>::WindowSlot(loc, line * CompactSegment<KeyType>::kNumSlotPerCacheLine);
+                _mm_prefetch(reinterpret_cast<const char*>(&segment->_[slot]), _MM_HINT_T0);
+            }
+            _mm_prefetch(reinterpret_cast<const char*>(&segment->version), _MM_HINT_T0);
+        }
+
+        for (size_t i = 0; i < batch_size; ++i) {
+            offsets[batch_start + i] = GetHashed(batch_keys[i], key_hashes[i], key_check_fn);
+        }
+    }
+}
+
+template <typename KeyType, typename HashPolicy>
+template <typename KeyCheckFn>
+IndexV CompactCCEH<KeyType, HashPolicy>::GetHashed(const KeyType& key, const size_t key_hash, KeyCheckFn key_check_fn) {
+    const uint16_t tag = CompactSlot::Tag(key_hash);
+    const epoch::EpochGuard epoch_guard;
+    while (true) {
+        const Directory<KeyType, CompactSegment<KeyType>>* directory = ATOMIC_LOAD(&dir);
+        const size_t seg_num = (key_hash >> (8 * sizeof(key_hash) - directory->depth));
+        CompactSegment<KeyType>* segment = directory->_[seg_num]->Resolve(key_hash);
+        if (segment == nullptr) {
+            continue;
+        }
+        const uint64_t version = segment->version.load(std::memory_order_acquire);
+        if (!segment->Covers(key_hash)) {
+            continue;
+        }
+
+        auto probe_window = [&](const size_t loc) {
+            for (unsigned line = 0; line < kNumCacheLine; ++line) {
+                for (uint32_t matches = segment->ProbeLine(tag, loc, line); matches != 0; matches &= matches - 1) {
+                    const size_t slot = CompactSegment<KeyType>::WindowSlot(
+                        loc, line * CompactSegment<KeyType>::kNumSlotPerCacheLine + __builtin_ctz(matches));
+                    const CompactSlot::word_t word = ATOMIC_LOAD(&segment->_[slot]);
+                    if (CompactSlot::TagOf(word) != tag) {
+                        // Slot was reused for another key after the probe.
+                        continue;
+                    }
+                    // Tags of different keys may match, so the key of the record decides.
+                    const IndexV slot_value = CompactSlot::OffsetOf(word);
+                    if (key_check_fn(key, slot_value)) {
+                        return slot_value;
+                    }
+                }
+            }
+            return IndexV::NONE();
+        };
+
+        IndexV offset = probe_window(CompactSegment<KeyType>::WindowLoc(key_hash, 0));
+        if (offset.is_tombstone()) {
+            const size_t num_windows = segment->NumWindows(key_hash);
+            for (size_t window = 1; window < num_windows && offset.is_tombstone(); ++window) {
+                offset = probe_window(CompactSegment<KeyType>::WindowLoc(key_hash, window));
+            }
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (segment->version.load(std::memory_order_relaxed) == version) {
+            return offset;
+        }
+    }
+}
+
+template <typename KeyType, typename HashPolicy>
+size_t CompactCCEH<KeyType, HashPolicy>::Capacity(void) {
+    return counters_.num_segments.load() * (CompactSegment<KeyType>::kNumSlot + CompactSegment<KeyType>::kNumStashSlot);
+}
+
+template <typename KeyType, typename HashPolicy>
+IndexStats CompactCCEH<KeyType, HashPolicy>::GetStats() const {
+    const epoch::EpochGuard epoch_guard;
+    return counters_.Stats<CompactSegment<KeyType>>(ATOMIC_LOAD(&dir));
+}
+
+template <typename KeyType, typename HashPolicy>
+CompactCCEH<KeyType, HashPolicy>::~CompactCCEH() {
+#ifndef CCEH_PERSISTENT
+    std::unordered_map<CompactSegment<KeyType>*, bool> set;
+    for (size_t i = 0; i < dir->capacity; ++i) {
+        set[dir->_[i]] = true;
+    }
+    for (auto const& [seg, foo] : set) {
+        delete seg;
+    }
+#endif
+}
+
+}  // namespace cceh
+}  // namespace viper
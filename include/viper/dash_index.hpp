@@ -0,0 +1,735 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <thread>
+#include <vector>
+#include <immintrin.h>
+
+#include "cceh.hpp"
+
+namespace viper::dash {
+
+using cceh::EXCLUSIVE_LOCK;
+using cceh::Pair;
+using cceh::SPLIT_REQUEST_BIT;
+
+/**
+ * A bucket of 14 slots in four cache lines. The first line holds the bucket's lock and one fingerprint byte per
+ * slot, so a probe compares all fingerprints at once and only reads the slots whose fingerprint matches.
+ * Writers lock the bucket. Readers do not write to it and retry if its version changed while they probed it.
+ */
+struct alignas(64) Bucket {
+    static constexpr size_t kNumSlot = 14;
+    static constexpr uint32_t kSlotMask = (1u << kNumSlot) - 1;
+
+    void Lock() {
+        uint32_t version = version_lock.load(std::memory_order_relaxed);
+        while ((version & 1) != 0 ||
+               !version_lock.compare_exchange_weak(version, version + 1, std::memory_order_acquire)) {
+            _mm_pause();
+            version = version_lock.load(std::memory_order_relaxed);
+        }
+    }
+
+    bool TryLock() {
+        uint32_t version = version_lock.load(std::memory_order_relaxed);
+        return (version & 1) == 0 &&
+               version_lock.compare_exchange_strong(version, version + 1, std::memory_order_acquire);
+    }
+
+    void Unlock() {
+        version_lock.fetch_add(1, std::memory_order_release);
+    }
+
+    /** Returns a mask with bit i set if slot i is used and has fingerprint `fp`. One SSE2 compare checks all slots. */
+    uint32_t MatchFingerprints(const uint8_t fp) const {
+#if defined(__SSE2__)
+        const __m128i fps = _mm_load_si128(reinterpret_cast<const __m128i*>(fingerprints));
+        const uint32_t matches = _mm_movemask_epi8(_mm_cmpeq_epi8(fps, _mm_set1_epi8(fp)));
+#else
+        uint32_t matches = 0;
+        for (size_t i = 0; i < kNumSlot; ++i) {
+            matches |= static_cast<uint32_t>(fingerprints[i] == fp) << i;
+        }
+#endif
+        return matches & ATOMIC_LOAD(&bitmap);
+    }
+
+    size_t NumUsed() const {
+        return __builtin_popcount(bitmap);
+    }
+
+    bool IsFull() const {
+        return bitmap == kSlotMask;
+    }
+
+    /**
+     * Writes a pair into a free slot. `is_displaced` is true if the key's target bucket is the previous bucket.
+     * The bucket must be locked or private to the caller.
+     */
+    void Add(const IndexK key, const IndexV value, const uint8_t fp, const bool is_displaced) {
+        const size_t slot = __builtin_ctz(~bitmap & kSlotMask);
+        slots[slot].value = value;
+        slots[slot].key = key;
+        fingerprints[slot] = fp;
+        displaced = (displaced & ~(1u << slot)) | (static_cast<uint32_t>(is_displaced) << slot);
+        ATOMIC_STORE(&bitmap, static_cast<uint16_t>(bitmap | (1u << slot)));
+    }
+
+    void Erase(const size_t slot) {
+        ATOMIC_STORE(&bitmap, static_cast<uint16_t>(bitmap & ~(1u << slot)));
+    }
+
+    /** Moves the pair in `slot` to `other`, which must have a free slot. Both buckets must be locked. */
+    void Move(const size_t slot, Bucket& other, const bool is_displaced) {
+        // The pair is in both buckets for a moment, so readers that probe them in order always find it.
+        other.Add(slots[slot].key, slots[slot].value, fingerprints[slot], is_displaced);
+        Erase(slot);
+    }
+
+    // Odd while a writer holds the bucket.
+    std::atomic<uint32_t> version_lock = 0;
+    // Bit i is set if slot i is used.
+    uint16_t bitmap = 0;
+    // Bit i is set if the key in slot i was displaced here from the previous bucket.
+    uint16_t displaced = 0;
+    // Number of keys of this (normal) bucket that are in a stash bucket. Lookups only probe the stash if it is > 0.
+    uint8_t stash_count = 0;
+    alignas(16) uint8_t fingerprints[16] = {};
+    alignas(16) Pair slots[kNumSlot];
+};
+static_assert(sizeof(Bucket) == 256, "A bucket should fill exactly four cache lines.");
+
+/**
+ * A segment of kNumBucket normal buckets and kNumStashBucket stash buckets. A key may be in its target bucket, the
+ * next bucket, or, if both are full, in a stash bucket. Inserts go to the less loaded of the first two and move a key
+ * to its other bucket if both are full, which keeps the buckets evenly filled, so that a segment only splits once
+ * about 95% of its slots are used.
+ * Writers share the segment through `sema` and lock the buckets they change. A split locks the whole segment.
+ */
+template <typename KeyType>
+struct DashSegment {
+    static constexpr size_t kNumBucket = 64;
+    static constexpr size_t kNumStashBucket = 4;
+    static constexpr size_t kNumSlot = kNumBucket * Bucket::kNumSlot;
+    static constexpr size_t kNumStashSlot = kNumStashBucket * Bucket::kNumSlot;
+    // The lowest hash bits are the fingerprint, the next ones select the bucket, and the top ones the segment.
+    static constexpr size_t kFingerprintBits = 8;
+
+    DashSegment(size_t depth)
+        : local_depth{depth}
+    { }
+
+    void* operator new(size_t size) {
+#ifdef CCEH_PERSISTENT
+        PMEMoid ret;
+        PMemAllocator::get().allocate(&ret, size);
+        return pmemobj_direct(ret);
+#else
+        return SegmentArena::get().allocate(size);
+#endif
+    }
+
+#ifdef CCEH_PERSISTENT
+    void operator delete(void* addr) {
+        PMEMoid oid = pmemobj_oid(addr);
+        pmemobj_free(&oid);
+    }
+#else
+    void operator delete(void* addr, size_t size) {
+        SegmentArena::get().free(addr, size);
+    }
+#endif
+
+    static uint8_t Fingerprint(const size_t key_hash) {
+        return key_hash;
+    }
+
+    static size_t BucketOf(const size_t key_hash) {
+        return (key_hash >> kFingerprintBits) % kNumBucket;
+    }
+
+    /** Returns 0 on success, 1 if the segment is full, and 2 if the key belongs to another segment by now. */
+    template <typename KeyCheckFn>
+    int Insert(const KeyType&, IndexV, size_t key_hash, IndexV* old_entry, KeyCheckFn);
+
+    /**
+     * Writes the offset of the key to `offset` (or a tombstone). Returns false if a bucket changed while it was
+     * probed, in which case the caller retries.
+     */
+    template <typename KeyCheckFn>
+    bool Get(const KeyType&, size_t key_hash, KeyCheckFn, IndexV* offset) const;
+
+    /** Inserts into a segment that no other thread accesses. Returns false if the buckets and the stash are full. */
+    bool Insert4split(IndexK, IndexV, size_t key_hash);
+
+    /**
+     * Frees a slot in the full target bucket or its neighbor by moving one of their keys to its other bucket.
+     * Both buckets must be locked. The buckets around them are only used if they are not locked by another writer.
+     * Returns the bucket with the free slot, or nullptr if no key could be moved.
+     */
+    Bucket* Displace(size_t target);
+
+    /** Balanced insert into the target bucket or its neighbor, after displacing a key if both are full. */
+    bool InsertBalanced(IndexK, IndexV, size_t key_hash);
+
+    /** See CompactSegment::Split. Moved keys are removed before the segment is unlocked. */
+    template <typename Hasher>
+    DashSegment* Split(size_t key_hash, const Hasher&);
+
+    bool Covers(size_t key_hash) const {
+        return (key_hash >> (8 * sizeof(key_hash) - ATOMIC_LOAD(&local_depth))) == ATOMIC_LOAD(&pattern);
+    }
+
+    DashSegment* Resolve(size_t key_hash) {
+        if (Covers(key_hash)) {
+            return this;
+        }
+        DashSegment* pending_sibling = sibling.load(std::memory_order_acquire);
+        if (pending_sibling != nullptr && pending_sibling->Covers(key_hash)) {
+            return pending_sibling;
+        }
+        return nullptr;
+    }
+
+    /** Value stored as the key of a slot: the key itself if it fits, else its full hash. */
+    static IndexK KeyChecker(const KeyType& key, const size_t key_hash) {
+        if constexpr (using_fp_) {
+            return key_hash;
+        } else {
+            return *reinterpret_cast<const IndexK*>(&key);
+        }
+    }
+
+    /** Hash of the key in a slot. */
+    template <typename Hasher>
+    static size_t SlotHash(const Pair& pair, const Hasher& hasher) {
+        if constexpr (using_fp_) {
+            return pair.key;
+        } else {
+            return hasher.stored_hash(pair.key);
+        }
+    }
+
+    Bucket buckets[kNumBucket + kNumStashBucket];
+    size_t local_depth;
+    std::atomic<uint64_t> version = 0;
+    size_t pattern = 0;
+    std::atomic<uint64_t> sema = 0;
+    std::atomic<DashSegment*> sibling = nullptr;
+    std::atomic<bool> is_dir_pending = false;
+    static constexpr bool using_fp_ = requires_fingerprint(KeyType);
+};
+
+/**
+ * A hash index after Dash (Lu et al., VLDB '20) in DRAM. It uses CCEH's extendible directory, but its segments consist
+ * of buckets with fingerprints (see Bucket and DashSegment). A lookup reads the fingerprint line of one or two
+ * buckets and only the slots whose fingerprint matches, instead of all lines of a CCEH probe window.
+ * Segments also fill up further than CCEH's before they split. Segments are not merged and the hash is not learned.
+ */
+template <typename KeyType, typename HashPolicy = cceh::StdHash>
+class DashIndex {
+  public:
+    static constexpr bool kIsOrdered = false;
+    using SegmentT = DashSegment<KeyType>;
+    using DirectoryT = cceh::Directory<KeyType, SegmentT>;
+
+    /** Creates a DashIndex with `initCap` segments, rounded down to a power of two. */
+    DashIndex(size_t initCap);
+    ~DashIndex();
+
+    /** Number of segments to hold `num_keys` keys at kPresizeLoadFactor. */
+    static size_t NumSegmentsFor(size_t num_keys);
+
+    template <typename KeyCheckFn>
+    IndexV Insert(const KeyType&, IndexV, KeyCheckFn);
+
+    template <typename KeyCheckFn>
+    IndexV Get(const KeyType&, KeyCheckFn);
+
+    /** See CCEH::MultiGet. Only the fingerprint line of each key's target bucket is prefetched. */
+    template <typename KeyCheckFn>
+    void MultiGet(const KeyType* keys, size_t num_keys, IndexV* offsets, KeyCheckFn);
+
+    template <typename KeyCheckFn>
+    bool Delete(const KeyType&, KeyCheckFn);
+
+    template <typename KeyCheckFn>
+    void BulkLoad(const std::vector<std::pair<KeyType, IndexV>>&, KeyCheckFn, size_t num_threads = 1);
+
+    size_t Capacity(void);
+
+    /** See CCEH::GetStats. Moved keys are removed by splits, so there are no stale slots. */
+    cceh::IndexStats GetStats() const;
+
+    static constexpr size_t kMultiGetBatchSize = 64;
+    static constexpr double kPresizeLoadFactor = 0.8;
+
+  private:
+    template <typename KeyCheckFn>
+    IndexV GetHashed(const KeyType&, size_t key_hash, KeyCheckFn);
+
+    DirectoryT* dir;
+    cceh::KeyHasher<KeyType, HashPolicy> hasher_;
+    cceh::IndexCounters counters_;
+};
+
+template <typename KeyType>
+template <typename KeyCheckFn>
+int DashSegment<KeyType>::Insert(const KeyType& key, IndexV value, size_t key_hash, IndexV* old_entry,
+                                 KeyCheckFn key_check_fn) {
+    uint64_t lock = sema.load();
+    if (lock == EXCLUSIVE_LOCK) return 2;
+    if (IS_BIT_SET(lock, SPLIT_REQUEST_BIT)) return 1;
+    while (!sema.compare_exchange_weak(lock, lock + 1)) {
+        if (lock == EXCLUSIVE_LOCK) return 2;
+        if (IS_BIT_SET(lock, SPLIT_REQUEST_BIT)) return 1;
+    }
+
+    if (!Covers(key_hash)) {
+        sema.fetch_sub(1);
+        return 2;
+    }
+
+    const IndexK key_checker = KeyChecker(key, key_hash);
+    const uint8_t fp = Fingerprint(key_hash);
+    const size_t target = BucketOf(key_hash);
+    const size_t neighbor = (target + 1) % kNumBucket;
+    Bucket& target_bucket = buckets[target];
+    Bucket& neighbor_bucket = buckets[neighbor];
+    // All writers lock buckets in ascending order. Stash buckets come last.
+    buckets[std::min(target, neighbor)].Lock();
+    buckets[std::max(target, neighbor)].Lock();
+
+    auto unlock = [&](const int ret) {
+        neighbor_bucket.Unlock();
+        target_bucket.Unlock();
+        sema.fetch_sub(1);
+        return ret;
+    };
+
+    // Replaces the value of `key` in `bucket`. Returns false if the bucket does not hold the key.
+    auto update = [&](Bucket& bucket) {
+        for (uint32_t matches = bucket.MatchFingerprints(fp); matches != 0; matches &= matches - 1) {
+            const size_t slot = __builtin_ctz(matches);
+            if (bucket.slots[slot].key != key_checker) continue;
+            if constexpr (using_fp_) {
+                if (!key_check_fn(key, bucket.slots[slot].value)) continue;
+            }
+            *old_entry = bucket.slots[slot].value;
+            if (value.is_tombstone()) {
+                bucket.Erase(slot);
+            } else {
+                ATOMIC_STORE(&bucket.slots[slot].value.offset, value.offset);
+            }
+            return true;
+        }
+        return false;
+    };
+
+    *old_entry = IndexV::NONE();
+    if (update(target_bucket) || update(neighbor_bucket)) {
+        return unlock(0);
+    }
+    if (target_bucket.stash_count > 0) {
+        for (size_t stash = kNumBucket; stash < kNumBucket + kNumStashBucket; ++stash) {
+            buckets[stash].Lock();
+            const bool is_updated = update(buckets[stash]);
+            buckets[stash].Unlock();
+            if (is_updated) {
+                target_bucket.stash_count -= value.is_tombstone();
+                return unlock(0);
+            }
+        }
+    }
+
+    if (value.is_tombstone()) {
+        // Deleting a key that does not exist.
+        return unlock(0);
+    }
+
+    if (InsertBalanced(key_checker, value, key_hash)) {
+        return unlock(0);
+    }
+    for (size_t stash = kNumBucket; stash < kNumBucket + kNumStashBucket; ++stash) {
+        buckets[stash].Lock();
+        const bool has_space = !buckets[stash].IsFull();
+        if (has_space) {
+            buckets[stash].Add(key_checker, value, fp, false);
+        }
+        buckets[stash].Unlock();
+        if (has_space) {
+            // The target bucket is locked, so readers see the count change only with the key in the stash.
+            target_bucket.stash_count++;
+            return unlock(0);
+        }
+    }
+    return unlock(1);
+}
+
+template <typename KeyType>
+template <typename KeyCheckFn>
+bool DashSegment<KeyType>::Get(const KeyType& key, const size_t key_hash, KeyCheckFn key_check_fn,
+                               IndexV* offset) const {
+    const IndexK key_checker = KeyChecker(key, key_hash);
+    const uint8_t fp = Fingerprint(key_hash);
+    const size_t target = BucketOf(key_hash);
+    uint8_t stash_count = 0;
+
+    // Returns false if the bucket was locked or changed while it was probed.
+    auto probe = [&](const Bucket& bucket) {
+        const uint32_t version = bucket.version_lock.load(std::memory_order_acquire);
+        if ((version & 1) != 0) {
+            return false;
+        }
+        *offset = IndexV::NONE();
+        for (uint32_t matches = bucket.MatchFingerprints(fp); matches != 0; matches &= matches - 1) {
+            const size_t slot = __builtin_ctz(matches);
+            const IndexV slot_value{ATOMIC_LOAD(&bucket.slots[slot].value.offset)};
+            if (ATOMIC_LOAD(&bucket.slots[slot].key) != key_checker) continue;
+            if constexpr (using_fp_) {
+                if (!key_check_fn(key, slot_value)) continue;
+            }
+            *offset = slot_value;
+            break;
+        }
+        if (&bucket == &buckets[target]) {
+            stash_count = bucket.stash_count;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return bucket.version_lock.load(std::memory_order_relaxed) == version;
+    };
+
+    const uint32_t target_version = buckets[target].version_lock.load(std::memory_order_acquire);
+    if (!probe(buckets[target])) return false;
+    if (!offset->is_tombstone()) return true;
+    if (!probe(buckets[(target + 1) % kNumBucket])) return false;
+    if (offset->is_tombstone() && stash_count > 0) {
+        for (size_t stash = kNumBucket; stash < kNumBucket + kNumStashBucket; ++stash) {
+            if (!probe(buckets[stash])) return false;
+            if (!offset->is_tombstone()) break;
+        }
+    }
+    // A key displaced back into the target bucket while the others were probed changed its version.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return buckets[target].version_lock.load(std::memory_order_relaxed) == target_version;
+}
+
+template <typename KeyType>
+bool DashSegment<KeyType>::InsertBalanced(const IndexK key, const IndexV value, const size_t key_hash) {
+    const size_t target = BucketOf(key_hash);
+    Bucket& target_bucket = buckets[target];
+    Bucket& neighbor_bucket = buckets[(target + 1) % kNumBucket];
+    // The less loaded bucket, or the target bucket if both are equally loaded.
+    Bucket* emptier_bucket = neighbor_bucket.NumUsed() < target_bucket.NumUsed() ? &neighbor_bucket : &target_bucket;
+    if (emptier_bucket->IsFull()) {
+        emptier_bucket = Displace(target);
+        if (emptier_bucket == nullptr) {
+            return false;
+        }
+    }
+    emptier_bucket->Add(key, value, Fingerprint(key_hash), emptier_bucket == &neighbor_bucket);
+    return true;
+}
+
+template <typename KeyType>
+Bucket* DashSegment<KeyType>::Displace(const size_t target) {
+    const size_t neighbor = (target + 1) % kNumBucket;
+    Bucket& target_bucket = buckets[target];
+    Bucket& neighbor_bucket = buckets[neighbor];
+
+    // A key in the neighbor bucket that is in its own target bucket can move to the bucket after it.
+    Bucket& next_bucket = buckets[(neighbor + 1) % kNumBucket];
+    const uint32_t movable_to_next = neighbor_bucket.bitmap & ~neighbor_bucket.displaced;
+    if (movable_to_next != 0 && &next_bucket != &target_bucket && next_bucket.TryLock()) {
+        const bool has_space = !next_bucket.IsFull();
+        if (has_space) {
+            neighbor_bucket.Move(__builtin_ctz(movable_to_next), next_bucket, true);
+        }
+        next_bucket.Unlock();
+        if (has_space) {
+            return &neighbor_bucket;
+        }
+    }
+
+    // A key in the target bucket that was displaced from the previous bucket can move back.
+    Bucket& previous_bucket = buckets[(target + kNumBucket - 1) % kNumBucket];
+    const uint32_t movable_to_previous = target_bucket.bitmap & target_bucket.displaced;
+    if (movable_to_previous != 0 && &previous_bucket != &neighbor_bucket && previous_bucket.TryLock()) {
+        const bool has_space = !previous_bucket.IsFull();
+        if (has_space) {
+            target_bucket.Move(__builtin_ctz(movable_to_previous), previous_bucket, false);
+        }
+        previous_bucket.Unlock();
+        if (has_space) {
+            return &target_bucket;
+        }
+    }
+    return nullptr;
+}
+
+template <typename KeyType>
+bool DashSegment<KeyType>::Insert4split(const IndexK key, const IndexV value, const size_t key_hash) {
+    if (InsertBalanced(key, value, key_hash)) {
+        return true;
+    }
+    for (size_t stash = kNumBucket; stash < kNumBucket + kNumStashBucket; ++stash) {
+        if (!buckets[stash].IsFull()) {
+            buckets[stash].Add(key, value, Fingerprint(key_hash), false);
+            buckets[BucketOf(key_hash)].stash_count++;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename KeyType>
+template <typename Hasher>
+DashSegment<KeyType>* DashSegment<KeyType>::Split(const size_t key_hash, const Hasher& hasher) {
+    uint64_t lock = 0;
+    if (!sema.compare_exchange_strong(lock, EXCLUSIVE_LOCK)) {
+        if (lock == EXCLUSIVE_LOCK) {
+            return nullptr;
+        }
+
+        lock = SPLIT_REQUEST_BIT;
+        if (!sema.compare_exchange_strong(lock, EXCLUSIVE_LOCK)) {
+            if ((lock & SPLIT_REQUEST_BIT) != 0) {
+                return nullptr;
+            }
+            sema.compare_exchange_strong(lock, lock | SPLIT_REQUEST_BIT);
+            return nullptr;
+        }
+    }
+
+    if (!Covers(key_hash) || is_dir_pending.load()) {
+        sema.store(0);
+        return nullptr;
+    }
+
+    // Readers still probe this segment while the keys are copied. They retry if the version changed in between.
+    version.fetch_add(1);
+
+    DashSegment* new_sibling = new DashSegment(local_depth + 1);
+    new_sibling->pattern = (pattern << 1) + 1;
+    new_sibling->is_dir_pending.store(true);
+
+    const size_t split_bit = (size_t) 1 << (8 * sizeof(size_t) - local_depth - 1);
+    std::bitset<kNumSlot + kNumStashSlot> is_moved;
+    for (size_t bucket = 0; bucket < kNumBucket + kNumStashBucket; ++bucket) {
+        for (uint32_t used = buckets[bucket].bitmap; used != 0; used &= used - 1) {
+            const size_t slot = __builtin_ctz(used);
+            const Pair& pair = buckets[bucket].slots[slot];
+            const size_t slot_hash = SlotHash(pair, hasher);
+            if ((slot_hash & split_bit) == 0) continue;
+            if (!new_sibling->Insert4split(pair.key, pair.value, slot_hash)) {
+                throw std::runtime_error("Could not move key to new segment. This should never happen!");
+            }
+            is_moved[bucket * Bucket::kNumSlot + slot] = true;
+        }
+    }
+
+    is_dir_pending.store(true);
+    sibling.store(new_sibling);
+    local_depth = local_depth + 1;
+    pattern = pattern << 1;
+    // Readers that checked the old pattern retry. Readers with the new version do not cover the moved keys anymore,
+    // so they never probe this segment for a key that is removed below.
+    version.fetch_add(1);
+
+    for (size_t bucket = 0; bucket < kNumBucket + kNumStashBucket; ++bucket) {
+        for (size_t slot = 0; slot < Bucket::kNumSlot; ++slot) {
+            if (!is_moved[bucket * Bucket::kNumSlot + slot]) continue;
+            buckets[bucket].Erase(slot);
+            if (bucket >= kNumBucket) {
+                buckets[BucketOf(SlotHash(buckets[bucket].slots[slot], hasher))].stash_count--;
+            }
+        }
+    }
+    sema.store(0);
+
+    return new_sibling;
+}
+
+template <typename KeyType, typename HashPolicy>
+DashIndex<KeyType, HashPolicy>::DashIndex(size_t initCap)
+    : dir{new DirectoryT(static_cast<size_t>(log2(initCap)))}
+{
+    for (unsigned i = 0; i < dir->capacity; ++i) {
+        dir->_[i] = new SegmentT(static_cast<size_t>(log2(initCap)));
+        dir->_[i]->pattern = i;
+    }
+    counters_.num_segments.store(dir->capacity);
+}
+
+template <typename KeyType, typename HashPolicy>
+size_t DashIndex<KeyType, HashPolicy>::NumSegmentsFor(const size_t num_keys) {
+    const double keys_per_segment = SegmentT::kNumSlot * kPresizeLoadFactor;
+    const size_t num_segments = std::ceil(num_keys / keys_per_segment);
+    size_t power_of_two = 2;
+    while (power_of_two < num_segments) {
+        power_of_two <<= 1;
+    }
+    return power_of_two;
+}
+
+template <typename KeyType, typename HashPolicy>
+template <typename KeyCheckFn>
+IndexV DashIndex<KeyType, HashPolicy>::Insert(const KeyType& key, IndexV value, KeyCheckFn key_check_fn) {
+    const size_t key_hash = hasher_(key);
+    const epoch::EpochGuard epoch_guard;
+
+    while (true) {
+        const DirectoryT* directory = ATOMIC_LOAD(&dir);
+        const size_t x = (key_hash >> (8 * sizeof(key_hash) - directory->depth));
+        SegmentT* target = directory->_[x]->Resolve(key_hash);
+        if (target == nullptr) {
+            continue;
+        }
+        IndexV old_entry{};
+        const int ret = target->Insert(key, value, key_hash, &old_entry, key_check_fn);
+        if (ret == 0) {
+            counters_.CountReplace(old_entry, value);
+            return old_entry;
+        } else if (ret == 2) {
+            continue;
+        }
+
+        SegmentT* sibling = target->Split(key_hash, hasher_);
+        if (sibling == nullptr) {
+            continue;
+        }
+        counters_.num_segments.fetch_add(1);
+        counters_.num_splits.fetch_add(1);
+        cceh::PublishSplit(dir, target, sibling, key_hash);
+    }
+}
+
+template <typename KeyType, typename HashPolicy>
+template <typename KeyCheckFn>
+bool DashIndex<KeyType, HashPolicy>::Delete(const KeyType& key, KeyCheckFn key_check_fn) {
+    const IndexV old_entry = Insert(key, IndexV::NONE(), key_check_fn);
+    return !old_entry.is_tombstone();
+}
+
+template <typename KeyType, typename HashPolicy>
+template <typename KeyCheckFn>
+void DashIndex<KeyType, HashPolicy>::BulkLoad(const std::vector<std::pair<KeyType, IndexV>>& entries,
+                                              KeyCheckFn key_check_fn, size_t num_threads) {
+    num_threads = std::max(1ul, std::min(num_threads, entries.size()));
+    const size_t num_entries_per_thread = (entries.size() / num_threads) + 1;
+
+    // Segments of the loading threads are allocated on the same node as those of the caller.
+    const size_t allocation_node = numa::AllocationNode();
+    std::vector<std::thread> load_threads;
+    load_threads.reserve(num_threads);
+    for (size_t thread_num = 0; thread_num < num_threads; ++thread_num) {
+        const size_t start = std::min(thread_num * num_entries_per_thread, entries.size());
+        const size_t end = std::min(start + num_entries_per_thread, entries.size());
+        load_threads.emplace_back([&, start, end] {
+            const numa::NodeScope node_scope{allocation_node};
+            for (size_t i = start; i < end; ++i) {
+                Insert(entries[i].first, entries[i].second, key_check_fn);
+            }
+        });
+    }
+
+    for (std::thread& thread : load_threads) {
+        thread.join();
+    }
+}
+
+template <typename KeyType, typename HashPolicy>
+template <typename KeyCheckFn>
+IndexV DashIndex<KeyType, HashPolicy>::Get(const KeyType& key, KeyCheckFn key_check_fn) {
+    return GetHashed(key, hasher_(key), key_check_fn);
+}
+
+template <typename KeyType, typename HashPolicy>
+template <typename KeyCheckFn>
+void DashIndex<KeyType, HashPolicy>::MultiGet(const KeyType* keys, const size_t num_keys, IndexV* offsets,
+                                              KeyCheckFn key_check_fn) {
+    size_t key_hashes[kMultiGetBatchSize];
+    const epoch::EpochGuard epoch_guard;
+    for (size_t batch_start = 0; batch_start < num_keys; batch_start += kMultiGetBatchSize) {
+        const KeyType* batch_keys = keys + batch_start;
+        const size_t batch_size = std::min(kMultiGetBatchSize, num_keys - batch_start);
+        const DirectoryT* directory = ATOMIC_LOAD(&dir);
+        const size_t dir_shift = 8 * sizeof(size_t) - directory->depth;
+
+        for (size_t i = 0; i < batch_size; ++i) {
+            key_hashes[i] = hasher_(batch_keys[i]);
+            _mm_prefetch(reinterpret_cast<const char*>(&directory->_[key_hashes[i] >> dir_shift]), _MM_HINT_T0);
+        }
+
+        for (size_t i = 0; i < batch_size; ++i) {
+            const SegmentT* segment = directory->_[key_hashes[i] >> dir_shift];
+            _mm_prefetch(reinterpret_cast<const char*>(&segment->buckets[SegmentT::BucketOf(key_hashes[i])]),
+                         _MM_HINT_T0);
+            _mm_prefetch(reinterpret_cast<const char*>(&segment->version), _MM_HINT_T0);
+        }
+
+        // Probing validates the segment, so a directory change after the prefetches only costs extra misses.
+        for (size_t i = 0; i < batch_size; ++i) {
+            offsets[batch_start + i] = GetHashed(batch_keys[i], key_hashes[i], key_check_fn);
+        }
+    }
+}
+
+template <typename KeyType, typename HashPolicy>
+template <typename KeyCheckFn>
+IndexV DashIndex<KeyType, HashPolicy>::GetHashed(const KeyType& key, const size_t key_hash, KeyCheckFn key_check_fn) {
+    const epoch::EpochGuard epoch_guard;
+    while (true) {
+        const DirectoryT* directory = ATOMIC_LOAD(&dir);
+        const size_t seg_num = (key_hash >> (8 * sizeof(key_hash) - directory->depth));
+        SegmentT* segment = directory->_[seg_num]->Resolve(key_hash);
+        if (segment == nullptr) {
+            continue;
+        }
+        // Keys are only copied while the version is odd, so an odd version is still valid if it does not change.
+        const uint64_t version = segment->version.load(std::memory_order_acquire);
+        if (!segment->Covers(key_hash)) {
+            continue;
+        }
+
+        IndexV offset;
+        if (!segment->Get(key, key_hash, key_check_fn, &offset)) {
+            // A writer changed a bucket during the probe.
+            continue;
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (segment->version.load(std::memory_order_relaxed) == version) {
+            return offset;
+        }
+    }
+}
+
+template <typename KeyType, typename HashPolicy>
+size_t DashIndex<KeyType, HashPolicy>::Capacity(void) {
+    return counters_.num_segments.load() * (SegmentT::kNumSlot + SegmentT::kNumStashSlot);
+}
+
+template <typename KeyType, typename HashPolicy>
+cceh::IndexStats DashIndex<KeyType, HashPolicy>::GetStats() const {
+    const epoch::EpochGuard epoch_guard;
+    return counters_.Stats<SegmentT>(ATOMIC_LOAD(&dir));
+}
+
+template <typename KeyType, typename HashPolicy>
+DashIndex<KeyType, HashPolicy>::~DashIndex() {
+#ifndef CCEH_PERSISTENT
+    std::unordered_map<SegmentT*, bool> set;
+    for (size_t i = 0; i < dir->capacity; ++i) {
+        set[dir->_[i]] = true;
+    }
+    for (auto const& [seg, foo] : set) {
+        delete seg;
+    }
+#endif
+}
+
+}  // namespace viper::dash
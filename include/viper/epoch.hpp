@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace viper::epoch {
+
+/**
+ * Epoch-based reclamation for index memory that concurrent readers may still access after it was unlinked, e.g.,
+ * an old CCEH directory after doubling. Threads enter an epoch around index operations with an EpochGuard.
+ * `Retire` defers the free of an unlinked object until no thread is in an epoch that could still see it.
+ * Guards are cheap: entering and leaving only write the calling thread's own cache line. If the kernel supports
+ * `membarrier`, entering also needs no memory fence, as retiring forces one on all running threads instead.
+ * Retiring is meant for rare events and takes a lock.
+ */
+class EpochManager {
+  public:
+    static constexpr size_t kMaxThreads = 1024;
+    static constexpr uint64_t kQuiescent = UINT64_MAX;
+
+    static EpochManager& get() {
+        static EpochManager instance{};
+        return instance;
+    }
+
+    void Enter() {
+        ThreadSlot& slot = thread_slot();
+        if (slot.depth++ > 0) {
+            return;
+        }
+        // The epoch must be visible before this thread reads any shared pointer. See `heavy_fence`.
+        const uint64_t epoch = global_epoch_.load(std::memory_order_acquire);
+        if (has_membarrier_) {
+            slot.epoch.store(epoch, std::memory_order_relaxed);
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+        } else {
+            slot.epoch.store(epoch, std::memory_order_seq_cst);
+        }
+    }
+
+    void Exit() {
+        ThreadSlot& slot = thread_slot();
+        if (--slot.depth > 0) {
+            return;
+        }
+        slot.epoch.store(kQuiescent, std::memory_order_release);
+    }
+
+    /** Frees `ptr` with `deleter` once all threads that entered an epoch before this call have left it. */
+    void Retire(void* ptr, void (*deleter)(void*)) {
+        std::lock_guard lock{retire_lock_};
+        // The object was unlinked before, so threads that enter the next epoch cannot see it.
+        retired_.push_back(Retired{ptr, deleter, global_epoch_.fetch_add(1)});
+        reclaim();
+    }
+
+    /** Waits until all threads left their current epoch and frees all retired objects. */
+    void Synchronize() {
+        const uint64_t epoch = global_epoch_.fetch_add(1);
+        heavy_fence();
+        while (min_active_epoch() <= epoch) {
+            std::this_thread::yield();
+        }
+        std::lock_guard lock{retire_lock_};
+        reclaim();
+    }
+
+    ~EpochManager() {
+        for (const Retired& retired : retired_) {
+            retired.deleter(retired.ptr);
+        }
+    }
+
+  protected:
+    EpochManager() {
+        has_membarrier_ = syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+    }
+
+    /**
+     * Pairs with `Enter`. With `membarrier`, all running threads of the process execute a full fence, so an epoch
+     * stored without a fence is visible afterwards. Otherwise, `Enter` stores with a fence itself.
+     */
+    void heavy_fence() {
+        if (!has_membarrier_ || syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) != 0) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    struct alignas(64) ThreadSlot {
+        std::atomic<uint64_t> epoch = kQuiescent;
+        std::atomic<bool> is_used = false;
+        size_t depth = 0;
+    };
+
+    struct Retired {
+        void* ptr;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    /** Releases the slot of a thread when the thread exits. */
+    struct SlotHandle {
+        ThreadSlot* slot;
+        ~SlotHandle() { slot->is_used.store(false, std::memory_order_release); }
+    };
+
+    ThreadSlot& thread_slot() {
+        // A plain pointer needs no initialization check on the hot path, unlike the handle.
+        thread_local ThreadSlot* slot = nullptr;
+        if (__builtin_expect(slot == nullptr, 0)) {
+            thread_local const SlotHandle handle{acquire_slot()};
+            slot = handle.slot;
+        }
+        return *slot;
+    }
+
+    ThreadSlot* acquire_slot() {
+        for (size_t slot_num = 0; slot_num < kMaxThreads; ++slot_num) {
+            bool expected = false;
+            if (slots_[slot_num].is_used.compare_exchange_strong(expected, true)) {
+                size_t num_slots = num_slots_.load();
+                while (num_slots <= slot_num && !num_slots_.compare_exchange_weak(num_slots, slot_num + 1)) {}
+                return &slots_[slot_num];
+            }
+        }
+        throw std::runtime_error("Too many threads for epoch-based reclamation.");
+    }
+
+    uint64_t min_active_epoch() const {
+        uint64_t min_epoch = kQuiescent;
+        const size_t num_slots = num_slots_.load();
+        for (size_t slot_num = 0; slot_num < num_slots; ++slot_num) {
+            min_epoch = std::min(min_epoch, slots_[slot_num].epoch.load());
+        }
+        return min_epoch;
+    }
+
+    void reclaim() {
+        // Caller holds `retire_lock_`.
+        heavy_fence();
+        const uint64_t min_epoch = min_active_epoch();
+        size_t num_kept = 0;
+        for (const Retired& retired : retired_) {
+            if (retired.epoch < min_epoch) {
+                retired.deleter(retired.ptr);
+            } else {
+                retired_[num_kept++] = retired;
+            }
+        }
+        retired_.resize(num_kept);
+    }
+
+    std::atomic<uint64_t> global_epoch_ = 1;
+    bool has_membarrier_;
+    ThreadSlot slots_[kMaxThreads];
+    std::atomic<size_t> num_slots_ = 0;
+    std::mutex retire_lock_;
+    std::vector<Retired> retired_;
+};
+
+/** Keeps the calling thread in an epoch for its lifetime. Guards can be nested. */
+class EpochGuard {
+  public:
+    EpochGuard() { EpochManager::get().Enter(); }
+    ~EpochGuard() { EpochManager::get().Exit(); }
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+};
+
+}  // namespace viper::epoch
@@ -0,0 +1,870 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <immintrin.h>
+
+#include "epoch.hpp"
+#include "learned_index.hpp"
+
+namespace viper::learned {
+
+/**
+ * Returns bounds `low <= high` so that the first index for which `is_left` is false lies in [low, high], assuming
+ * `keys` is partitioned by `is_left`. Searches exponentially outwards from `hint`, so the range grows with the distance.
+ */
+template <typename K, typename IsLeftFn>
+std::pair<size_t, size_t> exponential_search_range(const K* keys, const size_t size, size_t hint, IsLeftFn is_left) {
+    if (size == 0) return {0, 0};
+    hint = std::min(hint, size - 1);
+
+    size_t low;
+    size_t high;
+    if (is_left(keys[hint])) {
+        low = hint + 1;
+        for (size_t step = 1;; step *= 2) {
+            high = hint + step;
+            if (high >= size) {
+                high = size;
+                break;
+            }
+            if (!is_left(keys[high])) break;
+            low = high + 1;
+        }
+    } else {
+        high = hint;
+        for (size_t step = 1;; step *= 2) {
+            if (step > high) {
+                low = 0;
+                break;
+            }
+            low = high - step;
+            if (is_left(keys[low])) {
+                low++;
+                break;
+            }
+            high = low;
+        }
+    }
+    return {low, high};
+}
+
+/** Returns the first index in [0, size) for which `is_left` is false, searching outwards from `hint`. */
+template <typename K, typename IsLeftFn>
+size_t exponential_partition_point(const K* keys, const size_t size, const size_t hint, IsLeftFn is_left) {
+    const auto [low, high] = exponential_search_range(keys, size, hint, is_left);
+    return std::partition_point(keys + low, keys + high, is_left) - keys;
+}
+
+/** Least-squares linear model from model keys to positions. */
+struct LinearModel {
+    uint64_t base_key = 0;
+    double slope = 0;
+    double intercept = 0;
+
+    inline double predict(const uint64_t m_key) const {
+        const double x = m_key >= base_key ? static_cast<double>(m_key - base_key)
+                                           : -static_cast<double>(base_key - m_key);
+        return slope * x + intercept;
+    }
+
+    /** Fits the model so that the i-th key is mapped to position `i * scale`. */
+    template <typename K>
+    static LinearModel fit(const K* keys, const size_t num_keys, const double scale) {
+        LinearModel model{};
+        if (num_keys == 0) return model;
+
+        model.base_key = KeyTraits<K>::model_key(keys[0]);
+        double mean_x = 0;
+        double mean_y = 0;
+        for (size_t i = 0; i < num_keys; ++i) {
+            mean_x += model.predict_x(KeyTraits<K>::model_key(keys[i]));
+            mean_y += i * scale;
+        }
+        mean_x /= num_keys;
+        mean_y /= num_keys;
+
+        double covariance = 0;
+        double variance = 0;
+        for (size_t i = 0; i < num_keys; ++i) {
+            const double dx = model.predict_x(KeyTraits<K>::model_key(keys[i])) - mean_x;
+            covariance += dx * (i * scale - mean_y);
+            variance += dx * dx;
+        }
+
+        model.slope = variance > 0 ? covariance / variance : 0;
+        model.intercept = mean_y - model.slope * mean_x;
+        return model;
+    }
+
+  private:
+    inline double predict_x(const uint64_t m_key) const {
+        return static_cast<double>(m_key - base_key);
+    }
+};
+
+/**
+ * Updatable ordered index on gapped arrays (ALEX-style) that maps keys to their KeyValueOffset.
+ * A copy-on-write root routes keys to data nodes via a linear model over the nodes' pivot keys. Each data node
+ * stores its keys in a sorted array with gaps, in which a linear model predicts a key's slot. New keys are placed at
+ * their predicted slot if possible, so only few keys need to be shifted. Gaps hold a copy of the next key to their
+ * right, which keeps the array searchable with an exponential search from the predicted slot.
+ *
+ * Each data node has an optimistic version lock. Writers lock the node, readers validate the version after reading
+ * and retry on conflicts. A node that exceeds kMaxDensity is rebuilt into a larger node or split into two nodes,
+ * which are published in a new root. Replaced nodes and roots are retired and freed by epoch-based reclamation once
+ * no reader can access them anymore, so memory stays bounded under insert and delete churn.
+ * Inserts track how far keys land from their predicted slot. If the mean error of a node exceeds kMaxMeanInsertError,
+ * a background thread retrains the node's model on a copy of the node and swaps in the new node, unless it was
+ * modified in the meantime. This keeps searches short under shifting key distributions without blocking writers.
+ * Keys must be trivially copyable, as readers may see concurrent writes. Deletes leave a tombstone in the node,
+ * which is dropped on the next rebuild. As the index stores full keys, the key check functions are never called.
+ */
+template <typename K>
+class GappedIndex {
+    using Traits = KeyTraits<K>;
+    static_assert(std::is_trivially_copyable_v<K>, "GappedIndex requires trivially copyable keys.");
+
+  public:
+    static constexpr bool kIsOrdered = true;
+    static constexpr size_t kMinNodeSlots = 64;
+    static constexpr size_t kMaxNodeSlots = 1 << 18;
+    static constexpr double kInitDensity = 0.5;
+    static constexpr double kMaxDensity = 0.8;
+    static constexpr size_t kBulkLoadNodeKeys = kMaxNodeSlots * kInitDensity / 2;
+    static constexpr size_t kScanBatchSize = 64;
+    static constexpr size_t kMinDriftInserts = 256;
+    static constexpr size_t kMaxMeanInsertError = 32;
+
+    GappedIndex(size_t initial_capacity = 0);
+    ~GappedIndex();
+
+    IndexV Insert(const K& key, IndexV value);
+    IndexV Get(const K& key);
+    bool Delete(const K& key);
+
+    template <typename KeyCheckFn>
+    IndexV Insert(const K& key, IndexV value, KeyCheckFn) { return Insert(key, value); }
+
+    template <typename KeyCheckFn>
+    IndexV Get(const K& key, KeyCheckFn) { return Get(key); }
+
+    template <typename KeyCheckFn>
+    bool Delete(const K& key, KeyCheckFn) { return Delete(key); }
+
+    /**
+     * Builds the index from `entries`, which must be sorted by KeyTraits::less and unique. Index must be empty.
+     * The data nodes are built in parallel by up to `num_threads` threads.
+     */
+    void BulkLoad(const std::vector<std::pair<K, IndexV>>& entries, size_t num_threads = 1);
+
+    template <typename KeyCheckFn>
+    void BulkLoad(const std::vector<std::pair<K, IndexV>>& entries, KeyCheckFn, size_t num_threads) {
+        BulkLoad(entries, num_threads);
+    }
+
+    /**
+     * Calls `scan_fn(key, offset)` for all keys in [start_key, end_key] in order. Returns the number of visited keys.
+     * Entries are collected in batches, so `scan_fn` can modify the index. Stops if `scan_fn` returns false.
+     */
+    template <typename ScanFn>
+    size_t Scan(const K& start_key, const K& end_key, ScanFn scan_fn);
+
+    /** Number of keys, including deleted keys that were not yet dropped. Not exact under concurrent writes. */
+    size_t Size();
+
+  protected:
+    struct DataNode {
+        explicit DataNode(size_t capacity);
+        ~DataNode();
+
+        static DataNode* build(const std::pair<K, IndexV>* entries, size_t num_entries);
+
+        size_t predict(const K& key) const;
+        size_t lower_bound(const K& key) const;
+        size_t find(const K& key) const;
+        void insert(const K& key, IndexV value);
+
+        inline bool is_used(const size_t slot) const { return (bitmap[slot / 64] >> (slot % 64)) & 1; }
+        inline void set_used(const size_t slot) { bitmap[slot / 64] |= 1ul << (slot % 64); }
+        size_t next_used(size_t slot) const;
+        size_t next_gap(size_t slot) const;
+        size_t prev_gap(size_t slot) const;
+
+        const size_t capacity;
+        K* keys;
+        IndexV* offsets;
+        uint64_t* bitmap;
+        size_t end = 0;
+        size_t num_used = 0;
+        LinearModel model;
+        std::atomic<uint64_t> version = 0;
+        std::atomic<bool> is_obsolete = false;
+
+        // Drift counters since the node was built. Only modified under the write lock.
+        size_t num_inserts = 0;
+        size_t total_insert_error = 0;
+        bool is_retrain_queued = false;
+    };
+
+    /** One or two nodes that replace a node. `split_key` is the pivot of the second node. */
+    struct Replacement {
+        DataNode* nodes[2] = {nullptr, nullptr};
+        K split_key;
+    };
+
+    struct Root {
+        explicit Root(size_t num_nodes);
+
+        size_t route(const K& key) const;
+
+        const size_t num_nodes;
+        std::vector<K> pivots;
+        std::unique_ptr<std::atomic<DataNode*>[]> nodes;
+        LinearModel model;
+    };
+
+    static uint64_t read_lock(const DataNode* node);
+    static bool read_unlock(const DataNode* node, uint64_t version);
+    static void write_lock(DataNode* node);
+    static void write_unlock(DataNode* node);
+
+    bool collect_batch(const K& start_key, bool include_start, const K& end_key,
+                       std::vector<std::pair<K, IndexV>>* batch, K* resume_key);
+    void rebuild(DataNode* node, const K& key, IndexV value);
+    static Replacement build_replacement(const std::vector<std::pair<K, IndexV>>& entries);
+    void install(DataNode* node, const K& node_key, const Replacement& replacement);
+    void publish(Root* root);
+    static void retire(DataNode* node);
+    static void retire(Root* root);
+    void queue_retrain(const K& key);
+    void trigger_retrain();
+    void retrain(const K& key);
+
+    std::atomic<Root*> root_;
+    std::mutex root_lock_;
+
+    std::mutex retrain_lock_;
+    // Keys routed to the nodes to retrain. A queued node may be replaced and freed before it is retrained.
+    std::vector<K> retrain_queue_;
+    std::atomic<bool> is_retraining_;
+    std::unique_ptr<std::thread> retrain_thread_;
+};
+
+template <typename K>
+GappedIndex<K>::DataNode::DataNode(const size_t capacity) : capacity{capacity} {
+    keys = new K[capacity];
+    offsets = new IndexV[capacity];
+    bitmap = new uint64_t[(capacity + 63) / 64]();
+}
+
+template <typename K>
+GappedIndex<K>::DataNode::~DataNode() {
+    delete[] keys;
+    delete[] offsets;
+    delete[] bitmap;
+}
+
+template <typename K>
+typename GappedIndex<K>::DataNode* GappedIndex<K>::DataNode::build(const std::pair<K, IndexV>* entries,
+                                                                   const size_t num_entries) {
+    const size_t capacity = std::max(kMinNodeSlots, static_cast<size_t>(num_entries / kInitDensity));
+    DataNode* node = new DataNode(capacity);
+    if (num_entries == 0) return node;
+
+    std::vector<K> keys;
+    keys.reserve(num_entries);
+    for (size_t i = 0; i < num_entries; ++i) {
+        keys.push_back(entries[i].first);
+    }
+    node->model = LinearModel::fit(keys.data(), num_entries, static_cast<double>(capacity) / num_entries);
+
+    // Place keys at their predicted slot, but keep them in order and leave room for all remaining keys.
+    size_t next_free_slot = 0;
+    for (size_t i = 0; i < num_entries; ++i) {
+        const size_t max_slot = capacity - (num_entries - i);
+        const size_t slot = std::min(std::max(node->predict(keys[i]), next_free_slot), max_slot);
+        node->keys[slot] = keys[i];
+        node->offsets[slot] = entries[i].second;
+        node->set_used(slot);
+        next_free_slot = slot + 1;
+    }
+    node->end = next_free_slot;
+    node->num_used = num_entries;
+
+    for (size_t slot = node->end - 1; slot > 0; --slot) {
+        if (!node->is_used(slot - 1)) {
+            node->keys[slot - 1] = node->keys[slot];
+        }
+    }
+    return node;
+}
+
+template <typename K>
+size_t GappedIndex<K>::DataNode::predict(const K& key) const {
+    const double prediction = model.predict(Traits::model_key(key));
+    if (!(prediction > 0)) return 0;
+    return std::min(static_cast<size_t>(prediction), capacity - 1);
+}
+
+template <typename K>
+size_t GappedIndex<K>::DataNode::lower_bound(const K& key) const {
+    // Readers may see a concurrent write, so the bound must stay valid.
+    const size_t used_end = std::min(ATOMIC_LOAD(&end), capacity);
+    const auto [low, high] = exponential_search_range(keys, used_end, predict(key),
+                                                      [&](const K& slot_key) { return Traits::less(slot_key, key); });
+    return lower_bound_in_window(keys, low, high, key);
+}
+
+template <typename K>
+size_t GappedIndex<K>::DataNode::find(const K& key) const {
+    const size_t pos = lower_bound(key);
+    if (pos < std::min(ATOMIC_LOAD(&end), capacity) && Traits::equal(keys[pos], key)) {
+        // The key is stored in the first used slot of the run of gaps holding a copy of it.
+        return next_used(pos);
+    }
+    return capacity;
+}
+
+template <typename K>
+void GappedIndex<K>::DataNode::insert(const K& key, const IndexV value) {
+    // Caller holds the write lock and ensured that there is a gap.
+    const size_t pos = lower_bound(key);
+    if (pos < capacity && (pos == end || !is_used(pos))) {
+        // Place the key at its predicted slot in the run of gaps in front of the next larger key.
+        const size_t run_end = pos == end ? capacity : next_used(pos);
+        const size_t predicted_slot = predict(key);
+        const size_t slot = std::min(std::max(predicted_slot, pos), run_end - 1);
+        for (size_t gap = pos; gap < slot; ++gap) {
+            keys[gap] = key;
+        }
+        keys[slot] = key;
+        ATOMIC_STORE(&offsets[slot].offset, value.offset);
+        set_used(slot);
+        if (slot >= end) {
+            ATOMIC_STORE(&end, slot + 1);
+        }
+        num_used++;
+        num_inserts++;
+        total_insert_error += slot > predicted_slot ? slot - predicted_slot : predicted_slot - slot;
+        return;
+    }
+
+    // The slot is taken by a larger key or the key is larger than all keys in a full array.
+    // Shift the keys towards the closest gap.
+    const size_t right_gap = next_gap(pos + 1);
+    const size_t left_gap = prev_gap(pos);
+    const bool shift_right = left_gap == capacity || (right_gap < capacity && right_gap - pos <= pos - left_gap);
+    size_t slot;
+    if (shift_right) {
+        for (size_t i = right_gap; i > pos; --i) {
+            keys[i] = keys[i - 1];
+            offsets[i] = offsets[i - 1];
+        }
+        set_used(right_gap);
+        if (right_gap >= end) {
+            ATOMIC_STORE(&end, right_gap + 1);
+        }
+        slot = pos;
+    } else {
+        for (size_t i = left_gap; i < pos - 1; ++i) {
+            keys[i] = keys[i + 1];
+            offsets[i] = offsets[i + 1];
+        }
+        set_used(left_gap);
+        slot = pos - 1;
+    }
+    keys[slot] = key;
+    ATOMIC_STORE(&offsets[slot].offset, value.offset);
+    num_used++;
+    num_inserts++;
+    const size_t predicted_slot = predict(key);
+    total_insert_error += slot > predicted_slot ? slot - predicted_slot : predicted_slot - slot;
+}
+
+template <typename K>
+size_t GappedIndex<K>::DataNode::next_used(size_t slot) const {
+    while (slot < capacity) {
+        const uint64_t word = bitmap[slot / 64] >> (slot % 64);
+        if (word != 0) {
+            return std::min(slot + __builtin_ctzl(word), capacity);
+        }
+        slot = (slot / 64 + 1) * 64;
+    }
+    return capacity;
+}
+
+template <typename K>
+size_t GappedIndex<K>::DataNode::next_gap(size_t slot) const {
+    while (slot < capacity) {
+        const uint64_t word = ~bitmap[slot / 64] >> (slot % 64);
+        if (word != 0) {
+            return std::min(slot + __builtin_ctzl(word), capacity);
+        }
+        slot = (slot / 64 + 1) * 64;
+    }
+    return capacity;
+}
+
+template <typename K>
+size_t GappedIndex<K>::DataNode::prev_gap(size_t slot) const {
+    // Returns the last gap before `slot` or `capacity` if there is none.
+    while (slot > 0) {
+        const size_t last = slot - 1;
+        const uint64_t word = ~bitmap[last / 64] << (63 - (last % 64));
+        if (word != 0) {
+            return last - __builtin_clzl(word);
+        }
+        slot = (last / 64) * 64;
+    }
+    return capacity;
+}
+
+template <typename K>
+GappedIndex<K>::Root::Root(const size_t num_nodes)
+    : num_nodes{num_nodes}, pivots(num_nodes), nodes{new std::atomic<DataNode*>[num_nodes]} {}
+
+template <typename K>
+size_t GappedIndex<K>::Root::route(const K& key) const {
+    const double prediction = model.predict(Traits::model_key(key));
+    const size_t hint = prediction > 0 ? std::min(static_cast<size_t>(prediction), num_nodes - 1) : 0;
+    // The first pivot is ignored, so that node 0 also holds all keys smaller than its first key.
+    const size_t pos = exponential_partition_point(pivots.data(), num_nodes, hint,
+                                                   [&](const K& pivot) { return !Traits::less(key, pivot); });
+    return pos == 0 ? 0 : pos - 1;
+}
+
+template <typename K>
+uint64_t GappedIndex<K>::read_lock(const DataNode* node) {
+    while (true) {
+        const uint64_t version = node->version.load(std::memory_order_acquire);
+        if ((version & 1) == 0) return version;
+        _mm_pause();
+    }
+}
+
+template <typename K>
+bool GappedIndex<K>::read_unlock(const DataNode* node, const uint64_t version) {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return node->version.load(std::memory_order_relaxed) == version;
+}
+
+template <typename K>
+void GappedIndex<K>::write_lock(DataNode* node) {
+    uint64_t version = node->version.load(std::memory_order_relaxed);
+    while ((version & 1) != 0 || !node->version.compare_exchange_weak(version, version + 1,
+                                                                       std::memory_order_acquire)) {
+        _mm_pause();
+        version = node->version.load(std::memory_order_relaxed);
+    }
+}
+
+template <typename K>
+void GappedIndex<K>::write_unlock(DataNode* node) {
+    node->version.fetch_add(1, std::memory_order_release);
+}
+
+template <typename K>
+GappedIndex<K>::GappedIndex(size_t) {
+    Root* root = new Root(1);
+    root->nodes[0] = DataNode::build(nullptr, 0);
+    root_ = root;
+    is_retraining_ = false;
+}
+
+template <typename K>
+GappedIndex<K>::~GappedIndex() {
+    {
+        std::lock_guard lock{retrain_lock_};
+        retrain_queue_.clear();
+    }
+    while (is_retraining_.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+    {
+        // The retrain thread releases the lock after its last access to the index.
+        std::lock_guard lock{retrain_lock_};
+    }
+
+    Root* root = root_.load();
+    for (size_t node_num = 0; node_num < root->num_nodes; ++node_num) {
+        delete root->nodes[node_num].load();
+    }
+    delete root;
+}
+
+template <typename K>
+IndexV GappedIndex<K>::Insert(const K& key, const IndexV value) {
+    const epoch::EpochGuard epoch_guard;
+    while (true) {
+        const Root* root = root_.load(std::memory_order_acquire);
+        DataNode* node = root->nodes[root->route(key)].load(std::memory_order_acquire);
+        write_lock(node);
+        if (node->is_obsolete.load(std::memory_order_relaxed)) {
+            // Node was replaced in the meantime.
+            write_unlock(node);
+            continue;
+        }
+
+        const size_t slot = node->find(key);
+        if (slot < node->capacity) {
+            // Existing key, update in place. This also revives a deleted key.
+            const IndexV old_offset = node->offsets[slot];
+            ATOMIC_STORE(&node->offsets[slot].offset, value.offset);
+            write_unlock(node);
+            return old_offset;
+        }
+
+        if (value.is_tombstone()) {
+            // Deleting a key that does not exist.
+            write_unlock(node);
+            return IndexV::NONE();
+        }
+
+        if (node->num_used + 1 > node->capacity * kMaxDensity) {
+            rebuild(node, key, value);
+            write_unlock(node);
+            return IndexV::NONE();
+        }
+
+        node->insert(key, value);
+        const bool has_drifted = !node->is_retrain_queued && node->num_inserts >= kMinDriftInserts &&
+            node->total_insert_error > node->num_inserts * kMaxMeanInsertError;
+        if (has_drifted) {
+            node->is_retrain_queued = true;
+        }
+        write_unlock(node);
+        if (has_drifted) {
+            queue_retrain(key);
+        }
+        return IndexV::NONE();
+    }
+}
+
+template <typename K>
+IndexV GappedIndex<K>::Get(const K& key) {
+    const epoch::EpochGuard epoch_guard;
+    while (true) {
+        const Root* root = root_.load(std::memory_order_acquire);
+        const DataNode* node = root->nodes[root->route(key)].load(std::memory_order_acquire);
+        const uint64_t version = read_lock(node);
+        if (node->is_obsolete.load(std::memory_order_relaxed)) continue;
+
+        const size_t slot = node->find(key);
+        const IndexV offset = slot < node->capacity ? IndexV{ATOMIC_LOAD(&node->offsets[slot].offset)}
+                                                    : IndexV::NONE();
+        if (read_unlock(node, version)) {
+            return offset;
+        }
+    }
+}
+
+template <typename K>
+bool GappedIndex<K>::Delete(const K& key) {
+    // Inserting a tombstone removes the key.
+    return !Insert(key, IndexV::Tombstone()).is_tombstone();
+}
+
+template <typename K>
+void GappedIndex<K>::rebuild(DataNode* node, const K& key, const IndexV value) {
+    // Caller holds the write lock of `node`. Deleted keys are dropped here.
+    std::vector<std::pair<K, IndexV>> entries;
+    entries.reserve(node->num_used + 1);
+    bool is_inserted = false;
+    for (size_t slot = node->next_used(0); slot < node->end; slot = node->next_used(slot + 1)) {
+        if (!is_inserted && Traits::less(key, node->keys[slot])) {
+            entries.emplace_back(key, value);
+            is_inserted = true;
+        }
+        if (!node->offsets[slot].is_tombstone()) {
+            entries.emplace_back(node->keys[slot], node->offsets[slot]);
+        }
+    }
+    if (!is_inserted) {
+        entries.emplace_back(key, value);
+    }
+
+    install(node, key, build_replacement(entries));
+}
+
+template <typename K>
+typename GappedIndex<K>::Replacement GappedIndex<K>::build_replacement(
+        const std::vector<std::pair<K, IndexV>>& entries) {
+    Replacement replacement;
+    const size_t num_new_nodes = entries.size() > kMaxNodeSlots * kInitDensity ? 2 : 1;
+    const size_t split_pos = entries.size() / num_new_nodes;
+    replacement.nodes[0] = DataNode::build(entries.data(), split_pos);
+    if (num_new_nodes == 2) {
+        replacement.nodes[1] = DataNode::build(entries.data() + split_pos, entries.size() - split_pos);
+        replacement.split_key = entries[split_pos].first;
+    }
+    return replacement;
+}
+
+template <typename K>
+void GappedIndex<K>::install(DataNode* node, const K& node_key, const Replacement& replacement) {
+    // Caller holds the write lock of `node`.
+    std::lock_guard lock{root_lock_};
+    Root* old_root = root_.load(std::memory_order_relaxed);
+    // The node is locked and not obsolete, so it is part of the current root.
+    const size_t node_num = old_root->route(node_key);
+
+    if (replacement.nodes[1] == nullptr) {
+        old_root->nodes[node_num].store(replacement.nodes[0], std::memory_order_release);
+    } else {
+        Root* root = new Root(old_root->num_nodes + 1);
+        for (size_t i = 0; i < old_root->num_nodes; ++i) {
+            const size_t new_pos = i <= node_num ? i : i + 1;
+            root->pivots[new_pos] = old_root->pivots[i];
+            root->nodes[new_pos] = old_root->nodes[i].load(std::memory_order_relaxed);
+        }
+        root->nodes[node_num] = replacement.nodes[0];
+        root->nodes[node_num + 1] = replacement.nodes[1];
+        root->pivots[node_num + 1] = replacement.split_key;
+        publish(root);
+    }
+
+    node->is_obsolete.store(true, std::memory_order_relaxed);
+    retire(node);
+}
+
+template <typename K>
+void GappedIndex<K>::publish(Root* root) {
+    // Caller holds the root lock.
+    root->model = LinearModel::fit(root->pivots.data(), root->num_nodes, 1.0);
+    Root* old_root = root_.exchange(root, std::memory_order_acq_rel);
+    if (old_root != nullptr) {
+        retire(old_root);
+    }
+}
+
+template <typename K>
+void GappedIndex<K>::retire(DataNode* node) {
+    // Readers and writers access nodes inside an epoch, so the node is freed after they are done with it.
+    epoch::EpochManager::get().Retire(node, [](void* retired_node) {
+        delete static_cast<DataNode*>(retired_node);
+    });
+}
+
+template <typename K>
+void GappedIndex<K>::retire(Root* root) {
+    // The nodes are still referenced by the new root.
+    epoch::EpochManager::get().Retire(root, [](void* retired_root) {
+        delete static_cast<Root*>(retired_root);
+    });
+}
+
+template <typename K>
+void GappedIndex<K>::queue_retrain(const K& key) {
+    {
+        std::lock_guard lock{retrain_lock_};
+        retrain_queue_.push_back(key);
+    }
+    trigger_retrain();
+}
+
+template <typename K>
+void GappedIndex<K>::trigger_retrain() {
+    bool expected_retraining = false;
+    const bool should_retrain = is_retraining_.compare_exchange_strong(expected_retraining, true);
+    if (!should_retrain) {
+        return;
+    }
+
+    // Only one thread can ever get here because for all others the atomic exchange above fails.
+    retrain_thread_ = std::make_unique<std::thread>([this] {
+        while (true) {
+            std::vector<K> keys;
+            {
+                std::lock_guard lock{retrain_lock_};
+                if (retrain_queue_.empty()) {
+                    // Reset under the lock, so that nodes queued afterwards start a new thread.
+                    is_retraining_.store(false, std::memory_order_release);
+                    return;
+                }
+                keys.swap(retrain_queue_);
+            }
+            for (const K& key : keys) {
+                retrain(key);
+            }
+        }
+    });
+    retrain_thread_->detach();
+}
+
+template <typename K>
+void GappedIndex<K>::retrain(const K& key) {
+    // The guard keeps the node valid while its replacement is built.
+    const epoch::EpochGuard epoch_guard;
+    const Root* root = root_.load(std::memory_order_acquire);
+    DataNode* node = root->nodes[root->route(key)].load(std::memory_order_acquire);
+    std::vector<std::pair<K, IndexV>> entries;
+    uint64_t version;
+    do {
+        version = read_lock(node);
+        // A node that replaced the queued one in the meantime was not marked for retraining.
+        if (node->is_obsolete.load(std::memory_order_relaxed) || !ATOMIC_LOAD(&node->is_retrain_queued)) return;
+        entries.clear();
+        const size_t used_end = std::min(ATOMIC_LOAD(&node->end), node->capacity);
+        for (size_t slot = node->next_used(0); slot < used_end; slot = node->next_used(slot + 1)) {
+            const IndexV offset{ATOMIC_LOAD(&node->offsets[slot].offset)};
+            if (!offset.is_tombstone()) {
+                entries.emplace_back(node->keys[slot], offset);
+            }
+        }
+    } while (!read_unlock(node, version));
+
+    if (entries.empty()) {
+        return;
+    }
+
+    // Build the new node without holding the lock and only install it if the node did not change meanwhile.
+    const Replacement replacement = build_replacement(entries);
+    write_lock(node);
+    const bool is_unchanged = !node->is_obsolete.load(std::memory_order_relaxed) &&
+        node->version.load(std::memory_order_relaxed) == version + 1;
+    if (is_unchanged) {
+        install(node, entries[0].first, replacement);
+    } else {
+        // The next insert queues the node again if it still drifts.
+        node->is_retrain_queued = false;
+        delete replacement.nodes[0];
+        delete replacement.nodes[1];
+    }
+    write_unlock(node);
+}
+
+template <typename K>
+void GappedIndex<K>::BulkLoad(const std::vector<std::pair<K, IndexV>>& entries, size_t num_threads) {
+    std::lock_guard lock{root_lock_};
+    Root* old_root = root_.load();
+    if (old_root->num_nodes != 1 || old_root->nodes[0].load()->num_used != 0) {
+        throw std::runtime_error("Can only bulk load into an empty index.");
+    }
+
+    const size_t num_nodes = std::max(1ul, (entries.size() + kBulkLoadNodeKeys - 1) / kBulkLoadNodeKeys);
+    Root* root = new Root(num_nodes);
+    for (size_t node_num = 0; node_num < num_nodes; ++node_num) {
+        root->pivots[node_num] = entries.empty() ? K{} : entries[node_num * kBulkLoadNodeKeys].first;
+    }
+
+    num_threads = std::max(1ul, std::min(num_threads, num_nodes));
+    std::vector<std::thread> build_threads;
+    build_threads.reserve(num_threads);
+    for (size_t thread_num = 0; thread_num < num_threads; ++thread_num) {
+        build_threads.emplace_back([&, thread_num] {
+            for (size_t node_num = thread_num; node_num < num_nodes; node_num += num_threads) {
+                const size_t start = std::min(node_num * kBulkLoadNodeKeys, entries.size());
+                const size_t end = std::min(start + kBulkLoadNodeKeys, entries.size());
+                root->nodes[node_num] = DataNode::build(entries.data() + start, end - start);
+            }
+        });
+    }
+    for (std::thread& thread : build_threads) {
+        thread.join();
+    }
+
+    DataNode* old_node = old_root->nodes[0].load();
+    publish(root);
+    retire(old_node);
+}
+
+template <typename K>
+size_t GappedIndex<K>::Size() {
+    std::lock_guard lock{root_lock_};
+    const Root* root = root_.load();
+    size_t size = 0;
+    for (size_t node_num = 0; node_num < root->num_nodes; ++node_num) {
+        size += ATOMIC_LOAD(&root->nodes[node_num].load()->num_used);
+    }
+    return size;
+}
+
+template <typename K>
+template <typename ScanFn>
+size_t GappedIndex<K>::Scan(const K& start_key, const K& end_key, ScanFn scan_fn) {
+    std::vector<std::pair<K, IndexV>> batch;
+    batch.reserve(kScanBatchSize);
+
+    size_t num_visited = 0;
+    K next_key = start_key;
+    bool include_start = true;
+    bool has_more = true;
+    while (has_more) {
+        has_more = collect_batch(next_key, include_start, end_key, &batch, &next_key);
+        include_start = false;
+        for (const auto& [key, offset] : batch) {
+            num_visited++;
+            if (!scan_fn(key, offset)) {
+                return num_visited;
+            }
+        }
+    }
+    return num_visited;
+}
+
+template <typename K>
+bool GappedIndex<K>::collect_batch(const K& start_key, const bool include_start, const K& end_key,
+                                   std::vector<std::pair<K, IndexV>>* batch, K* resume_key) {
+    const epoch::EpochGuard epoch_guard;
+    const K start = start_key;
+    while (true) {
+        batch->clear();
+        const Root* root = root_.load(std::memory_order_acquire);
+        size_t node_num = root->route(start);
+        bool is_first_node = true;
+        bool is_valid = true;
+        bool has_more = false;
+        size_t num_collected = 0;
+        K last_key = start;
+
+        for (; node_num < root->num_nodes && is_valid; ++node_num) {
+            const DataNode* node = root->nodes[node_num].load(std::memory_order_acquire);
+            const uint64_t version = read_lock(node);
+            if (node->is_obsolete.load(std::memory_order_relaxed)) {
+                is_valid = false;
+                break;
+            }
+
+            const size_t used_end = std::min(ATOMIC_LOAD(&node->end), node->capacity);
+            size_t slot = is_first_node ? node->lower_bound(start) : 0;
+            is_first_node = false;
+            bool is_done = false;
+            // Tombstones count towards the batch size so that a batch is bounded in work, not in results.
+            for (slot = node->next_used(slot); slot < used_end; slot = node->next_used(slot + 1)) {
+                const K& key = node->keys[slot];
+                if (!include_start && Traits::equal(key, start)) continue;
+                if (Traits::less(end_key, key)) {
+                    is_done = true;
+                    break;
+                }
+
+                const IndexV offset{ATOMIC_LOAD(&node->offsets[slot].offset)};
+                last_key = key;
+                if (!offset.is_tombstone()) {
+                    batch->emplace_back(key, offset);
+                }
+                if (++num_collected == kScanBatchSize) {
+                    has_more = true;
+                    is_done = true;
+                    break;
+                }
+            }
+
+            is_valid = read_unlock(node, version);
+            if (is_done) break;
+        }
+
+        if (is_valid) {
+            *resume_key = last_key;
+            return has_more;
+        }
+    }
+}
+
+}  // namespace viper::learned
@@ -14,8 +14,13 @@
 
 #pragma once
 
+#include <algorithm>
 #include <functional>
+#include <vector>
+#include <cstring>
 #include <stddef.h>
+#include <stdint.h>
+#include <immintrin.h>
 
 namespace viper::cceh {
 
@@ -60,8 +65,214 @@ static size_t
     murmur2
 };
 
-inline size_t h(const void* key, size_t len, size_t seed = 0xc70697UL) {
+static constexpr size_t kDefaultSeed = 0xc70697UL;
+
+inline size_t h(const void* key, size_t len, size_t seed = kDefaultSeed) {
     return hash_funcs[0](key, len, seed);
 }
 
+namespace internal {
+
+inline uint64_t read64(const uint8_t* data) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+inline uint64_t read32(const uint8_t* data) {
+    uint32_t word;
+    memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+/** Multiplies two words and xors both halves of the 128-bit product, so that all result bits depend on all inputs. */
+inline uint64_t fold_multiply(const uint64_t a, const uint64_t b) {
+    const __uint128_t product = static_cast<__uint128_t>(a) * b;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+}  // namespace internal
+
+/**
+ * Hash policies for CCEH's `HashPolicy` template parameter. Each provides `Hash(key, len, seed)`. CCEH uses both the
+ * top bits (segment) and the lowest bits (bucket) of a hash, so both ends need to be well mixed.
+ */
+
+/** `h()`, i.e., `std::_Hash_bytes`. The default. */
+struct StdHash {
+    static size_t Hash(const void* key, const size_t len, const size_t seed = kDefaultSeed) {
+        return h(key, len, seed);
+    }
+};
+
+/**
+ * Hashes 16 bytes per step with a 128-bit multiplication and 48 bytes per step in three independent lanes for long
+ * keys, following wyhash. Keys of up to 16 bytes need no loop.
+ */
+struct WideBlockHash {
+    static size_t Hash(const void* key, const size_t len, size_t seed = kDefaultSeed) {
+        using internal::fold_multiply;
+        using internal::read32;
+        using internal::read64;
+        constexpr uint64_t kP0 = 0xa0761d6478bd642full;
+        constexpr uint64_t kP1 = 0xe7037ed1a0b428dbull;
+        constexpr uint64_t kP2 = 0x8ebc6af09c88c6e3ull;
+        constexpr uint64_t kP3 = 0x589965cc75374cc3ull;
+
+        const uint8_t* data = static_cast<const uint8_t*>(key);
+        seed ^= fold_multiply(seed ^ kP0, kP1);
+        uint64_t a = 0;
+        uint64_t b = 0;
+        if (len <= 16) {
+            if (len >= 4) {
+                // Two overlapping reads from each end cover all bytes.
+                const size_t middle = (len >> 3) << 2;
+                a = (read32(data) << 32) | read32(data + middle);
+                b = (read32(data + len - 4) << 32) | read32(data + len - 4 - middle);
+            } else if (len > 0) {
+                a = (static_cast<uint64_t>(data[0]) << 16) | (static_cast<uint64_t>(data[len >> 1]) << 8) |
+                    data[len - 1];
+            }
+        } else {
+            size_t remaining = len;
+            if (remaining > 48) {
+                uint64_t lane1 = seed;
+                uint64_t lane2 = seed;
+                do {
+                    seed = fold_multiply(read64(data) ^ kP1, read64(data + 8) ^ seed);
+                    lane1 = fold_multiply(read64(data + 16) ^ kP2, read64(data + 24) ^ lane1);
+                    lane2 = fold_multiply(read64(data + 32) ^ kP3, read64(data + 40) ^ lane2);
+                    data += 48;
+                    remaining -= 48;
+                } while (remaining > 48);
+                seed ^= lane1 ^ lane2;
+            }
+            while (remaining > 16) {
+                seed = fold_multiply(read64(data) ^ kP1, read64(data + 8) ^ seed);
+                data += 16;
+                remaining -= 16;
+            }
+            // The last 16 bytes, which may overlap with the last step.
+            a = read64(data + remaining - 16);
+            b = read64(data + remaining - 8);
+        }
+        const __uint128_t product = static_cast<__uint128_t>(a ^ kP1) * (b ^ seed);
+        return fold_multiply(static_cast<uint64_t>(product) ^ kP0 ^ len, static_cast<uint64_t>(product >> 64) ^ kP1);
+    }
+};
+
+/**
+ * For keys of up to 8 bytes, e.g., `uint64_t`: a single multiplication with an odd constant. Multiply-shift keeps
+ * the high half of the product, which leaves the lowest bits weak, so both halves are folded instead. Longer keys
+ * use WideBlockHash.
+ */
+struct MultiplyShiftHash {
+    static size_t Hash(const void* key, const size_t len, const size_t seed = kDefaultSeed) {
+        constexpr uint64_t kMultiplier = 0x9E3779B97F4A7C15ull;
+        if (len > 8) {
+            return WideBlockHash::Hash(key, len, seed);
+        }
+        uint64_t word = 0;
+        memcpy(&word, key, len);
+        return internal::fold_multiply(word ^ seed, kMultiplier);
+    }
+};
+
+/**
+ * CRC32C with the SSE4.2 instruction, which processes 8 bytes per cycle. A CRC is linear and only has 32 bits, so
+ * two lanes (the second over rotated words) are combined and mixed with a final multiplication. Without SSE4.2,
+ * this is WideBlockHash.
+ */
+struct Crc32cHash {
+    static size_t Hash(const void* key, size_t len, const size_t seed = kDefaultSeed) {
+#ifdef __SSE4_2__
+        const uint8_t* data = static_cast<const uint8_t*>(key);
+        const size_t total_len = len;
+        uint64_t low = static_cast<uint32_t>(seed);
+        uint64_t high = static_cast<uint32_t>(seed >> 32) ^ 0x9E3779B9u;
+        for (; len >= 8; len -= 8, data += 8) {
+            const uint64_t word = internal::read64(data);
+            low = _mm_crc32_u64(low, word);
+            high = _mm_crc32_u64(high, (word << 32) | (word >> 32));
+        }
+        if (len > 0) {
+            uint64_t word = 0;
+            memcpy(&word, data, len);
+            low = _mm_crc32_u64(low, word);
+            high = _mm_crc32_u64(high, (word << 32) | (word >> 32));
+        }
+        return internal::fold_multiply(((high << 32) | low) ^ total_len, 0x9E3779B97F4A7C15ull);
+#else
+        return WideBlockHash::Hash(key, len, seed);
+#endif
+    }
+};
+
+/**
+ * Monotone piecewise linear model of the CDF of a set of 64-bit keys.
+ * The key range is split into kNumBuckets equally wide buckets and the CDF is interpolated within a bucket, so a
+ * prediction costs two loads and no search. Used as a learned hash that spreads keys evenly across the hash space.
+ */
+class CdfModel {
+  public:
+    static constexpr size_t kNumBuckets = 1 << 14;
+
+    /** Trains the model on a sorted key sample. Returns false if the sample does not span a range of keys. */
+    bool train(const std::vector<uint64_t>& sorted_keys) {
+        cdf_.clear();
+        if (sorted_keys.size() < 2 || sorted_keys.front() == sorted_keys.back()) {
+            return false;
+        }
+
+        min_key_ = sorted_keys.front();
+        max_key_ = sorted_keys.back();
+        scale_ = kNumBuckets / static_cast<double>(max_key_ - min_key_);
+
+        std::vector<size_t> counts(kNumBuckets, 0);
+        for (const uint64_t key : sorted_keys) {
+            counts[bucket(key)]++;
+        }
+
+        cdf_.resize(kNumBuckets + 1);
+        size_t num_keys_before = 0;
+        for (size_t bucket_num = 0; bucket_num < kNumBuckets; ++bucket_num) {
+            cdf_[bucket_num] = static_cast<double>(num_keys_before) / sorted_keys.size();
+            num_keys_before += counts[bucket_num];
+        }
+        cdf_[kNumBuckets] = 1.0;
+        return true;
+    }
+
+    bool is_trained() const {
+        return !cdf_.empty();
+    }
+
+    /** True if `key` lies within the trained key range. Only keys in this range are spread by the model. */
+    bool covers(const uint64_t key) const {
+        return is_trained() && key >= min_key_ && key <= max_key_;
+    }
+
+    /** Maps a covered key to its scaled CDF position in [0, 2^64). */
+    uint64_t predict(const uint64_t key) const {
+        const double pos = (key - min_key_) * scale_;
+        const size_t bucket_num = std::min(static_cast<size_t>(pos), kNumBuckets - 1);
+        const double fraction = std::min(pos - bucket_num, 1.0);
+        const double y = cdf_[bucket_num] + fraction * (cdf_[bucket_num + 1] - cdf_[bucket_num]);
+        if (y >= 1.0) {
+            return UINT64_MAX;
+        }
+        return static_cast<uint64_t>(y * 18446744073709551616.0);
+    }
+
+  private:
+    size_t bucket(const uint64_t key) const {
+        return std::min(static_cast<size_t>((key - min_key_) * scale_), kNumBuckets - 1);
+    }
+
+    uint64_t min_key_ = 0;
+    uint64_t max_key_ = 0;
+    double scale_ = 0;
+    std::vector<double> cdf_;
+};
+
 }  // namespace viper::cceh
@@ -0,0 +1,872 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "cceh.hpp"
+
+namespace viper::learned {
+
+/**
+ * Maps keys to the 64-bit model space used by the learned index and defines the order of the index.
+ * The model key must be monotone with respect to `less`. Keys with equal model keys are ordered by their bytes.
+ * Fixed-size keys are modeled on their first 8 bytes (little-endian), which matches the order of the
+ * benchmark records. Specialize this for custom key types if their order differs.
+ */
+template <typename K, typename Enable = void>
+struct KeyTraits {
+    static_assert(std::is_trivially_copyable_v<K>, "Ordered index requires trivially copyable keys.");
+
+    /** Number of 64-bit words per key if the first word is the model key, else 0. Used by `count_model_less`. */
+    static constexpr size_t kSimdStride =
+        (sizeof(K) == sizeof(uint64_t) || sizeof(K) == 2 * sizeof(uint64_t)) ? sizeof(K) / sizeof(uint64_t) : 0;
+    static constexpr uint64_t kModelKeyFlip = 0;
+
+    static inline uint64_t model_key(const K& key) {
+        uint64_t m_key = 0;
+        memcpy(&m_key, &key, std::min(sizeof(K), sizeof(uint64_t)));
+        return m_key;
+    }
+
+    static inline bool less(const K& lhs, const K& rhs) {
+        const uint64_t m_lhs = model_key(lhs);
+        const uint64_t m_rhs = model_key(rhs);
+        if (m_lhs != m_rhs) return m_lhs < m_rhs;
+        if constexpr (sizeof(K) > sizeof(uint64_t)) {
+            return memcmp(&lhs, &rhs, sizeof(K)) < 0;
+        } else {
+            return false;
+        }
+    }
+
+    static inline bool equal(const K& lhs, const K& rhs) {
+        return memcmp(&lhs, &rhs, sizeof(K)) == 0;
+    }
+
+    /** Largest key, e.g., as the end of an unbounded iterator. */
+    static inline K max_key() {
+        K key;
+        memset(&key, 0xFF, sizeof(K));
+        return key;
+    }
+};
+
+template <typename K>
+struct KeyTraits<K, std::enable_if_t<std::is_integral_v<K>>> {
+    static constexpr size_t kSimdStride = sizeof(K) == sizeof(uint64_t) ? 1 : 0;
+    static constexpr uint64_t kModelKeyFlip = std::is_signed_v<K> ? (1ul << 63) : 0;
+
+    static inline uint64_t model_key(const K key) {
+        if constexpr (std::is_signed_v<K>) {
+            // Flip sign bit so that negative keys are ordered before positive ones.
+            return static_cast<uint64_t>(static_cast<int64_t>(key)) ^ (1ul << 63);
+        } else {
+            return static_cast<uint64_t>(key);
+        }
+    }
+
+    static inline bool less(const K lhs, const K rhs) { return lhs < rhs; }
+    static inline bool equal(const K lhs, const K rhs) { return lhs == rhs; }
+    static inline K max_key() { return std::numeric_limits<K>::max(); }
+};
+
+template <>
+struct KeyTraits<std::string> {
+    /** Big-endian first 8 bytes, so that the model key preserves the lexicographic order. */
+    static inline uint64_t model_key(const std::string& key) {
+        uint64_t m_key = 0;
+        const size_t prefix_length = std::min(key.size(), sizeof(uint64_t));
+        for (size_t i = 0; i < prefix_length; ++i) {
+            m_key |= static_cast<uint64_t>(static_cast<uint8_t>(key[i])) << (8 * (7 - i));
+        }
+        return m_key;
+    }
+
+    static inline bool less(const std::string& lhs, const std::string& rhs) { return lhs < rhs; }
+    static inline bool equal(const std::string& lhs, const std::string& rhs) { return lhs == rhs; }
+
+    /** Larger than any key that Viper can store, as key sizes have 15 bits. */
+    static inline std::string max_key() { return std::string(1 << 15, '\xFF'); }
+};
+
+template <typename K, typename = void>
+struct SimdStride : std::integral_constant<size_t, 0> {};
+
+template <typename K>
+struct SimdStride<K, std::void_t<decltype(KeyTraits<K>::kSimdStride)>>
+    : std::integral_constant<size_t, KeyTraits<K>::kSimdStride> {};
+
+/**
+ * Returns the number of keys in [begin, end) whose model key is smaller than `m_key`.
+ * Keys with one or two 64-bit words are compared 8 (AVX-512) or 4 (AVX2) at a time without branches.
+ */
+template <typename K>
+size_t count_model_less(const K* keys, const size_t begin, const size_t end, const uint64_t m_key) {
+    using Traits = KeyTraits<K>;
+    constexpr size_t kStride = SimdStride<K>::value;
+    size_t pos = begin;
+    size_t count = 0;
+
+    if constexpr (kStride == 1 || kStride == 2) {
+        const auto* words = reinterpret_cast<const uint64_t*>(keys);
+#if defined(__AVX512F__)
+        const __m512i flip = _mm512_set1_epi64(Traits::kModelKeyFlip);
+        const __m512i search_key = _mm512_set1_epi64(m_key);
+        for (; pos + 8 <= end; pos += 8) {
+            const uint64_t* chunk = words + (pos * kStride);
+            __m512i model_keys;
+            if constexpr (kStride == 1) {
+                model_keys = _mm512_loadu_si512(chunk);
+            } else {
+                // Only the count matters, so the order of the first words in the vector does not.
+                model_keys = _mm512_unpacklo_epi64(_mm512_loadu_si512(chunk), _mm512_loadu_si512(chunk + 8));
+            }
+            model_keys = _mm512_xor_si512(model_keys, flip);
+            count += _mm_popcnt_u32(_mm512_cmplt_epu64_mask(model_keys, search_key));
+        }
+#elif defined(__AVX2__)
+        // AVX2 can only compare signed integers, so the sign bit is flipped on both sides.
+        constexpr uint64_t sign_bit = 1ul << 63;
+        const __m256i flip = _mm256_set1_epi64x(Traits::kModelKeyFlip ^ sign_bit);
+        const __m256i search_key = _mm256_set1_epi64x(m_key ^ sign_bit);
+        for (; pos + 4 <= end; pos += 4) {
+            const uint64_t* chunk = words + (pos * kStride);
+            __m256i model_keys;
+            if constexpr (kStride == 1) {
+                model_keys = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(chunk));
+            } else {
+                model_keys = _mm256_unpacklo_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(chunk)),
+                                                   _mm256_loadu_si256(reinterpret_cast<const __m256i*>(chunk + 4)));
+            }
+            model_keys = _mm256_xor_si256(model_keys, flip);
+            const __m256i is_less = _mm256_cmpgt_epi64(search_key, model_keys);
+            count += _mm_popcnt_u32(_mm256_movemask_pd(_mm256_castsi256_pd(is_less)));
+        }
+#endif
+    }
+
+    for (; pos < end; ++pos) {
+        count += Traits::model_key(keys[pos]) < m_key;
+    }
+    return count;
+}
+
+/**
+ * Returns the first position in [begin, end) whose key is not less than `key`, or `end`. `keys` must be sorted.
+ * This is meant for the small error windows of the learned models. Large windows are narrowed by binary search first.
+ */
+template <typename K>
+size_t lower_bound_in_window(const K* keys, size_t begin, size_t end, const K& key) {
+    using Traits = KeyTraits<K>;
+    constexpr size_t kMaxLinearWindow = 128;
+
+    if constexpr (SimdStride<K>::value == 0) {
+        return std::partition_point(keys + begin, keys + end, [&](const K& k) { return Traits::less(k, key); }) - keys;
+    } else {
+        while (end - begin > kMaxLinearWindow) {
+            const size_t mid = begin + (end - begin) / 2;
+            if (Traits::less(keys[mid], key)) {
+                begin = mid + 1;
+            } else {
+                end = mid;
+            }
+        }
+
+        size_t pos = begin + count_model_less(keys, begin, end, Traits::model_key(key));
+        // Keys with the same model key are ordered by their bytes.
+        while (pos < end && Traits::less(keys[pos], key)) {
+            ++pos;
+        }
+        return pos;
+    }
+}
+
+/**
+ * Linear model for a contiguous range of positions in the sorted key array.
+ * All keys in the segment are at most `error` positions away from the predicted position.
+ */
+struct LinearSegment {
+    uint64_t first_key;
+    size_t first_pos;
+    double slope;
+    size_t error;
+
+    inline double predict(const uint64_t m_key) const {
+        return first_pos + slope * static_cast<double>(m_key - first_key);
+    }
+};
+
+/**
+ * Fits epsilon-bounded linear segments over the sorted model keys in [begin, end) using a shrinking cone.
+ * Keys with the same model key are never split across segments.
+ */
+template <typename K>
+void fit_segments(const std::vector<K>& keys, const size_t begin, const size_t end, const size_t epsilon,
+                  std::vector<LinearSegment>* segments) {
+    size_t seg_start = begin;
+    while (seg_start < end) {
+        const uint64_t first_key = KeyTraits<K>::model_key(keys[seg_start]);
+        double slope_low = 0;
+        double slope_high = std::numeric_limits<double>::infinity();
+
+        size_t pos = seg_start + 1;
+        for (; pos < end; ++pos) {
+            const uint64_t m_key = KeyTraits<K>::model_key(keys[pos]);
+            if (m_key == first_key) continue;
+            const double dx = static_cast<double>(m_key - first_key);
+            const double dy = static_cast<double>(pos - seg_start);
+            const double slope = dy / dx;
+            if (slope < slope_low || slope > slope_high) break;
+            slope_low = std::max(slope_low, (dy - epsilon) / dx);
+            slope_high = std::min(slope_high, (dy + epsilon) / dx);
+        }
+
+        // Lookups only search the last segment with first_key <= key, so a run of equal model keys must start the
+        // next segment instead of being split. Runs with the segment's first key are never split above.
+        while (pos < end && KeyTraits<K>::model_key(keys[pos]) == KeyTraits<K>::model_key(keys[pos - 1])) {
+            pos--;
+        }
+
+        LinearSegment segment{first_key, seg_start, 0, 0};
+        if (slope_high != std::numeric_limits<double>::infinity()) {
+            segment.slope = (slope_low + slope_high) / 2;
+        }
+
+        // Duplicate model keys may exceed epsilon, so store the real error of the segment.
+        double max_error = 0;
+        for (size_t i = seg_start; i < pos; ++i) {
+            const double prediction = segment.predict(KeyTraits<K>::model_key(keys[i]));
+            max_error = std::max(max_error, std::abs(prediction - static_cast<double>(i)));
+        }
+        segment.error = static_cast<size_t>(std::ceil(max_error));
+        segments->push_back(segment);
+        seg_start = pos;
+    }
+}
+
+/**
+ * Merges runs that are each sorted by KeyTraits::less into one sorted vector.
+ * Pairs of runs are merged in parallel, so this takes log2(#runs) rounds.
+ */
+template <typename K>
+std::vector<std::pair<K, IndexV>> merge_sorted_runs(std::vector<std::vector<std::pair<K, IndexV>>> runs) {
+    auto entry_less = [](const std::pair<K, IndexV>& lhs, const std::pair<K, IndexV>& rhs) {
+        return KeyTraits<K>::less(lhs.first, rhs.first);
+    };
+
+    while (runs.size() > 1) {
+        const size_t num_merges = runs.size() / 2;
+        std::vector<std::vector<std::pair<K, IndexV>>> merged_runs(num_merges + (runs.size() % 2));
+        std::vector<std::thread> merge_threads;
+        merge_threads.reserve(num_merges);
+
+        for (size_t merge_num = 0; merge_num < num_merges; ++merge_num) {
+            merge_threads.emplace_back([&, merge_num] {
+                auto& lhs = runs[2 * merge_num];
+                auto& rhs = runs[2 * merge_num + 1];
+                auto& merged = merged_runs[merge_num];
+                merged.reserve(lhs.size() + rhs.size());
+                std::merge(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), std::back_inserter(merged), entry_less);
+                // Free memory early, as all entries are in memory twice during the merge.
+                lhs = {};
+                rhs = {};
+            });
+        }
+
+        for (std::thread& thread : merge_threads) {
+            thread.join();
+        }
+
+        if (runs.size() % 2 == 1) {
+            merged_runs.back() = std::move(runs.back());
+        }
+        runs = std::move(merged_runs);
+    }
+
+    if (runs.empty()) return {};
+    return std::move(runs[0]);
+}
+
+/** Sorted keys with their offsets and the fitted segments of a LearnedIndex, e.g., to persist the index. */
+template <typename K>
+struct IndexCheckpoint {
+    std::vector<K> keys;
+    std::vector<IndexV> offsets;
+    std::vector<LinearSegment> segments;
+};
+
+/**
+ * Ordered index that maps keys to their KeyValueOffset.
+ * The bulk of the keys is stored in a sorted array that is searched via piecewise linear models
+ * (PGM-style, epsilon-bounded). Updates to existing keys are applied in place. New keys are buffered in an
+ * ordered delta, which is merged into the sorted array once it grows too large.
+ * The merge runs without the lock: the delta is frozen and a new sorted array is built from it, while all writes go
+ * to a new delta that takes precedence over both. Only swapping in the new array takes the exclusive lock.
+ * As the index stores full keys, the key check functions are never called.
+ */
+template <typename K>
+class LearnedIndex {
+    using Traits = KeyTraits<K>;
+
+  public:
+    static constexpr bool kIsOrdered = true;
+    static constexpr size_t kEpsilon = 16;
+    static constexpr size_t kMinDeltaSize = 4096;
+    static constexpr size_t kDeltaRatio = 8;
+    static constexpr size_t kScanBatchSize = 64;
+    static constexpr size_t kMinKeysPerFitThread = 1'000'000;
+    static constexpr size_t kMaxSwapWrites = 1024;
+
+    LearnedIndex(size_t initial_capacity = 0);
+
+    IndexV Insert(const K& key, IndexV value);
+    IndexV Get(const K& key);
+    bool Delete(const K& key);
+
+    template <typename KeyCheckFn>
+    IndexV Insert(const K& key, IndexV value, KeyCheckFn) { return Insert(key, value); }
+
+    template <typename KeyCheckFn>
+    IndexV Get(const K& key, KeyCheckFn) { return Get(key); }
+
+    template <typename KeyCheckFn>
+    bool Delete(const K& key, KeyCheckFn) { return Delete(key); }
+
+    /**
+     * Builds the index from `entries`, which must be sorted by KeyTraits::less and unique. Index must be empty.
+     * The segments are fitted in parallel by up to `num_threads` threads.
+     */
+    void BulkLoad(const std::vector<std::pair<K, IndexV>>& entries, size_t num_threads = 1);
+
+    template <typename KeyCheckFn>
+    void BulkLoad(const std::vector<std::pair<K, IndexV>>& entries, KeyCheckFn, size_t num_threads) {
+        BulkLoad(entries, num_threads);
+    }
+
+    /**
+     * Calls `scan_fn(key, offset)` for all keys in [start_key, end_key] in order. Returns the number of visited keys.
+     * Entries are collected in batches, so `scan_fn` can modify the index. Stops if `scan_fn` returns false.
+     */
+    template <typename ScanFn>
+    size_t Scan(const K& start_key, const K& end_key, ScanFn scan_fn);
+
+    /** Number of keys that are not deleted. */
+    size_t Size();
+
+    /** Merges the delta and returns a copy of the sorted array and its segments. Writers may continue meanwhile. */
+    IndexCheckpoint<K> Checkpoint();
+
+    /** Restores the index from a checkpoint without fitting the segments again. Index must be empty. */
+    void Restore(IndexCheckpoint<K> checkpoint);
+
+  protected:
+    struct KeyLess {
+        bool operator()(const K& lhs, const K& rhs) const { return Traits::less(lhs, rhs); }
+    };
+
+    struct Snapshot {
+        std::vector<K> keys;
+        std::vector<IndexV> offsets;
+        std::vector<uint64_t> segment_keys;
+        std::vector<LinearSegment> segments;
+
+        size_t lower_bound(const K& key) const;
+        size_t find(const K& key) const;
+    };
+
+    using Delta = std::map<K, IndexV, KeyLess>;
+
+    bool collect_batch(const K& start_key, bool include_start, const K& end_key,
+                       std::vector<std::pair<K, IndexV>>* batch, K* resume_key);
+    IndexV lookup(const K& key) const;
+    IndexV upsert(const K& key, IndexV value);
+    IndexV erase(const K& key);
+    void log_merge_write(const K& key, IndexV value);
+    bool freeze_delta();
+    void merge_delta();
+    void build_models(Snapshot* snapshot, size_t num_threads = 1);
+
+    std::unique_ptr<Snapshot> snapshot_;
+    // New keys. While a merge runs, all writes, which may also be tombstones for keys in the snapshot.
+    Delta delta_;
+    // Keys that are being merged into a new snapshot. Not modified until the merge is done.
+    Delta frozen_delta_;
+    // Writes since the merge started, which it applies to the new snapshot before swapping it in.
+    std::vector<std::pair<K, IndexV>> merge_log_;
+    bool is_merging_ = false;
+    std::atomic<size_t> num_keys_ = 0;
+    std::shared_mutex lock_;
+};
+
+template <typename K>
+size_t LearnedIndex<K>::Snapshot::lower_bound(const K& key) const {
+    if (keys.empty()) return 0;
+
+    const uint64_t m_key = Traits::model_key(key);
+    const auto seg_it = std::upper_bound(segment_keys.begin(), segment_keys.end(), m_key);
+    if (seg_it == segment_keys.begin()) {
+        // Smaller than all keys.
+        return 0;
+    }
+
+    const size_t seg_num = (seg_it - segment_keys.begin()) - 1;
+    const LinearSegment& segment = segments[seg_num];
+    const size_t seg_end = seg_num + 1 < segments.size() ? segments[seg_num + 1].first_pos : keys.size();
+    const double prediction = segment.predict(m_key);
+
+    const double low = std::max(prediction - segment.error, static_cast<double>(segment.first_pos));
+    const double high = std::min(prediction + segment.error + 2, static_cast<double>(seg_end));
+    const size_t search_begin = std::min(static_cast<size_t>(low), seg_end);
+    const size_t search_end = std::max(static_cast<size_t>(high), search_begin);
+
+    return lower_bound_in_window(keys.data(), search_begin, search_end, key);
+}
+
+template <typename K>
+size_t LearnedIndex<K>::Snapshot::find(const K& key) const {
+    const size_t pos = lower_bound(key);
+    if (pos < keys.size() && Traits::equal(keys[pos], key)) {
+        return pos;
+    }
+    return keys.size();
+}
+
+template <typename K>
+LearnedIndex<K>::LearnedIndex(const size_t initial_capacity) : snapshot_{std::make_unique<Snapshot>()} {
+    snapshot_->keys.reserve(initial_capacity);
+    snapshot_->offsets.reserve(initial_capacity);
+}
+
+template <typename K>
+IndexV LearnedIndex<K>::Insert(const K& key, const IndexV value) {
+    // Inserting a tombstone removes the key.
+    const IndexV old_offset = value.is_tombstone() ? erase(key) : upsert(key, value);
+    if (value.is_tombstone() != old_offset.is_tombstone()) {
+        if (value.is_tombstone()) {
+            num_keys_.fetch_sub(1);
+        } else {
+            num_keys_.fetch_add(1);
+        }
+    }
+    return old_offset;
+}
+
+template <typename K>
+IndexV LearnedIndex<K>::upsert(const K& key, const IndexV value) {
+    {
+        std::shared_lock lock{lock_};
+        const size_t pos = snapshot_->find(key);
+        if (!is_merging_ && pos < snapshot_->keys.size()) {
+            // Existing key, update in place.
+            const offset_size_t old_offset = __atomic_exchange_n(&snapshot_->offsets[pos].offset,
+                                                                 value.offset, __ATOMIC_ACQ_REL);
+            return IndexV{old_offset};
+        }
+    }
+
+    IndexV old_offset;
+    bool should_merge = false;
+    {
+        std::unique_lock lock{lock_};
+        if (is_merging_) {
+            // The merge reads the snapshot, so it must not change. The delta shadows it until the merge is done.
+            old_offset = lookup(key);
+            log_merge_write(key, value);
+            return old_offset;
+        }
+
+        const size_t pos = snapshot_->find(key);
+        if (pos < snapshot_->keys.size()) {
+            // Key was merged in the meantime.
+            old_offset = snapshot_->offsets[pos];
+            snapshot_->offsets[pos] = value;
+            return old_offset;
+        }
+
+        old_offset = IndexV::NONE();
+        auto [it, is_new] = delta_.try_emplace(key, value);
+        if (!is_new) {
+            old_offset = it->second;
+            it->second = value;
+        }
+        should_merge = freeze_delta();
+    }
+
+    if (should_merge) {
+        merge_delta();
+    }
+    return old_offset;
+}
+
+template <typename K>
+IndexV LearnedIndex<K>::Get(const K& key) {
+    std::shared_lock lock{lock_};
+    return lookup(key);
+}
+
+template <typename K>
+IndexV LearnedIndex<K>::lookup(const K& key) const {
+    // Caller holds the lock. While a merge runs, the delta has the latest value of all keys written since.
+    if (is_merging_) {
+        const auto it = delta_.find(key);
+        if (it != delta_.end()) {
+            return it->second;
+        }
+    }
+
+    const size_t pos = snapshot_->find(key);
+    if (pos < snapshot_->keys.size()) {
+        return IndexV{ATOMIC_LOAD(&snapshot_->offsets[pos].offset)};
+    }
+
+    const Delta& delta = is_merging_ ? frozen_delta_ : delta_;
+    const auto it = delta.find(key);
+    if (it != delta.end()) {
+        return it->second;
+    }
+    return IndexV::NONE();
+}
+
+template <typename K>
+bool LearnedIndex<K>::Delete(const K& key) {
+    return !Insert(key, IndexV::Tombstone()).is_tombstone();
+}
+
+template <typename K>
+IndexV LearnedIndex<K>::erase(const K& key) {
+    {
+        std::shared_lock lock{lock_};
+        const size_t pos = snapshot_->find(key);
+        if (!is_merging_ && pos < snapshot_->keys.size()) {
+            // Tombstone is removed on the next merge.
+            const offset_size_t old_offset = __atomic_exchange_n(&snapshot_->offsets[pos].offset,
+                                                                 IndexV::Tombstone().offset, __ATOMIC_ACQ_REL);
+            return IndexV{old_offset};
+        }
+    }
+
+    std::unique_lock lock{lock_};
+    if (is_merging_) {
+        const IndexV old_offset = lookup(key);
+        if (!old_offset.is_tombstone()) {
+            // The key may also be in the snapshot or the frozen delta, so the tombstone is needed until the merge.
+            log_merge_write(key, IndexV::Tombstone());
+        }
+        return old_offset;
+    }
+
+    const size_t pos = snapshot_->find(key);
+    if (pos < snapshot_->keys.size()) {
+        const IndexV old_offset = snapshot_->offsets[pos];
+        snapshot_->offsets[pos] = IndexV::Tombstone();
+        return old_offset;
+    }
+
+    const auto it = delta_.find(key);
+    if (it == delta_.end()) {
+        return IndexV::NONE();
+    }
+    const IndexV old_offset = it->second;
+    delta_.erase(it);
+    return old_offset;
+}
+
+template <typename K>
+void LearnedIndex<K>::BulkLoad(const std::vector<std::pair<K, IndexV>>& entries, const size_t num_threads) {
+    std::unique_lock lock{lock_};
+    if (!snapshot_->keys.empty() || !delta_.empty() || is_merging_) {
+        throw std::runtime_error("Can only bulk load into an empty index.");
+    }
+
+    auto snapshot = std::make_unique<Snapshot>();
+    snapshot->keys.reserve(entries.size());
+    snapshot->offsets.reserve(entries.size());
+    for (const auto& [key, offset] : entries) {
+        snapshot->keys.push_back(key);
+        snapshot->offsets.push_back(offset);
+    }
+    build_models(snapshot.get(), num_threads);
+    snapshot_ = std::move(snapshot);
+    num_keys_.store(entries.size());
+}
+
+template <typename K>
+size_t LearnedIndex<K>::Size() {
+    return num_keys_.load();
+}
+
+template <typename K>
+IndexCheckpoint<K> LearnedIndex<K>::Checkpoint() {
+    while (true) {
+        std::unique_lock lock{lock_};
+        if (is_merging_) {
+            // Wait for the running merge, as the checkpoint only contains the snapshot.
+            lock.unlock();
+            std::this_thread::yield();
+            continue;
+        }
+        if (delta_.empty()) {
+            break;
+        }
+        is_merging_ = true;
+        frozen_delta_.swap(delta_);
+        lock.unlock();
+        merge_delta();
+    }
+
+    // Offsets may still be updated in place, so they are copied atomically. A merge that starts meanwhile does not
+    // change the snapshot until it is swapped, which needs the exclusive lock.
+    std::shared_lock lock{lock_};
+    IndexCheckpoint<K> checkpoint{snapshot_->keys, {}, snapshot_->segments};
+    checkpoint.offsets.reserve(snapshot_->offsets.size());
+    for (const IndexV& offset : snapshot_->offsets) {
+        checkpoint.offsets.emplace_back(ATOMIC_LOAD(&offset.offset));
+    }
+    return checkpoint;
+}
+
+template <typename K>
+void LearnedIndex<K>::Restore(IndexCheckpoint<K> checkpoint) {
+    std::unique_lock lock{lock_};
+    if (!snapshot_->keys.empty() || !delta_.empty() || is_merging_) {
+        throw std::runtime_error("Can only restore into an empty index.");
+    }
+
+    auto snapshot = std::make_unique<Snapshot>();
+    snapshot->keys = std::move(checkpoint.keys);
+    snapshot->offsets = std::move(checkpoint.offsets);
+    snapshot->segments = std::move(checkpoint.segments);
+    snapshot->segment_keys.reserve(snapshot->segments.size());
+    for (const LinearSegment& segment : snapshot->segments) {
+        snapshot->segment_keys.push_back(segment.first_key);
+    }
+    num_keys_.store(std::count_if(snapshot->offsets.begin(), snapshot->offsets.end(),
+                                  [](const IndexV& offset) { return !offset.is_tombstone(); }));
+    snapshot_ = std::move(snapshot);
+}
+
+template <typename K>
+template <typename ScanFn>
+size_t LearnedIndex<K>::Scan(const K& start_key, const K& end_key, ScanFn scan_fn) {
+    std::vector<std::pair<K, IndexV>> batch;
+    batch.reserve(kScanBatchSize);
+
+    size_t num_visited = 0;
+    K next_key = start_key;
+    bool include_start = true;
+    bool has_more = true;
+    while (has_more) {
+        batch.clear();
+        has_more = collect_batch(next_key, include_start, end_key, &batch, &next_key);
+        include_start = false;
+        for (const auto& [key, offset] : batch) {
+            num_visited++;
+            if (!scan_fn(key, offset)) {
+                return num_visited;
+            }
+        }
+    }
+    return num_visited;
+}
+
+template <typename K>
+bool LearnedIndex<K>::collect_batch(const K& start_key, const bool include_start, const K& end_key,
+                                    std::vector<std::pair<K, IndexV>>* batch, K* resume_key) {
+    std::shared_lock lock{lock_};
+    const Snapshot& snapshot = *snapshot_;
+    size_t snap_pos = snapshot.lower_bound(start_key);
+    auto delta_it = delta_.lower_bound(start_key);
+    const auto delta_end = delta_.end();
+    // Empty unless a merge is running.
+    auto frozen_it = frozen_delta_.lower_bound(start_key);
+    const auto frozen_end = frozen_delta_.end();
+
+    if (!include_start) {
+        if (snap_pos < snapshot.keys.size() && Traits::equal(snapshot.keys[snap_pos], start_key)) snap_pos++;
+        if (delta_it != delta_end && Traits::equal(delta_it->first, start_key)) delta_it++;
+        if (frozen_it != frozen_end && Traits::equal(frozen_it->first, start_key)) frozen_it++;
+    }
+
+    // Tombstones count towards the batch size so that a batch is bounded in work, not in results.
+    for (size_t num_collected = 0; num_collected < kScanBatchSize; ++num_collected) {
+        const bool has_snap = snap_pos < snapshot.keys.size();
+        const bool has_delta = delta_it != delta_end;
+        const bool has_frozen = frozen_it != frozen_end;
+        if (!has_snap && !has_delta && !has_frozen) return false;
+
+        const K* min_key = has_snap ? &snapshot.keys[snap_pos] : nullptr;
+        if (has_delta && (min_key == nullptr || Traits::less(delta_it->first, *min_key))) min_key = &delta_it->first;
+        if (has_frozen && (min_key == nullptr || Traits::less(frozen_it->first, *min_key))) min_key = &frozen_it->first;
+        const K key = *min_key;
+        if (Traits::less(end_key, key)) return false;
+
+        // A key may be in several sources during a merge. The delta has the latest value, the frozen delta the oldest.
+        IndexV offset = IndexV::NONE();
+        bool is_found = false;
+        if (has_delta && Traits::equal(delta_it->first, key)) {
+            offset = delta_it->second;
+            is_found = true;
+            delta_it++;
+        }
+        if (has_snap && Traits::equal(snapshot.keys[snap_pos], key)) {
+            if (!is_found) offset = IndexV{ATOMIC_LOAD(&snapshot.offsets[snap_pos].offset)};
+            is_found = true;
+            snap_pos++;
+        }
+        if (has_frozen && Traits::equal(frozen_it->first, key)) {
+            if (!is_found) offset = frozen_it->second;
+            frozen_it++;
+        }
+
+        *resume_key = key;
+        if (!offset.is_tombstone()) {
+            batch->emplace_back(key, offset);
+        }
+    }
+    return true;
+}
+
+template <typename K>
+void LearnedIndex<K>::log_merge_write(const K& key, const IndexV value) {
+    // Caller holds the exclusive lock.
+    delta_.insert_or_assign(key, value);
+    merge_log_.emplace_back(key, value);
+}
+
+template <typename K>
+bool LearnedIndex<K>::freeze_delta() {
+    // Caller holds the exclusive lock.
+    if (is_merging_ || delta_.size() <= std::max(kMinDeltaSize, snapshot_->keys.size() / kDeltaRatio)) {
+        return false;
+    }
+    is_merging_ = true;
+    frozen_delta_.swap(delta_);
+    return true;
+}
+
+template <typename K>
+void LearnedIndex<K>::merge_delta() {
+    // Caller froze the delta and holds no lock. Only this thread replaces the snapshot, and nobody modifies it or
+    // the frozen delta until then.
+    const Snapshot& old_snapshot = *snapshot_;
+    auto new_snapshot = std::make_unique<Snapshot>();
+    const size_t max_size = old_snapshot.keys.size() + frozen_delta_.size();
+    new_snapshot->keys.reserve(max_size);
+    new_snapshot->offsets.reserve(max_size);
+
+    size_t snap_pos = 0;
+    auto delta_it = frozen_delta_.begin();
+    while (snap_pos < old_snapshot.keys.size() || delta_it != frozen_delta_.end()) {
+        const bool take_snap = snap_pos < old_snapshot.keys.size() &&
+            (delta_it == frozen_delta_.end() || Traits::less(old_snapshot.keys[snap_pos], delta_it->first));
+        if (take_snap) {
+            const IndexV offset = old_snapshot.offsets[snap_pos];
+            if (!offset.is_tombstone()) {
+                new_snapshot->keys.push_back(old_snapshot.keys[snap_pos]);
+                new_snapshot->offsets.push_back(offset);
+            }
+            snap_pos++;
+        } else {
+            new_snapshot->keys.push_back(delta_it->first);
+            new_snapshot->offsets.push_back(delta_it->second);
+            delta_it++;
+        }
+    }
+    build_models(new_snapshot.get());
+
+    // Replays the writes made since the merge started. Writes to merged keys go to the new snapshot, so that the
+    // new delta only holds new keys again.
+    Delta new_delta;
+    auto replay = [&](const std::vector<std::pair<K, IndexV>>& writes) {
+        for (const auto& [key, offset] : writes) {
+            const size_t pos = new_snapshot->find(key);
+            if (pos < new_snapshot->keys.size()) {
+                new_snapshot->offsets[pos] = offset;
+            } else if (offset.is_tombstone()) {
+                new_delta.erase(key);
+            } else {
+                new_delta.insert_or_assign(key, offset);
+            }
+        }
+    };
+
+    // Most writes are replayed without the lock. Only the last few are replayed while the snapshot is swapped.
+    std::vector<std::pair<K, IndexV>> writes;
+    Delta merged_delta;
+    while (true) {
+        {
+            std::unique_lock lock{lock_};
+            if (merge_log_.size() <= kMaxSwapWrites) {
+                replay(merge_log_);
+                merge_log_.clear();
+                // The old snapshot and deltas are freed below, after the lock is released.
+                std::swap(snapshot_, new_snapshot);
+                delta_.swap(new_delta);
+                merged_delta.swap(frozen_delta_);
+                is_merging_ = false;
+                break;
+            }
+            writes.swap(merge_log_);
+        }
+        replay(writes);
+        writes.clear();
+    }
+}
+
+template <typename K>
+void LearnedIndex<K>::build_models(Snapshot* snapshot, size_t num_threads) {
+    const std::vector<K>& keys = snapshot->keys;
+    const size_t num_keys = keys.size();
+    num_threads = std::max(1ul, std::min(num_threads, num_keys / kMinKeysPerFitThread));
+
+    if (num_threads == 1) {
+        fit_segments(keys, 0, num_keys, kEpsilon, &snapshot->segments);
+    } else {
+        // Each thread fits the segments of one chunk. Chunks must not split keys with the same model key.
+        std::vector<size_t> chunk_starts{0};
+        for (size_t chunk_num = 1; chunk_num < num_threads; ++chunk_num) {
+            size_t chunk_start = std::max(chunk_starts.back(), (chunk_num * num_keys) / num_threads);
+            while (chunk_start > 0 && chunk_start < num_keys &&
+                   Traits::model_key(keys[chunk_start]) == Traits::model_key(keys[chunk_start - 1])) {
+                chunk_start++;
+            }
+            chunk_starts.push_back(chunk_start);
+        }
+        chunk_starts.push_back(num_keys);
+
+        std::vector<std::vector<LinearSegment>> chunk_segments(num_threads);
+        std::vector<std::thread> fit_threads;
+        fit_threads.reserve(num_threads);
+        for (size_t chunk_num = 0; chunk_num < num_threads; ++chunk_num) {
+            fit_threads.emplace_back([&, chunk_num] {
+                fit_segments(keys, chunk_starts[chunk_num], chunk_starts[chunk_num + 1], kEpsilon,
+                             &chunk_segments[chunk_num]);
+            });
+        }
+        for (std::thread& thread : fit_threads) {
+            thread.join();
+        }
+        for (const std::vector<LinearSegment>& segments : chunk_segments) {
+            snapshot->segments.insert(snapshot->segments.end(), segments.begin(), segments.end());
+        }
+    }
+
+    snapshot->segment_keys.reserve(snapshot->segments.size());
+    for (const LinearSegment& segment : snapshot->segments) {
+        snapshot->segment_keys.push_back(segment.first_key);
+    }
+}
+
+}  // namespace viper::learned
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * Small helpers to place memory on NUMA nodes. They use the raw system calls, so that Viper does not depend on
+ * libnuma. Without NUMA support, there is a single node 0 and binding memory does nothing.
+ */
+namespace viper::numa {
+
+static constexpr size_t kMaxNodes = 64;
+static constexpr size_t kAnyNode = SIZE_MAX;
+
+/** Number of NUMA nodes, i.e., the highest online node id + 1. */
+inline size_t NumNodes() {
+    static const size_t num_nodes = [] {
+        std::ifstream online_file{"/sys/devices/system/node/online"};
+        std::string online_nodes;
+        if (!(online_file >> online_nodes)) {
+            return 1ul;
+        }
+        // A list of ranges such as "0-3" or "0,2", so the last number is the highest id.
+        const size_t last_start = online_nodes.find_last_of(",-") + 1;
+        return std::min(std::stoul(online_nodes.substr(last_start)) + 1, kMaxNodes);
+    }();
+    return num_nodes;
+}
+
+/** Node of the CPU that the calling thread currently runs on. */
+inline size_t CurrentNode() {
+    unsigned int cpu = 0;
+    unsigned int node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return 0;
+    }
+    return std::min<size_t>(node, NumNodes() - 1);
+}
+
+/** Node whose memory backs the page at `addr`. Faults the page in if it was not accessed before. */
+inline size_t NodeOfAddress(const void* addr) {
+    int node = 0;
+    if (syscall(SYS_get_mempolicy, &node, nullptr, 0, addr, MPOL_F_NODE | MPOL_F_ADDR) != 0) {
+        return 0;
+    }
+    return std::min<size_t>(node, NumNodes() - 1);
+}
+
+/**
+ * Allocates the pages of [addr, addr + length) on `node` when they are first accessed. Falls back to other nodes if
+ * `node` is out of memory. `addr` must be page-aligned.
+ */
+inline void PreferNode(void* addr, const size_t length, const size_t node) {
+    if (NumNodes() == 1) {
+        return;
+    }
+    const unsigned long node_mask = 1ul << node;
+    syscall(SYS_mbind, addr, length, MPOL_PREFERRED, &node_mask, 8 * sizeof(node_mask) + 1, 0);
+}
+
+/** Node that the calling thread allocates index memory on, or kAnyNode. See NodeScope. */
+inline size_t& AllocationNode() {
+    thread_local size_t node = kAnyNode;
+    return node;
+}
+
+/** Sets the node that the calling thread allocates index memory on for its lifetime. */
+class NodeScope {
+  public:
+    explicit NodeScope(const size_t node) : previous_node_{AllocationNode()} { AllocationNode() = node; }
+    ~NodeScope() { AllocationNode() = previous_node_; }
+
+    NodeScope(const NodeScope&) = delete;
+    NodeScope& operator=(const NodeScope&) = delete;
+
+  private:
+    const size_t previous_node_;
+};
+
+}  // namespace viper::numa
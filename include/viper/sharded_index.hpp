@@ -0,0 +1,155 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cceh.hpp"
+#include "numa.hpp"
+
+namespace viper::numa {
+
+/**
+ * Partitions the keys into one `IndexT` per NUMA node by a hash of the key, e.g.,
+ * `Viper<K, V, numa::ShardedIndex<K>>`. The segments and directory of a shard are allocated on its node (see
+ * SegmentArena), so the index memory and its bandwidth are spread evenly over all nodes instead of the node that
+ * touched it first. Each shard also has its own directory lock. Operations are routed to the shard of their key.
+ * The routing hash uses another seed than the index, so that each shard still sees uniformly distributed hashes.
+ * Sharding is only supported for unordered indexes.
+ */
+template <typename K, typename IndexT = cceh::CCEH<K>>
+class ShardedIndex {
+  public:
+    static_assert(!IndexT::kIsOrdered, "Sharding by hash does not preserve the key order.");
+    static constexpr bool kIsOrdered = false;
+
+    /** Creates one shard per node, each with an equal part of `initial_capacity`. */
+    explicit ShardedIndex(const size_t initial_capacity) {
+        const size_t num_shards = NumNodes();
+        shards_.reserve(num_shards);
+        for (size_t node = 0; node < num_shards; ++node) {
+            const NodeScope node_scope{node};
+            shards_.push_back(std::make_unique<IndexT>(std::max(2ul, initial_capacity / num_shards)));
+        }
+    }
+
+    /** Only if `IndexT` is sized in segments. The total number of segments of all shards. */
+    template <typename I = IndexT>
+    static auto NumSegmentsFor(const size_t num_keys) -> decltype(I::NumSegmentsFor(num_keys)) {
+        const size_t num_shards = NumNodes();
+        return num_shards * I::NumSegmentsFor((num_keys + num_shards - 1) / num_shards);
+    }
+
+    /** Shard (and node) that `key` belongs to. Clients on that node access the key's index memory locally. */
+    size_t ShardOf(const K& key) const {
+        if constexpr (std::is_same_v<K, std::string>) {
+            return cceh::h(key.data(), key.length(), kShardSeed) % shards_.size();
+        } else {
+            return cceh::h(&key, sizeof(key), kShardSeed) % shards_.size();
+        }
+    }
+
+    template <typename KeyCheckFn>
+    IndexV Insert(const K& key, const IndexV offset, KeyCheckFn key_check_fn) {
+        const size_t shard = ShardOf(key);
+        // Splits allocate new segments on the shard's node.
+        const NodeScope node_scope{shard};
+        return shards_[shard]->Insert(key, offset, key_check_fn);
+    }
+
+    template <typename KeyCheckFn>
+    IndexV Get(const K& key, KeyCheckFn key_check_fn) {
+        return shards_[ShardOf(key)]->Get(key, key_check_fn);
+    }
+
+    template <typename KeyCheckFn>
+    bool Delete(const K& key, KeyCheckFn key_check_fn) {
+        const size_t shard = ShardOf(key);
+        const NodeScope node_scope{shard};
+        return shards_[shard]->Delete(key, key_check_fn);
+    }
+
+    /** Only if `IndexT` has MultiGet. Groups the keys by shard, so that each shard batches its lookups. */
+    template <typename KeyCheckFn, typename I = IndexT>
+    auto MultiGet(const K* keys, size_t num_keys, IndexV* offsets, KeyCheckFn key_check_fn)
+        -> decltype(std::declval<I&>().MultiGet(keys, num_keys, offsets, key_check_fn)) {
+        std::vector<std::vector<K>> shard_keys(shards_.size());
+        std::vector<std::vector<size_t>> shard_positions(shards_.size());
+        for (size_t i = 0; i < num_keys; ++i) {
+            const size_t shard = ShardOf(keys[i]);
+            shard_keys[shard].push_back(keys[i]);
+            shard_positions[shard].push_back(i);
+        }
+        std::vector<IndexV> shard_offsets;
+        for (size_t shard = 0; shard < shards_.size(); ++shard) {
+            shard_offsets.resize(shard_keys[shard].size());
+            shards_[shard]->MultiGet(shard_keys[shard].data(), shard_keys[shard].size(), shard_offsets.data(),
+                                     key_check_fn);
+            for (size_t i = 0; i < shard_offsets.size(); ++i) {
+                offsets[shard_positions[shard][i]] = shard_offsets[i];
+            }
+        }
+    }
+
+    /** Loads all shards in parallel, each with a share of `num_threads`. */
+    template <typename KeyCheckFn>
+    void BulkLoad(const std::vector<std::pair<K, IndexV>>& entries, KeyCheckFn key_check_fn, size_t num_threads) {
+        std::vector<std::vector<std::pair<K, IndexV>>> shard_entries(shards_.size());
+        for (const auto& entry : entries) {
+            // Keeps the order of the entries within each shard.
+            shard_entries[ShardOf(entry.first)].push_back(entry);
+        }
+
+        const size_t num_threads_per_shard = std::max(1ul, num_threads / shards_.size());
+        std::vector<std::thread> load_threads;
+        load_threads.reserve(shards_.size());
+        for (size_t shard = 0; shard < shards_.size(); ++shard) {
+            load_threads.emplace_back([&, shard] {
+                const NodeScope node_scope{shard};
+                shards_[shard]->BulkLoad(shard_entries[shard], key_check_fn, num_threads_per_shard);
+            });
+        }
+        for (std::thread& thread : load_threads) {
+            thread.join();
+        }
+    }
+
+    /** Only if `IndexT` has Shrink. Returns the total number of merges. */
+    template <typename I = IndexT>
+    auto Shrink() -> decltype(std::declval<I&>().Shrink()) {
+        size_t num_merges = 0;
+        for (size_t shard = 0; shard < shards_.size(); ++shard) {
+            const NodeScope node_scope{shard};
+            num_merges += shards_[shard]->Shrink();
+        }
+        return num_merges;
+    }
+
+    /** Only if `IndexT` has GetStats. Sums the statistics of all shards. The depth is the deepest shard's. */
+    template <typename I = IndexT>
+    auto GetStats() const -> decltype(std::declval<const I&>().GetStats()) {
+        cceh::IndexStats stats{};
+        for (const auto& shard : shards_) {
+            const cceh::IndexStats shard_stats = shard->GetStats();
+            stats.num_segments += shard_stats.num_segments;
+            stats.directory_depth = std::max(stats.directory_depth, shard_stats.directory_depth);
+            stats.directory_size += shard_stats.directory_size;
+            stats.num_slots += shard_stats.num_slots;
+            stats.num_keys += shard_stats.num_keys;
+            stats.num_stale_slots += shard_stats.num_stale_slots;
+            stats.num_occupied_slots += shard_stats.num_occupied_slots;
+            stats.num_splits += shard_stats.num_splits;
+            stats.num_merges += shard_stats.num_merges;
+            stats.allocated_bytes += shard_stats.allocated_bytes;
+        }
+        return stats;
+    }
+
+  private:
+    static constexpr size_t kShardSeed = 0x5bd1e995UL;
+
+    std::vector<std::unique_ptr<IndexT>> shards_;
+};
+
+}  // namespace viper::numa
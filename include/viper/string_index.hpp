@@ -0,0 +1,645 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "learned_index.hpp"
+
+namespace viper::learned {
+
+/** Returns the 8 bytes of `key` starting at `pos` as a big-endian integer, padded with zeros. */
+inline uint64_t load_slice(const std::string_view key, const size_t pos) {
+    uint64_t slice = 0;
+    const size_t slice_end = std::min(key.size(), pos + sizeof(uint64_t));
+    for (size_t i = pos; i < slice_end; ++i) {
+        slice |= static_cast<uint64_t>(static_cast<uint8_t>(key[i])) << (8 * (7 - (i - pos)));
+    }
+    return slice;
+}
+
+inline size_t common_prefix_length(const std::string_view lhs, const std::string_view rhs) {
+    const size_t max_length = std::min(lhs.size(), rhs.size());
+    return std::mismatch(lhs.begin(), lhs.begin() + max_length, rhs.begin()).first - lhs.begin();
+}
+
+/**
+ * Ordered index for string keys that maps keys to their KeyValueOffset.
+ * The sorted keys are split into partitions of at most `kMaxPartitionSize` keys. Partitions end where adjacent keys
+ * share the shortest prefix, so that the keys of a partition share a long prefix, which is stored only once.
+ * For each key, the 8 bytes after its partition's prefix are stored as an integer slice. The slices are searched via
+ * piecewise linear models per partition and compared with SIMD. The remaining bytes are only compared if two slices
+ * are equal. Like LearnedIndex, new keys are buffered in an ordered delta that is merged once it grows too large,
+ * and the merge builds the new snapshot without holding the lock.
+ * As the index stores full keys in DRAM, the key check functions are never called.
+ */
+class StringIndex {
+    using K = std::string;
+
+  public:
+    static constexpr bool kIsOrdered = true;
+    static constexpr size_t kEpsilon = 16;
+    static constexpr size_t kMaxPartitionSize = 4096;
+    static constexpr size_t kMinDeltaSize = 4096;
+    static constexpr size_t kDeltaRatio = 8;
+    static constexpr size_t kScanBatchSize = 64;
+    static constexpr size_t kMinPartitionsPerFitThread = 256;
+    static constexpr size_t kMaxSwapWrites = 1024;
+
+    StringIndex(size_t initial_capacity = 0);
+
+    IndexV Insert(const K& key, IndexV value);
+    IndexV Get(const K& key);
+    bool Delete(const K& key);
+
+    template <typename KeyCheckFn>
+    IndexV Insert(const K& key, IndexV value, KeyCheckFn) { return Insert(key, value); }
+
+    template <typename KeyCheckFn>
+    IndexV Get(const K& key, KeyCheckFn) { return Get(key); }
+
+    template <typename KeyCheckFn>
+    bool Delete(const K& key, KeyCheckFn) { return Delete(key); }
+
+    /** Builds the index from `entries`, which must be sorted and unique. Index must be empty. */
+    void BulkLoad(const std::vector<std::pair<K, IndexV>>& entries, size_t num_threads = 1);
+
+    template <typename KeyCheckFn>
+    void BulkLoad(const std::vector<std::pair<K, IndexV>>& entries, KeyCheckFn, size_t num_threads) {
+        BulkLoad(entries, num_threads);
+    }
+
+    /**
+     * Calls `scan_fn(key, offset)` for all keys in [start_key, end_key] in order. Returns the number of visited keys.
+     * Entries are collected in batches, so `scan_fn` can modify the index. Stops if `scan_fn` returns false.
+     */
+    template <typename ScanFn>
+    size_t Scan(const K& start_key, const K& end_key, ScanFn scan_fn);
+
+    /** Number of keys that are not deleted. */
+    size_t Size();
+
+  protected:
+    struct Partition {
+        std::string prefix;
+        size_t first_pos;
+        size_t first_segment;
+    };
+
+    struct Snapshot {
+        std::vector<Partition> partitions;
+        std::vector<K> first_keys;
+        std::vector<uint64_t> slices;
+        std::vector<size_t> tail_offsets;
+        std::string tails;
+        std::vector<IndexV> offsets;
+        std::vector<LinearSegment> segments;
+        std::vector<uint64_t> segment_keys;
+
+        inline size_t size() const { return offsets.size(); }
+        inline size_t partition_end(size_t partition_num) const;
+        inline size_t segment_end(size_t partition_num) const;
+        inline size_t partition_of(size_t pos) const;
+        /** Key bytes after the partition prefix. */
+        inline std::string_view tail(size_t pos) const;
+        K key_at(size_t pos, size_t partition_num) const;
+        size_t lower_bound(const K& key) const;
+        size_t find(const K& key) const;
+    };
+
+    using Delta = std::map<K, IndexV>;
+
+    bool collect_batch(const K& start_key, bool include_start, const K& end_key,
+                       std::vector<std::pair<K, IndexV>>* batch, K* resume_key);
+    IndexV lookup(const K& key) const;
+    IndexV upsert(const K& key, IndexV value);
+    IndexV erase(const K& key);
+    void log_merge_write(const K& key, IndexV value);
+    bool freeze_delta();
+    void merge_delta();
+    static std::unique_ptr<Snapshot> build_snapshot(const std::vector<std::pair<K, IndexV>>& entries,
+                                                    size_t num_threads);
+
+    std::unique_ptr<Snapshot> snapshot_;
+    // New keys. While a merge runs, all writes, which may also be tombstones for keys in the snapshot.
+    Delta delta_;
+    // Keys that are being merged into a new snapshot. Not modified until the merge is done.
+    Delta frozen_delta_;
+    // Writes since the merge started, which it applies to the new snapshot before swapping it in.
+    std::vector<std::pair<K, IndexV>> merge_log_;
+    bool is_merging_ = false;
+    std::atomic<size_t> num_keys_ = 0;
+    std::shared_mutex lock_;
+};
+
+/** Ordered index that Viper maintains for `ViperConfig::enable_ordered_index`. */
+template <typename K>
+using OrderedIndex = std::conditional_t<std::is_same_v<K, std::string>, StringIndex, LearnedIndex<K>>;
+
+inline size_t StringIndex::Snapshot::partition_end(const size_t partition_num) const {
+    return partition_num + 1 < partitions.size() ? partitions[partition_num + 1].first_pos : size();
+}
+
+inline size_t StringIndex::Snapshot::segment_end(const size_t partition_num) const {
+    return partition_num + 1 < partitions.size() ? partitions[partition_num + 1].first_segment : segments.size();
+}
+
+inline size_t StringIndex::Snapshot::partition_of(const size_t pos) const {
+    const auto it = std::upper_bound(partitions.begin(), partitions.end(), pos,
+                                     [](const size_t p, const Partition& partition) { return p < partition.first_pos; });
+    return (it - partitions.begin()) - 1;
+}
+
+inline std::string_view StringIndex::Snapshot::tail(const size_t pos) const {
+    return std::string_view{tails}.substr(tail_offsets[pos], tail_offsets[pos + 1] - tail_offsets[pos]);
+}
+
+inline StringIndex::K StringIndex::Snapshot::key_at(const size_t pos, const size_t partition_num) const {
+    const std::string_view key_tail = tail(pos);
+    K key;
+    key.reserve(partitions[partition_num].prefix.size() + key_tail.size());
+    key.append(partitions[partition_num].prefix).append(key_tail);
+    return key;
+}
+
+inline size_t StringIndex::Snapshot::lower_bound(const K& key) const {
+    if (first_keys.empty()) return 0;
+
+    const auto part_it = std::upper_bound(first_keys.begin(), first_keys.end(), key);
+    if (part_it == first_keys.begin()) {
+        // Smaller than all keys.
+        return 0;
+    }
+
+    const size_t partition_num = (part_it - first_keys.begin()) - 1;
+    const Partition& partition = partitions[partition_num];
+    const size_t part_end = partition_end(partition_num);
+    const int prefix_cmp = key.compare(0, partition.prefix.size(), partition.prefix);
+    if (prefix_cmp != 0) {
+        // All keys in the partition start with the prefix.
+        return prefix_cmp < 0 ? partition.first_pos : part_end;
+    }
+
+    const uint64_t slice = load_slice(key, partition.prefix.size());
+    const auto seg_begin = segment_keys.begin() + partition.first_segment;
+    const auto seg_it = std::upper_bound(seg_begin, segment_keys.begin() + segment_end(partition_num), slice);
+    if (seg_it == seg_begin) {
+        return partition.first_pos;
+    }
+
+    const size_t seg_num = (seg_it - segment_keys.begin()) - 1;
+    const LinearSegment& segment = segments[seg_num];
+    const size_t seg_end = seg_num + 1 < segment_end(partition_num) ? segments[seg_num + 1].first_pos : part_end;
+    const double prediction = segment.predict(slice);
+
+    const double low = std::max(prediction - segment.error, static_cast<double>(segment.first_pos));
+    const double high = std::min(prediction + segment.error + 2, static_cast<double>(seg_end));
+    const size_t search_begin = std::min(static_cast<size_t>(low), seg_end);
+    const size_t search_end = std::max(static_cast<size_t>(high), search_begin);
+
+    const size_t pos = lower_bound_in_window(slices.data(), search_begin, search_end, slice);
+    if (pos == search_end || slices[pos] != slice) {
+        return pos;
+    }
+
+    // Keys with the same slice are ordered by their remaining bytes. Long runs share a prefix, so search them.
+    const std::string_view key_tail = std::string_view{key}.substr(partition.prefix.size());
+    size_t run_begin = pos;
+    size_t run_end = search_end;
+    while (run_begin < run_end) {
+        const size_t mid = run_begin + (run_end - run_begin) / 2;
+        if (slices[mid] == slice && tail(mid) < key_tail) {
+            run_begin = mid + 1;
+        } else {
+            run_end = mid;
+        }
+    }
+    return run_begin;
+}
+
+inline size_t StringIndex::Snapshot::find(const K& key) const {
+    const size_t pos = lower_bound(key);
+    if (pos < size()) {
+        const size_t partition_num = partition_of(pos);
+        const std::string& prefix = partitions[partition_num].prefix;
+        if (key.size() == prefix.size() + tail(pos).size() && key.compare(0, prefix.size(), prefix) == 0 &&
+            std::string_view{key}.substr(prefix.size()) == tail(pos)) {
+            return pos;
+        }
+    }
+    return size();
+}
+
+inline StringIndex::StringIndex(const size_t initial_capacity) : snapshot_{std::make_unique<Snapshot>()} {
+    snapshot_->offsets.reserve(initial_capacity);
+    snapshot_->tail_offsets.push_back(0);
+}
+
+inline IndexV StringIndex::Insert(const K& key, const IndexV value) {
+    // Inserting a tombstone removes the key.
+    const IndexV old_offset = value.is_tombstone() ? erase(key) : upsert(key, value);
+    if (value.is_tombstone() != old_offset.is_tombstone()) {
+        if (value.is_tombstone()) {
+            num_keys_.fetch_sub(1);
+        } else {
+            num_keys_.fetch_add(1);
+        }
+    }
+    return old_offset;
+}
+
+inline IndexV StringIndex::upsert(const K& key, const IndexV value) {
+    {
+        std::shared_lock lock{lock_};
+        const size_t pos = snapshot_->find(key);
+        if (!is_merging_ && pos < snapshot_->size()) {
+            // Existing key, update in place.
+            const offset_size_t old_offset = __atomic_exchange_n(&snapshot_->offsets[pos].offset,
+                                                                 value.offset, __ATOMIC_ACQ_REL);
+            return IndexV{old_offset};
+        }
+    }
+
+    IndexV old_offset;
+    bool should_merge = false;
+    {
+        std::unique_lock lock{lock_};
+        if (is_merging_) {
+            // The merge reads the snapshot, so it must not change. The delta shadows it until the merge is done.
+            old_offset = lookup(key);
+            log_merge_write(key, value);
+            return old_offset;
+        }
+
+        const size_t pos = snapshot_->find(key);
+        if (pos < snapshot_->size()) {
+            // Key was merged in the meantime.
+            old_offset = snapshot_->offsets[pos];
+            snapshot_->offsets[pos] = value;
+            return old_offset;
+        }
+
+        old_offset = IndexV::NONE();
+        auto [it, is_new] = delta_.try_emplace(key, value);
+        if (!is_new) {
+            old_offset = it->second;
+            it->second = value;
+        }
+        should_merge = freeze_delta();
+    }
+
+    if (should_merge) {
+        merge_delta();
+    }
+    return old_offset;
+}
+
+inline IndexV StringIndex::Get(const K& key) {
+    std::shared_lock lock{lock_};
+    return lookup(key);
+}
+
+inline IndexV StringIndex::lookup(const K& key) const {
+    // Caller holds the lock. While a merge runs, the delta has the latest value of all keys written since.
+    if (is_merging_) {
+        const auto it = delta_.find(key);
+        if (it != delta_.end()) {
+            return it->second;
+        }
+    }
+
+    const size_t pos = snapshot_->find(key);
+    if (pos < snapshot_->size()) {
+        return IndexV{ATOMIC_LOAD(&snapshot_->offsets[pos].offset)};
+    }
+
+    const Delta& delta = is_merging_ ? frozen_delta_ : delta_;
+    const auto it = delta.find(key);
+    if (it != delta.end()) {
+        return it->second;
+    }
+    return IndexV::NONE();
+}
+
+inline bool StringIndex::Delete(const K& key) {
+    return !Insert(key, IndexV::Tombstone()).is_tombstone();
+}
+
+inline IndexV StringIndex::erase(const K& key) {
+    {
+        std::shared_lock lock{lock_};
+        const size_t pos = snapshot_->find(key);
+        if (!is_merging_ && pos < snapshot_->size()) {
+            // Tombstone is removed on the next merge.
+            const offset_size_t old_offset = __atomic_exchange_n(&snapshot_->offsets[pos].offset,
+                                                                 IndexV::Tombstone().offset, __ATOMIC_ACQ_REL);
+            return IndexV{old_offset};
+        }
+    }
+
+    std::unique_lock lock{lock_};
+    if (is_merging_) {
+        const IndexV old_offset = lookup(key);
+        if (!old_offset.is_tombstone()) {
+            // The key may also be in the snapshot or the frozen delta, so the tombstone is needed until the merge.
+            log_merge_write(key, IndexV::Tombstone());
+        }
+        return old_offset;
+    }
+
+    const size_t pos = snapshot_->find(key);
+    if (pos < snapshot_->size()) {
+        const IndexV old_offset = snapshot_->offsets[pos];
+        snapshot_->offsets[pos] = IndexV::Tombstone();
+        return old_offset;
+    }
+
+    const auto it = delta_.find(key);
+    if (it == delta_.end()) {
+        return IndexV::NONE();
+    }
+    const IndexV old_offset = it->second;
+    delta_.erase(it);
+    return old_offset;
+}
+
+inline void StringIndex::BulkLoad(const std::vector<std::pair<K, IndexV>>& entries, const size_t num_threads) {
+    std::unique_lock lock{lock_};
+    if (snapshot_->size() > 0 || !delta_.empty() || is_merging_) {
+        throw std::runtime_error("Can only bulk load into an empty index.");
+    }
+    snapshot_ = build_snapshot(entries, num_threads);
+    num_keys_.store(entries.size());
+}
+
+inline size_t StringIndex::Size() {
+    return num_keys_.load();
+}
+
+template <typename ScanFn>
+size_t StringIndex::Scan(const K& start_key, const K& end_key, ScanFn scan_fn) {
+    std::vector<std::pair<K, IndexV>> batch;
+    batch.reserve(kScanBatchSize);
+
+    size_t num_visited = 0;
+    K next_key = start_key;
+    bool include_start = true;
+    bool has_more = true;
+    while (has_more) {
+        batch.clear();
+        has_more = collect_batch(next_key, include_start, end_key, &batch, &next_key);
+        include_start = false;
+        for (const auto& [key, offset] : batch) {
+            num_visited++;
+            if (!scan_fn(key, offset)) {
+                return num_visited;
+            }
+        }
+    }
+    return num_visited;
+}
+
+inline bool StringIndex::collect_batch(const K& start_key, const bool include_start, const K& end_key,
+                                       std::vector<std::pair<K, IndexV>>* batch, K* resume_key) {
+    std::shared_lock lock{lock_};
+    const Snapshot& snapshot = *snapshot_;
+    size_t snap_pos = snapshot.lower_bound(start_key);
+    size_t partition_num = snap_pos < snapshot.size() ? snapshot.partition_of(snap_pos) : 0;
+    K snap_key = snap_pos < snapshot.size() ? snapshot.key_at(snap_pos, partition_num) : K{};
+    auto delta_it = delta_.lower_bound(start_key);
+    const auto delta_end = delta_.end();
+    // Empty unless a merge is running.
+    auto frozen_it = frozen_delta_.lower_bound(start_key);
+    const auto frozen_end = frozen_delta_.end();
+
+    auto advance_snap = [&] {
+        snap_pos++;
+        if (snap_pos < snapshot.size()) {
+            if (snap_pos == snapshot.partition_end(partition_num)) partition_num++;
+            snap_key = snapshot.key_at(snap_pos, partition_num);
+        }
+    };
+
+    if (!include_start) {
+        if (snap_pos < snapshot.size() && snap_key == start_key) advance_snap();
+        if (delta_it != delta_end && delta_it->first == start_key) delta_it++;
+        if (frozen_it != frozen_end && frozen_it->first == start_key) frozen_it++;
+    }
+
+    // Tombstones count towards the batch size so that a batch is bounded in work, not in results.
+    for (size_t num_collected = 0; num_collected < kScanBatchSize; ++num_collected) {
+        const bool has_snap = snap_pos < snapshot.size();
+        const bool has_delta = delta_it != delta_end;
+        const bool has_frozen = frozen_it != frozen_end;
+        if (!has_snap && !has_delta && !has_frozen) return false;
+
+        const K* min_key = has_snap ? &snap_key : nullptr;
+        if (has_delta && (min_key == nullptr || delta_it->first < *min_key)) min_key = &delta_it->first;
+        if (has_frozen && (min_key == nullptr || frozen_it->first < *min_key)) min_key = &frozen_it->first;
+        const K key = *min_key;
+        if (end_key < key) return false;
+
+        // A key may be in several sources during a merge. The delta has the latest value, the frozen delta the oldest.
+        IndexV offset = IndexV::NONE();
+        bool is_found = false;
+        if (has_delta && delta_it->first == key) {
+            offset = delta_it->second;
+            is_found = true;
+            delta_it++;
+        }
+        if (has_snap && snap_key == key) {
+            if (!is_found) offset = IndexV{ATOMIC_LOAD(&snapshot.offsets[snap_pos].offset)};
+            is_found = true;
+            advance_snap();
+        }
+        if (has_frozen && frozen_it->first == key) {
+            if (!is_found) offset = frozen_it->second;
+            frozen_it++;
+        }
+
+        *resume_key = key;
+        if (!offset.is_tombstone()) {
+            batch->emplace_back(key, offset);
+        }
+    }
+    return true;
+}
+
+inline void StringIndex::log_merge_write(const K& key, const IndexV value) {
+    // Caller holds the exclusive lock.
+    delta_.insert_or_assign(key, value);
+    merge_log_.emplace_back(key, value);
+}
+
+inline bool StringIndex::freeze_delta() {
+    // Caller holds the exclusive lock.
+    if (is_merging_ || delta_.size() <= std::max(kMinDeltaSize, snapshot_->size() / kDeltaRatio)) {
+        return false;
+    }
+    is_merging_ = true;
+    frozen_delta_.swap(delta_);
+    return true;
+}
+
+inline void StringIndex::merge_delta() {
+    // Caller froze the delta and holds no lock. Only this thread replaces the snapshot, and nobody modifies it or
+    // the frozen delta until then.
+    const Snapshot& old_snapshot = *snapshot_;
+    std::vector<std::pair<K, IndexV>> entries;
+    entries.reserve(old_snapshot.size() + frozen_delta_.size());
+
+    size_t snap_pos = 0;
+    size_t partition_num = 0;
+    K snap_key = old_snapshot.size() > 0 ? old_snapshot.key_at(0, 0) : K{};
+    auto delta_it = frozen_delta_.begin();
+    while (snap_pos < old_snapshot.size() || delta_it != frozen_delta_.end()) {
+        const bool take_snap = snap_pos < old_snapshot.size() &&
+            (delta_it == frozen_delta_.end() || snap_key < delta_it->first);
+        if (take_snap) {
+            const IndexV offset = old_snapshot.offsets[snap_pos];
+            if (!offset.is_tombstone()) {
+                entries.emplace_back(std::move(snap_key), offset);
+            }
+            snap_pos++;
+            if (snap_pos < old_snapshot.size()) {
+                if (snap_pos == old_snapshot.partition_end(partition_num)) partition_num++;
+                snap_key = old_snapshot.key_at(snap_pos, partition_num);
+            }
+        } else {
+            entries.emplace_back(delta_it->first, delta_it->second);
+            delta_it++;
+        }
+    }
+
+    std::unique_ptr<Snapshot> new_snapshot = build_snapshot(entries, 1);
+    entries = {};
+
+    // Replays the writes made since the merge started. Writes to merged keys go to the new snapshot, so that the
+    // new delta only holds new keys again.
+    Delta new_delta;
+    auto replay = [&](const std::vector<std::pair<K, IndexV>>& writes) {
+        for (const auto& [key, offset] : writes) {
+            const size_t pos = new_snapshot->find(key);
+            if (pos < new_snapshot->size()) {
+                new_snapshot->offsets[pos] = offset;
+            } else if (offset.is_tombstone()) {
+                new_delta.erase(key);
+            } else {
+                new_delta.insert_or_assign(key, offset);
+            }
+        }
+    };
+
+    // Most writes are replayed without the lock. Only the last few are replayed while the snapshot is swapped.
+    std::vector<std::pair<K, IndexV>> writes;
+    Delta merged_delta;
+    while (true) {
+        {
+            std::unique_lock lock{lock_};
+            if (merge_log_.size() <= kMaxSwapWrites) {
+                replay(merge_log_);
+                merge_log_.clear();
+                // The old snapshot and deltas are freed below, after the lock is released.
+                std::swap(snapshot_, new_snapshot);
+                delta_.swap(new_delta);
+                merged_delta.swap(frozen_delta_);
+                is_merging_ = false;
+                break;
+            }
+            writes.swap(merge_log_);
+        }
+        replay(writes);
+        writes.clear();
+    }
+}
+
+inline std::unique_ptr<StringIndex::Snapshot> StringIndex::build_snapshot(
+        const std::vector<std::pair<K, IndexV>>& entries, size_t num_threads) {
+    auto snapshot = std::make_unique<Snapshot>();
+    const size_t num_keys = entries.size();
+    snapshot->slices.reserve(num_keys);
+    snapshot->offsets.reserve(num_keys);
+    snapshot->tail_offsets.reserve(num_keys + 1);
+    snapshot->tail_offsets.push_back(0);
+
+    size_t part_start = 0;
+    while (part_start < num_keys) {
+        size_t part_end = std::min(part_start + kMaxPartitionSize, num_keys);
+        if (part_end < num_keys) {
+            // End the partition where adjacent keys share the shortest prefix, but keep it at least half full.
+            size_t min_common_length = common_prefix_length(entries[part_end - 1].first, entries[part_end].first);
+            for (size_t pos = part_end - 1; pos > part_start + (kMaxPartitionSize / 2); --pos) {
+                const size_t common_length = common_prefix_length(entries[pos - 1].first, entries[pos].first);
+                if (common_length < min_common_length) {
+                    min_common_length = common_length;
+                    part_end = pos;
+                }
+            }
+        }
+
+        const K& first_key = entries[part_start].first;
+        const size_t prefix_length = common_prefix_length(first_key, entries[part_end - 1].first);
+        snapshot->partitions.push_back({first_key.substr(0, prefix_length), part_start, 0});
+        snapshot->first_keys.push_back(first_key);
+        for (size_t pos = part_start; pos < part_end; ++pos) {
+            const K& key = entries[pos].first;
+            snapshot->slices.push_back(load_slice(key, prefix_length));
+            snapshot->tails.append(key, prefix_length);
+            snapshot->tail_offsets.push_back(snapshot->tails.size());
+            snapshot->offsets.push_back(entries[pos].second);
+        }
+        part_start = part_end;
+    }
+
+    // Fit the segments of each partition, with each thread handling a contiguous range of partitions.
+    const size_t num_partitions = snapshot->partitions.size();
+    num_threads = std::max(1ul, std::min(num_threads, num_partitions / kMinPartitionsPerFitThread));
+    std::vector<std::vector<LinearSegment>> thread_segments(num_threads);
+    std::vector<std::vector<size_t>> thread_first_segments(num_threads);
+    auto fit = [&](const size_t thread_num) {
+        const size_t first_partition = (thread_num * num_partitions) / num_threads;
+        const size_t last_partition = ((thread_num + 1) * num_partitions) / num_threads;
+        for (size_t partition_num = first_partition; partition_num < last_partition; ++partition_num) {
+            thread_first_segments[thread_num].push_back(thread_segments[thread_num].size());
+            fit_segments(snapshot->slices, snapshot->partitions[partition_num].first_pos,
+                         snapshot->partition_end(partition_num), kEpsilon, &thread_segments[thread_num]);
+        }
+    };
+
+    if (num_threads == 1) {
+        fit(0);
+    } else {
+        std::vector<std::thread> fit_threads;
+        fit_threads.reserve(num_threads);
+        for (size_t thread_num = 0; thread_num < num_threads; ++thread_num) {
+            fit_threads.emplace_back(fit, thread_num);
+        }
+        for (std::thread& thread : fit_threads) {
+            thread.join();
+        }
+    }
+
+    size_t partition_num = 0;
+    for (size_t thread_num = 0; thread_num < num_threads; ++thread_num) {
+        const size_t segment_base = snapshot->segments.size();
+        for (const size_t first_segment : thread_first_segments[thread_num]) {
+            snapshot->partitions[partition_num++].first_segment = segment_base + first_segment;
+        }
+        snapshot->segments.insert(snapshot->segments.end(), thread_segments[thread_num].begin(),
+                                  thread_segments[thread_num].end());
+    }
+
+    snapshot->segment_keys.reserve(snapshot->segments.size());
+    for (const LinearSegment& segment : snapshot->segments) {
+        snapshot->segment_keys.push_back(segment.first_key);
+    }
+    return snapshot;
+}
+
+}  // namespace viper::learned
@@ -12,9 +12,13 @@
 #include <atomic>
 #include <assert.h>
 #include <filesystem>
+#include <mutex>
 #include <immintrin.h>
 
 #include "cceh.hpp"
+#include "numa.hpp"
+#include "learned_index.hpp"
+#include "string_index.hpp"
 #include "concurrentqueue.h"
 
 #ifndef NDEBUG
@@ -55,6 +59,7 @@ static constexpr version_lock_t UNLOCKED_BIT  = 0b11111110;
 static constexpr auto VIPER_MAP_PROT = PROT_WRITE | PROT_READ;
 static constexpr auto VIPER_MAP_FLAGS = MAP_SHARED_VALIDATE | MAP_SYNC;
 static constexpr auto VIPER_DRAM_MAP_FLAGS = MAP_ANONYMOUS | MAP_PRIVATE;
+static constexpr uint64_t VIPER_CHECKPOINT_MAGIC = 0x5649504552434b50; // "VIPERCKP"
 static constexpr auto VIPER_FILE_OPEN_FLAGS = O_CREAT | O_RDWR | O_DIRECT;
 
 struct ViperConfig {
@@ -65,6 +70,33 @@ struct ViperConfig {
     size_t dax_alignment = ONE_GB;
     size_t fs_alignment = ONE_GB;
     bool enable_reclamation = false;
+    bool enable_ordered_index = false;
+    bool enable_bulk_recovery = false;
+    bool enable_learned_hash = false;
+    bool enable_checkpoint = false;
+    /** Number of keys the index is sized for on creation. On open, the number of recovered slots is used if larger. */
+    size_t expected_num_keys = 0;
+    /** Number of removes after which a background thread shrinks the index, if it supports `Shrink`. 0 disables it. */
+    size_t index_shrink_threshold = 1'000'000;
+    /** Keeps one free block queue per NUMA node. Clients reuse blocks of their own node before those of other nodes. */
+    bool enable_numa_blocks = false;
+    /**
+     * Allocates the CCEH index from an `index` file in the pool directory. After a clean close, `open` uses this index
+     * as is instead of recovering it from the records. Requires CCEH and a file-based pool.
+     */
+    bool enable_persistent_index = false;
+};
+
+/**
+ * Statistics of a Viper instance. All values are maintained incrementally, so reading them does not scan the index
+ * or the records. `num_records` includes the changes of each client up to its last sync.
+ */
+struct ViperStats {
+    size_t num_records = 0;
+    size_t used_pmem_bytes = 0;
+    size_t allocated_pmem_bytes = 0;
+    // All zero if the index does not provide `GetStats()`.
+    cceh::IndexStats index{};
 };
 
 namespace internal {
@@ -112,6 +144,28 @@ inline void pmem_memcpy_persist(void* dest, const void* src, const size_t len) {
     pmem_persist(dest, len);
 }
 
+inline bool read_fully(const int fd, void* data, size_t len) {
+    char* data_ptr = static_cast<char*>(data);
+    while (len > 0) {
+        const ssize_t num_read = ::read(fd, data_ptr, len);
+        if (num_read <= 0) return false;
+        data_ptr += num_read;
+        len -= num_read;
+    }
+    return true;
+}
+
+inline bool write_fully(const int fd, const void* data, size_t len) {
+    const char* data_ptr = static_cast<const char*>(data);
+    while (len > 0) {
+        const ssize_t num_written = ::write(fd, data_ptr, len);
+        if (num_written <= 0) return false;
+        data_ptr += num_written;
+        len -= num_written;
+    }
+    return true;
+}
+
 struct VarSizeEntry {
     union {
         uint32_t size_info;
@@ -260,6 +314,43 @@ struct alignas(PAGE_SIZE) ViperPageBlock {
     }
 };
 
+/** True if `IndexT` provides the optional batched lookup `MultiGet(keys, num_keys, offsets, key_check_fn)`. */
+template <typename IndexT, typename K, typename = void>
+struct HasMultiGet : std::false_type {};
+
+template <typename IndexT, typename K>
+struct HasMultiGet<IndexT, K, std::void_t<decltype(std::declval<IndexT&>().MultiGet(
+        std::declval<const K*>(), size_t{}, std::declval<KeyValueOffset*>(),
+        std::declval<bool (*)(const K&, KeyValueOffset)>()))>> : std::true_type {};
+
+/** True if `IndexT` provides the optional `Shrink()`, which releases memory after many deletes. */
+template <typename IndexT, typename = void>
+struct HasShrink : std::false_type {};
+
+template <typename IndexT>
+struct HasShrink<IndexT, std::void_t<decltype(std::declval<IndexT&>().Shrink())>> : std::true_type {};
+
+/** True if `IndexT` is created with a number of segments, which `IndexT::NumSegmentsFor(num_keys)` returns. */
+template <typename IndexT, typename = void>
+struct IsSizedInSegments : std::false_type {};
+
+template <typename IndexT>
+struct IsSizedInSegments<IndexT, std::void_t<decltype(IndexT::NumSegmentsFor(size_t{}))>> : std::true_type {};
+
+/** True if `IndexT` provides the optional `GetStats()`, which returns its cceh::IndexStats. */
+template <typename IndexT, typename = void>
+struct HasStats : std::false_type {};
+
+template <typename IndexT>
+struct HasStats<IndexT, std::void_t<decltype(std::declval<const IndexT&>().GetStats())>> : std::true_type {};
+
+/** True if `IndexT` is CCEH with any hash policy or key mode, which can use a learned hash. */
+template <typename IndexT>
+struct IsCCEH : std::false_type {};
+
+template <typename K, typename HashPolicy, bool kInlineKeys>
+struct IsCCEH<cceh::CCEH<K, HashPolicy, kInlineKeys>> : std::true_type {};
+
 } // namespace internal
 
 struct ViperFileMetadata {
@@ -269,6 +360,18 @@ struct ViperFileMetadata {
     std::atomic<block_size_t> num_used_blocks;
     block_size_t num_allocated_blocks;
     size_t total_mapped_size;
+    /** A valid checkpoint contains all records, except for those in blocks >= the watermark. */
+    bool is_checkpoint_valid;
+    block_size_t checkpoint_block_watermark;
+    /** The index file holds the index of all records. Cleared on open and set on a clean close. */
+    bool is_index_valid;
+};
+
+struct ViperCheckpointHeader {
+    uint64_t magic;
+    uint64_t key_size;
+    uint64_t num_entries;
+    uint64_t num_segments;
 };
 
 struct ViperFileMapping {
@@ -326,9 +429,37 @@ struct ValueAccessor<std::string> {
     static const_ptr_type to_ptr_type(const type& x) { return &x; }
 };
 
-template <typename K, typename V>
+/**
+ * Viper stores all records in PMem and keeps a volatile index `IndexT` that maps keys to their KeyValueOffset.
+ * By default, this is a CCEH hash index. Any other index needs to provide the following interface.
+ * `key_check_fn(key, offset)` compares `key` with the key of the record at `offset` in PMem. Indexes that do
+ * not store full keys (e.g., fingerprints) call it to resolve collisions; indexes with full keys can ignore it.
+ * `key_check_fn.stored_key(offset)` returns the bytes of the key at `offset`, e.g., to rehash it.
+ *
+ *   static constexpr bool kIsOrdered;    True if the index supports `Scan`. Viper then uses it for range scans.
+ *   IndexT(size_t initial_capacity);
+ *   IndexV Insert(const K& key, IndexV offset, KeyCheckFn key_check_fn);
+ *          Inserts or updates `key` and returns the old offset or a tombstone if `key` was not present.
+ *   IndexV Get(const K& key, KeyCheckFn key_check_fn);
+ *          Returns the offset of `key` or a tombstone if `key` is not present.
+ *   bool Delete(const K& key, KeyCheckFn key_check_fn);
+ *          Removes `key` (equivalent to inserting a tombstone) and returns true if it was present.
+ *   void BulkLoad(const std::vector<std::pair<K, IndexV>>& entries, KeyCheckFn key_check_fn, size_t num_threads);
+ *          Builds the index from unique entries that are sorted by `learned::KeyTraits<K>::less`
+ *          with up to `num_threads` threads. Used for recovery with `ViperConfig::enable_bulk_recovery`.
+ *   size_t Scan(const K& start_key, const K& end_key, ScanFn scan_fn);
+ *          Only if ordered. Calls `scan_fn(key, offset)` in key order for all keys in [start_key, end_key].
+ *   void MultiGet(const K* keys, size_t num_keys, IndexV* offsets, KeyCheckFn key_check_fn);
+ *          Optional. Writes the result of `Get` for each key to `offsets`. Used by `multi_get` if present.
+ *   size_t Shrink();
+ *          Optional. Releases memory of deleted keys. Called in the background after
+ *          `ViperConfig::index_shrink_threshold` removes.
+ *
+ * All methods must be safe to call concurrently.
+ */
+template <typename K, typename V, typename IndexT = cceh::CCEH<K>>
 class Viper {
-    using ViperT = Viper<K, V>;
+    using ViperT = Viper<K, V, IndexT>;
     using VPage = internal::ViperPage<K, V>;
     using KVOffset = KeyValueOffset;
     static constexpr uint64_t v_page_size = sizeof(VPage);
@@ -337,29 +468,59 @@ class Viper {
     using VPageBlock = internal::ViperPageBlock<VPage, num_pages_per_block>;
 
   public:
-    static std::unique_ptr<Viper<K, V>> create(const std::string& pool_file, uint64_t initial_pool_size,
+    static std::unique_ptr<Viper<K, V, IndexT>> create(const std::string& pool_file, uint64_t initial_pool_size,
                                                             ViperConfig v_config = ViperConfig{});
-    static std::unique_ptr<Viper<K, V>> open(const std::string& pool_file, ViperConfig v_config = ViperConfig{});
+    static std::unique_ptr<Viper<K, V, IndexT>> open(const std::string& pool_file, ViperConfig v_config = ViperConfig{});
     Viper(ViperBase v_base, std::filesystem::path pool_dir, bool owns_pool, ViperConfig v_config);
     ~Viper();
 
     void reclaim();
 
+    /**
+     * Writes the learned index into a checkpoint file next to the pool's meta file. On open, the index is restored
+     * from it and only blocks written since the checkpoint are recovered. Requires a file-based pool, fixed-size
+     * keys, and a learned index (as `IndexT` or via `enable_ordered_index`). Returns false if this is not the case.
+     * Removing a key invalidates the checkpoint. Called on close if `enable_checkpoint` is set.
+     */
+    bool checkpoint();
+
+    class Iterator;
+
     class ReadOnlyClient {
-        friend class Viper<K, V>;
+        friend class Viper<K, V, IndexT>;
+        friend class Iterator;
       public:
+        static constexpr size_t multi_get_batch_size = 64;
+
         bool get(const K& key, V* value) const;
+
+        size_t multi_get(const K* keys, size_t num_keys, V* values, bool* found) const;
+
+        template <typename ScanFn>
+        size_t scan(const K& start_key, const K& end_key, ScanFn scan_fn) const;
+
+        template <typename ScanFn>
+        size_t scan_prefix(const K& prefix, ScanFn scan_fn) const;
+
+        Iterator get_iterator() const;
+        Iterator get_iterator(const K& upper_bound) const;
+
         size_t get_total_used_pmem() const;
         size_t get_total_allocated_pmem() const;
+        ViperStats get_stats() const;
       protected:
         explicit ReadOnlyClient(ViperT& viper);
         inline const std::pair<typename KeyAccessor<K>::checker_type, typename ValueAccessor<V>::checker_type> get_const_entry_from_offset(KVOffset offset) const;
         inline bool get_const_value_from_offset(KVOffset offset, V* value) const;
+        inline bool get_const_value_for_key(const K& key, KVOffset offset, V* value) const;
+        inline void prefetch_record(KVOffset offset) const;
+        template <typename ScanFn>
+        void scan_index(const K& start_key, const K& end_key, ScanFn scan_fn) const;
         ViperT& viper_;
     };
 
     class Client : public ReadOnlyClient {
-        friend class Viper<K, V>;
+        friend class Viper<K, V, IndexT>;
       public:
         bool put(const K& key, const V& value);
 
@@ -377,11 +538,15 @@ class Viper {
         Client(ViperT& viper);
 
         bool put(const K& key, const V& value, bool delete_old);
+        bool put_fixed_size(const K& key, const V& value, bool delete_old);
+        bool put_var_size(const K& key, const V& value, bool delete_old);
         inline void update_access_information();
         inline void update_var_size_page_information();
         inline bool get_value_from_offset(KVOffset offset, V* value);
+        inline bool get_fixed_size_value_from_offset(KVOffset offset, V* value);
+        inline bool get_var_size_value_from_offset(KVOffset offset, V* value);
         inline void info_sync(bool force = false);
-        void free_occupied_slot(const KVOffset offset_to_delete, const K& key, const bool delete_offset = false);
+        void free_occupied_slot(const KVOffset offset_to_delete);
         void invalidate_record(VPage* v_page, const data_offset_size_t data_offset);
 
         enum PageStrategy : uint8_t { BlockBased, DimmBased };
@@ -399,18 +564,61 @@ class Viper {
 
         // Block-based
         page_size_t num_v_pages_processed_;
+        // NUMA node whose free blocks are used first.
+        size_t numa_node_;
 
         uint16_t op_count_;
         size_t num_reclaimable_ops_;
         int size_delta_;
     };
 
+    /**
+     * Iterates over the records in key order. Offsets are read from the ordered index `batch_size` keys at a time
+     * and the records of the next `prefetch_distance` keys are prefetched, so that PMem reads overlap.
+     * Like `scan`, this requires an ordered index and is not a snapshot.
+     */
+    class Iterator {
+        friend class ReadOnlyClient;
+      public:
+        static constexpr size_t batch_size = 64;
+        static constexpr size_t prefetch_distance = 8;
+
+        /** Positions the iterator at the first record with a key >= `key`. */
+        void seek(const K& key);
+        void next();
+        bool valid() const;
+        const K& key() const;
+        const V& value() const;
+
+      protected:
+        Iterator(const ReadOnlyClient& client, const K& upper_bound);
+        void fill_batch(const K& start_key, bool include_start);
+        void read_record();
+        inline void prefetch_record(size_t batch_pos) const;
+
+        const ReadOnlyClient client_;
+        const K upper_bound_;
+        std::vector<std::pair<K, KVOffset>> batch_;
+        size_t batch_pos_;
+        bool has_more_batches_;
+        bool is_valid_;
+        K key_;
+        V value_;
+    };
+
     Client get_client();
     ReadOnlyClient get_read_only_client();
 
   protected:
+    static constexpr size_t default_index_capacity = 131072;
+
     static ViperBase init_pool(const std::string& pool_file, uint64_t pool_size,
                                bool is_new_pool, ViperConfig v_config);
+    static size_t get_initial_index_capacity(const ViperBase& v_base, const ViperConfig& v_config);
+    static std::unique_ptr<PersistentArena> open_index_arena(const ViperBase& v_base,
+                                                                   const std::filesystem::path& pool_dir,
+                                                                   const ViperConfig& v_config);
+    static IndexT make_index(const ViperBase& v_base, const ViperConfig& v_config, PersistentArena* index_arena);
 
     void get_new_access_information(Client* client);
     void get_block_based_access(Client* client);
@@ -421,26 +629,57 @@ class Viper {
     ViperFileMapping allocate_v_page_blocks();
     void add_v_page_blocks(ViperFileMapping mapping);
     void recover_database();
+    void recover_fixed_size_database();
+    learned::LearnedIndex<K>* get_checkpoint_index();
+    bool load_checkpoint();
+    void invalidate_checkpoint();
+    void lower_checkpoint_watermark(block_size_t block_number);
     void trigger_resize();
     void trigger_reclaim(size_t num_reclaim_ops);
+    void trigger_index_shrink();
+    size_t get_block_node(block_size_t block_number);
+    void reclaim_fixed_size();
+    void reclaim_var_size();
     void compact(Client& client, VPageBlock* v_block);
+    void compact_fixed_size(Client& client, VPageBlock* v_block);
+    void compact_var_size(Client& client, VPageBlock* v_block);
 
     bool check_key_equality(const K& key, const KVOffset offset_to_compare);
+    std::string_view get_stored_key(KVOffset offset);
+
+    /**
+     * Key check for indexes that do not store full keys, e.g., fingerprints in CCEH. Compares the record in PMem.
+     * `stored_key(offset)` returns the raw bytes of the record's key for indexes that need to rehash it.
+     */
+    struct RecordKeyCheck {
+        ViperT* viper;
+        bool operator()(const K& key, const KVOffset offset) const { return viper->check_key_equality(key, offset); }
+        std::string_view stored_key(const KVOffset offset) const { return viper->get_stored_key(offset); }
+    };
+
+    inline RecordKeyCheck get_key_check_fn() {
+        return RecordKeyCheck{this};
+    }
 
     ViperBase v_base_;
     const bool owns_pool_;
     ViperConfig v_config_;
     std::filesystem::path pool_dir_;
 
-    cceh::CCEH<K> map_;
+    // Declared before the index, which allocates from it.
+    std::unique_ptr<PersistentArena> index_arena_;
+    IndexT map_;
     static constexpr bool using_fp = requires_fingerprint(K);
+    static constexpr bool is_ordered_map = IndexT::kIsOrdered;
+    std::unique_ptr<learned::OrderedIndex<K>> ordered_index_;
 
     std::vector<VPageBlock*> v_blocks_;
     std::atomic<size_t> num_v_blocks_;
     std::atomic<size_t> current_size_;
     std::atomic<size_t> reclaimable_ops_;
     std::atomic<offset_size_t> current_block_page_;
-    moodycamel::ConcurrentQueue<block_size_t> free_blocks_;
+    // One queue per NUMA node with `enable_numa_blocks`, else one.
+    std::vector<moodycamel::ConcurrentQueue<block_size_t>> free_blocks_;
 
     const double resize_threshold_;
     std::atomic<bool> is_resizing_;
@@ -451,28 +690,38 @@ class Viper {
     std::atomic<bool> is_reclaiming_;
     std::unique_ptr<std::thread> reclaim_thread_;
 
+    std::atomic<size_t> index_removes_;
+    std::atomic<bool> is_shrinking_index_;
+
     std::atomic<bool> deadlock_offset_lock_;
     std::vector<KVOffset> deadlock_offsets_;
 
     std::atomic<uint8_t> num_active_clients_;
     const uint8_t num_recovery_threads_;
+
+    enum CheckpointState : uint8_t { NoCheckpoint, CheckpointInProgress, CheckpointValid };
+    std::atomic<CheckpointState> checkpoint_state_;
+    std::mutex checkpoint_lock_;
+    block_size_t pending_checkpoint_watermark_;
 };
 
-template <typename K, typename V>
-std::unique_ptr<Viper<K, V>> Viper<K, V>::create(const std::string& pool_file, uint64_t initial_pool_size,
+template <typename K, typename V, typename IndexT>
+std::unique_ptr<Viper<K, V, IndexT>> Viper<K, V, IndexT>::create(const std::string& pool_file, uint64_t initial_pool_size,
                                                  ViperConfig v_config) {
-    return std::make_unique<Viper<K, V>>(
+    return std::make_unique<Viper<K, V, IndexT>>(
             init_pool(pool_file, initial_pool_size, true, v_config), pool_file, true, v_config);
 }
 
-template <typename K, typename V>
-std::unique_ptr<Viper<K, V>> Viper<K, V>::open(const std::string& pool_file, ViperConfig v_config) {
-    return std::make_unique<Viper<K, V>>(init_pool(pool_file, 0, false, v_config), pool_file, true, v_config);
+template <typename K, typename V, typename IndexT>
+std::unique_ptr<Viper<K, V, IndexT>> Viper<K, V, IndexT>::open(const std::string& pool_file, ViperConfig v_config) {
+    return std::make_unique<Viper<K, V, IndexT>>(init_pool(pool_file, 0, false, v_config), pool_file, true, v_config);
 }
 
-template <typename K, typename V>
-Viper<K, V>::Viper(ViperBase v_base, const std::filesystem::path pool_dir, const bool owns_pool, const ViperConfig v_config) :
-    v_base_{v_base}, map_{131072}, owns_pool_{owns_pool}, v_config_{v_config}, pool_dir_{pool_dir},
+template <typename K, typename V, typename IndexT>
+Viper<K, V, IndexT>::Viper(ViperBase v_base, const std::filesystem::path pool_dir, const bool owns_pool, const ViperConfig v_config) :
+    v_base_{v_base}, index_arena_{open_index_arena(v_base, pool_dir, v_config)},
+    map_{make_index(v_base, v_config, index_arena_.get())}, owns_pool_{owns_pool}, v_config_{v_config}, pool_dir_{pool_dir},
+    free_blocks_(v_config.enable_numa_blocks ? numa::NumNodes() : 1),
     resize_threshold_{v_config.resize_threshold}, reclaim_threshold_{v_config.reclaim_threshold},
     num_recovery_threads_{v_config.num_recovery_threads} {
     current_block_page_ = 0;
@@ -480,11 +729,18 @@ Viper<K, V>::Viper(ViperBase v_base, const std::filesystem::path pool_dir, const
     reclaimable_ops_ = 0;
     is_resizing_ = false;
     is_reclaiming_ = false;
+    index_removes_ = 0;
+    is_shrinking_index_ = false;
     num_active_clients_ = 0;
     deadlock_offset_lock_ = false;
+    checkpoint_state_ = NoCheckpoint;
 
     std::srand(std::time(nullptr));
 
+    if (v_config_.enable_ordered_index && !is_ordered_map) {
+        ordered_index_ = std::make_unique<learned::OrderedIndex<K>>();
+    }
+
     if (v_base_.v_mappings.empty()) {
         throw new std::runtime_error("Need to have at least one memory section mapped.");
     }
@@ -493,15 +749,114 @@ Viper<K, V>::Viper(ViperBase v_base, const std::filesystem::path pool_dir, const
         add_v_page_blocks(mapping);
     }
 
-    if (!v_base_.is_new_db) {
+    if (v_base_.v_metadata->is_index_valid) {
+        // The index file does not match the records anymore once they are modified.
+        v_base_.v_metadata->is_index_valid = false;
+        internal::pmem_persist(v_base_.v_metadata, sizeof(ViperFileMetadata));
+    }
+
+    bool is_index_recovered = false;
+    if constexpr (internal::IsCCEH<IndexT>::value) {
+        if (map_.IsRecovered()) {
+            // The index holds all records, so they do not need to be scanned.
+            current_size_ = map_.GetStats().num_keys;
+            is_index_recovered = true;
+            DEBUG_LOG("Opened persistent index with " << current_size_.load() << " keys.");
+        }
+    }
+    if (!v_base_.is_new_db && !is_index_recovered) {
         DEBUG_LOG("Recovering existing database.");
         recover_database();
     }
     current_block_page_ = KVOffset{v_base.v_metadata->num_used_blocks.load(LOAD_ORDER), 0, 0}.offset;
+
+    if (checkpoint_state_.load(LOAD_ORDER) != CheckpointValid && v_base_.v_metadata->is_checkpoint_valid) {
+        // The checkpoint was not used, so it will not be kept up to date either.
+        v_base_.v_metadata->is_checkpoint_valid = false;
+        internal::pmem_persist(v_base_.v_metadata, sizeof(ViperFileMetadata));
+    }
 }
 
-template <typename K, typename V>
-Viper<K, V>::~Viper() {
+/**
+ * Returns the capacity the index is created with. This is the number of segments for CCEH (and CompactCCEH) and the
+ * number of keys for other indexes. Without `expected_num_keys` and recovered records, the default capacity is used.
+ */
+template <typename K, typename V, typename IndexT>
+size_t Viper<K, V, IndexT>::get_initial_index_capacity(const ViperBase& v_base, const ViperConfig& v_config) {
+    size_t num_keys = v_config.expected_num_keys;
+    if constexpr (!std::is_same_v<K, std::string>) {
+        if (!v_base.is_new_db) {
+            // Upper bound, as some slots may be free or hold outdated records.
+            const size_t num_recovered_slots =
+                v_base.v_metadata->num_used_blocks.load(LOAD_ORDER) * num_pages_per_block * VPage::num_slots_per_page;
+            num_keys = std::max(num_keys, num_recovered_slots);
+        }
+    }
+
+    if (num_keys == 0) {
+        return default_index_capacity;
+    }
+    if constexpr (internal::IsSizedInSegments<IndexT>::value) {
+        return IndexT::NumSegmentsFor(num_keys);
+    } else {
+        return num_keys;
+    }
+}
+
+/**
+ * Returns the arena of the persistent index, or nullptr if it is disabled. Its content is discarded unless the pool
+ * was closed cleanly with it. With the ordered index, the records are recovered anyway, so it is discarded, too.
+ */
+template <typename K, typename V, typename IndexT>
+std::unique_ptr<PersistentArena> Viper<K, V, IndexT>::open_index_arena(const ViperBase& v_base,
+                                                                             const std::filesystem::path& pool_dir,
+                                                                             const ViperConfig& v_config) {
+    if (!v_config.enable_persistent_index) {
+        return nullptr;
+    }
+    if (!internal::IsCCEH<IndexT>::value || !v_base.is_file_based) {
+        throw std::runtime_error("The persistent index requires CCEH and a file-based pool.");
+    }
+    const bool is_index_valid = !v_base.is_new_db && v_base.v_metadata->is_index_valid &&
+                                !v_config.enable_ordered_index;
+    auto index_arena = PersistentArena::Open(pool_dir / "index", !is_index_valid);
+    if (index_arena == nullptr) {
+        DEBUG_LOG("No address range for the persistent index is free. Using a volatile index.");
+    }
+    return index_arena;
+}
+
+template <typename K, typename V, typename IndexT>
+IndexT Viper<K, V, IndexT>::make_index(const ViperBase& v_base, const ViperConfig& v_config,
+                                       PersistentArena* index_arena) {
+    const size_t capacity = get_initial_index_capacity(v_base, v_config);
+    if constexpr (internal::IsCCEH<IndexT>::value) {
+        if (index_arena != nullptr) {
+            return IndexT{capacity, index_arena};
+        }
+    }
+    return IndexT{capacity};
+}
+
+template <typename K, typename V, typename IndexT>
+Viper<K, V, IndexT>::~Viper() {
+    while (is_shrinking_index_.load()) {
+        // The shrink thread still accesses the index.
+        std::this_thread::yield();
+    }
+
+    if (v_config_.enable_checkpoint) {
+        checkpoint();
+    }
+
+    if constexpr (internal::IsCCEH<IndexT>::value) {
+        if (index_arena_ != nullptr) {
+            map_.Persist();
+            v_base_.v_metadata->is_index_valid = true;
+            internal::pmem_persist(v_base_.v_metadata, sizeof(ViperFileMetadata));
+        }
+    }
+
     if (owns_pool_) {
         DEBUG_LOG("Closing pool file.");
         munmap(v_base_.v_metadata, v_base_.v_metadata->block_offset);
@@ -525,7 +880,9 @@ ViperInitData init_dram_pool(uint64_t pool_size, ViperConfig v_config, const siz
 
     ViperFileMetadata v_metadata{ .block_offset = PAGE_SIZE, .block_size = block_size,
                                   .alloc_size = alloc_size, .num_used_blocks = 0,
-                                  .num_allocated_blocks = 0, .total_mapped_size = pool_size };
+                                  .num_allocated_blocks = 0, .total_mapped_size = pool_size,
+                                  .is_checkpoint_valid = false, .checkpoint_block_watermark = 0,
+                                  .is_index_valid = false };
 
     ViperFileMetadata* metadata = static_cast<ViperFileMetadata*>(pmem_addr);
     memcpy(metadata, &v_metadata, sizeof(v_metadata));
@@ -596,7 +953,9 @@ ViperInitData init_devdax_pool(const std::string& pool_file, uint64_t pool_size,
     if (is_new_pool) {
         ViperFileMetadata v_metadata{ .block_offset = PAGE_SIZE, .block_size = block_size,
                                       .alloc_size = alloc_size, .num_used_blocks = 0,
-                                      .num_allocated_blocks = 0, .total_mapped_size = pool_size};
+                                      .num_allocated_blocks = 0, .total_mapped_size = pool_size,
+                                      .is_checkpoint_valid = false, .checkpoint_block_watermark = 0,
+                                      .is_index_valid = false };
         internal::pmem_memcpy_persist(pmem_addr, &v_metadata, sizeof(v_metadata));
     }
     ViperFileMetadata* metadata = static_cast<ViperFileMetadata*>(pmem_addr);
@@ -697,7 +1056,8 @@ ViperInitData init_file_pool(const std::string& pool_dir, uint64_t pool_size,
         MMAP_CHECK(metadata_addr)
         ViperFileMetadata v_metadata{ .block_offset = PAGE_SIZE, .block_size = block_size,
                 .alloc_size = alloc_size, .num_used_blocks = 0,
-                .num_allocated_blocks = num_allocated_blocks, .total_mapped_size = pool_size};
+                .num_allocated_blocks = num_allocated_blocks, .total_mapped_size = pool_size,
+                .is_checkpoint_valid = false, .checkpoint_block_watermark = 0, .is_index_valid = false};
         internal::pmem_memcpy_persist(metadata_addr, &v_metadata, sizeof(v_metadata));
         metadata = static_cast<ViperFileMetadata*>(metadata_addr);
     }
@@ -705,8 +1065,8 @@ ViperInitData init_file_pool(const std::string& pool_dir, uint64_t pool_size,
     return ViperInitData{ .fd = -1, .meta = metadata, .mappings = std::move(mappings) };
 }
 
-template <typename K, typename V>
-ViperBase Viper<K, V>::init_pool(const std::string& pool_file, uint64_t pool_size,
+template <typename K, typename V, typename IndexT>
+ViperBase Viper<K, V, IndexT>::init_pool(const std::string& pool_file, uint64_t pool_size,
                                  bool is_new_pool, ViperConfig v_config) {
     constexpr size_t block_size = sizeof(VPageBlock);
     ViperInitData init_data;
@@ -733,8 +1093,8 @@ ViperBase Viper<K, V>::init_pool(const std::string& pool_file, uint64_t pool_siz
                       .v_mappings = std::move(init_data.mappings) };
 }
 
-template <typename K, typename V>
-ViperFileMapping Viper<K, V>::allocate_v_page_blocks() {
+template <typename K, typename V, typename IndexT>
+ViperFileMapping Viper<K, V, IndexT>::allocate_v_page_blocks() {
     const size_t alloc_size = v_base_.v_metadata->alloc_size;
 
     void* pmem_addr;
@@ -773,8 +1133,8 @@ ViperFileMapping Viper<K, V>::allocate_v_page_blocks() {
     return mapping;
 }
 
-template <typename K, typename V>
-void Viper<K, V>::add_v_page_blocks(ViperFileMapping mapping) {
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::add_v_page_blocks(ViperFileMapping mapping) {
     VPageBlock* start_block = reinterpret_cast<VPageBlock*>(mapping.start_addr);
     const block_size_t num_blocks_to_map = mapping.mapped_size / sizeof(VPageBlock);
 
@@ -787,18 +1147,32 @@ void Viper<K, V>::add_v_page_blocks(ViperFileMapping mapping) {
     num_v_blocks_.store(v_blocks_.size(), STORE_ORDER);
 }
 
-template <typename K, typename V>
-void Viper<K, V>::recover_database() {
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::recover_fixed_size_database() {
     auto start = std::chrono::steady_clock::now();
 
     const block_size_t num_used_blocks = v_base_.v_metadata->num_used_blocks.load(LOAD_ORDER);
-    DEBUG_LOG("Re-inserting values from " << num_used_blocks << " block(s).");
-    const size_t num_rec_threads = std::min(num_used_blocks, (size_t) num_recovery_threads_);
+    const bool has_checkpoint = v_config_.enable_checkpoint && load_checkpoint();
+    // With a checkpoint, only the blocks written since the checkpoint need to be recovered.
+    const block_size_t first_block = has_checkpoint ? v_base_.v_metadata->checkpoint_block_watermark : 0;
+    DEBUG_LOG("Re-inserting values from " << (num_used_blocks - std::min(first_block, num_used_blocks)) << " block(s).");
+    if (num_used_blocks <= first_block) {
+        return;
+    }
+    const block_size_t num_blocks_to_recover = num_used_blocks - first_block;
+    const size_t num_rec_threads = std::min(num_blocks_to_recover, (size_t) num_recovery_threads_);
 
     std::vector<std::thread> recovery_threads;
     recovery_threads.reserve(num_rec_threads);
 
-    auto key_check_fn = [&](auto key, auto offset) { return check_key_equality(key, offset); };
+    auto key_check_fn = get_key_check_fn();
+
+    // In bulk mode, each thread collects and sorts its entries. The index is then built from all entries at once.
+    // Training the learned hash needs all keys before the first insert, so it always uses bulk mode.
+    constexpr bool has_learned_hash = internal::IsCCEH<IndexT>::value;
+    const bool train_hash = has_learned_hash && v_config_.enable_learned_hash;
+    const bool use_bulk_load = !has_checkpoint && (v_config_.enable_bulk_recovery || train_hash);
+    std::vector<std::vector<std::pair<K, KVOffset>>> recovered_runs(use_bulk_load ? num_rec_threads : 0);
 
     auto recover = [&](const size_t thread_num, const block_size_t start_block, const block_size_t end_block) {
         size_t num_entries = 0;
@@ -819,19 +1193,36 @@ void Viper<K, V>::recover_database() {
                     // Data is present
                     const K& key = page.data[slot_num].first;
                     const KVOffset offset{block_num, page_num, slot_num};
-                    map_.Insert(key, offset, key_check_fn);
-                    num_entries++;
+                    if (use_bulk_load) {
+                        recovered_runs[thread_num].emplace_back(key, offset);
+                        num_entries++;
+                    } else {
+                        // Only count new keys, as the key may already be in the checkpoint.
+                        const KVOffset old_offset = map_.Insert(key, offset, key_check_fn);
+                        if (ordered_index_ != nullptr) {
+                            ordered_index_->Insert(key, offset);
+                        }
+                        num_entries += old_offset.is_tombstone();
+                    }
                 }
             }
         }
-        current_size_.fetch_add(num_entries);
+
+        if (use_bulk_load) {
+            std::vector<std::pair<K, KVOffset>>& run = recovered_runs[thread_num];
+            std::sort(run.begin(), run.end(), [](const auto& lhs, const auto& rhs) {
+                return learned::KeyTraits<K>::less(lhs.first, rhs.first);
+            });
+        } else {
+            current_size_.fetch_add(num_entries);
+        }
     };
 
     // We give each thread + 1 blocks to avoid leaving out blocks at the end.
-    const block_size_t num_blocks_per_thread = (num_used_blocks / num_rec_threads) + 1;
+    const block_size_t num_blocks_per_thread = (num_blocks_to_recover / num_rec_threads) + 1;
 
     for (size_t thread_num = 0; thread_num < num_rec_threads; ++thread_num) {
-        const block_size_t start_block = thread_num * num_blocks_per_thread;
+        const block_size_t start_block = first_block + (thread_num * num_blocks_per_thread);
         const block_size_t end_block = std::min(start_block + num_blocks_per_thread, num_used_blocks);
         recovery_threads.emplace_back(recover, thread_num, start_block, end_block);
     }
@@ -840,20 +1231,222 @@ void Viper<K, V>::recover_database() {
         thread.join();
     }
 
+    if (use_bulk_load) {
+        std::vector<std::pair<K, KVOffset>> entries = learned::merge_sorted_runs<K>(std::move(recovered_runs));
+        // A key can have two records if Viper crashed between writing the new and freeing the old record.
+        const auto unique_end = std::unique(entries.begin(), entries.end(), [](const auto& lhs, const auto& rhs) {
+            return learned::KeyTraits<K>::equal(lhs.first, rhs.first);
+        });
+        entries.erase(unique_end, entries.end());
+        current_size_.store(entries.size(), STORE_ORDER);
+
+        if constexpr (has_learned_hash) {
+            if (train_hash) {
+                map_.TrainHash(entries);
+            }
+        }
+        map_.BulkLoad(entries, key_check_fn, num_rec_threads);
+        if (ordered_index_ != nullptr) {
+            ordered_index_->BulkLoad(entries, num_rec_threads);
+        }
+    }
+
     auto end = std::chrono::steady_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
     DEBUG_LOG("RECOVERY DURATION: " << duration << " ms.");
     DEBUG_LOG("Re-inserted " << current_size_.load(LOAD_ORDER) << " keys.");
 }
 
-template <>
-void Viper<std::string, std::string>::recover_database() {
-    // TODO
-    throw std::runtime_error("Not implemented yet");
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::recover_database() {
+    if constexpr (std::is_same_v<K, std::string>) {
+        // TODO
+        throw std::runtime_error("Not implemented yet");
+    } else {
+        recover_fixed_size_database();
+    }
 }
 
-template <typename K, typename V>
-void Viper<K, V>::get_new_access_information(Client* client) {
+template <typename K, typename V, typename IndexT>
+learned::LearnedIndex<K>* Viper<K, V, IndexT>::get_checkpoint_index() {
+    if constexpr (std::is_same_v<IndexT, learned::LearnedIndex<K>>) {
+        return &map_;
+    } else if constexpr (std::is_same_v<learned::OrderedIndex<K>, learned::LearnedIndex<K>>) {
+        return ordered_index_.get();
+    } else {
+        return nullptr;
+    }
+}
+
+template <typename K, typename V, typename IndexT>
+bool Viper<K, V, IndexT>::checkpoint() {
+    if constexpr (std::is_same_v<K, std::string>) {
+        return false;
+    } else {
+        learned::LearnedIndex<K>* index = get_checkpoint_index();
+        if (index == nullptr || !v_base_.is_file_based) {
+            return false;
+        }
+
+        {
+            std::lock_guard guard{checkpoint_lock_};
+            if (checkpoint_state_.load(LOAD_ORDER) == CheckpointInProgress) {
+                return false;
+            }
+            if (v_base_.v_metadata->is_checkpoint_valid) {
+                v_base_.v_metadata->is_checkpoint_valid = false;
+                internal::pmem_persist(v_base_.v_metadata, sizeof(ViperFileMetadata));
+            }
+
+            // Records in blocks that are currently owned by a client may still change, so these are recovered.
+            block_size_t watermark = KVOffset{current_block_page_.load(LOAD_ORDER)}.block_number;
+            while (is_v_blocks_resizing_.load(std::memory_order_acquire)) {
+                // Wait for vector's memory to be valid again
+            }
+            for (block_size_t block_num = 0; block_num < watermark; ++block_num) {
+                if (v_blocks_[block_num]->is_owned()) {
+                    watermark = block_num;
+                    break;
+                }
+            }
+            pending_checkpoint_watermark_ = watermark;
+            checkpoint_state_.store(CheckpointInProgress, std::memory_order_seq_cst);
+        }
+
+        learned::IndexCheckpoint<K> checkpoint = index->Checkpoint();
+        const ViperCheckpointHeader header{ .magic = VIPER_CHECKPOINT_MAGIC, .key_size = sizeof(K),
+                                            .num_entries = checkpoint.keys.size(),
+                                            .num_segments = checkpoint.segments.size() };
+
+        const std::filesystem::path checkpoint_file = pool_dir_ / "checkpoint";
+        const std::filesystem::path tmp_file = pool_dir_ / "checkpoint.tmp";
+        const int fd = ::open(tmp_file.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0600);
+        bool is_written = fd >= 0;
+        if (is_written) {
+            is_written = internal::write_fully(fd, &header, sizeof(header)) &&
+                internal::write_fully(fd, checkpoint.keys.data(), checkpoint.keys.size() * sizeof(K)) &&
+                internal::write_fully(fd, checkpoint.offsets.data(), checkpoint.offsets.size() * sizeof(KVOffset)) &&
+                internal::write_fully(fd, checkpoint.segments.data(),
+                                      checkpoint.segments.size() * sizeof(learned::LinearSegment)) &&
+                fsync(fd) == 0;
+            close(fd);
+        }
+        if (is_written) {
+            std::error_code ec;
+            std::filesystem::rename(tmp_file, checkpoint_file, ec);
+            is_written = !ec;
+        }
+        if (is_written) {
+            const int dir_fd = ::open(pool_dir_.c_str(), O_RDONLY | O_DIRECTORY);
+            is_written = dir_fd >= 0 && fsync(dir_fd) == 0;
+            if (dir_fd >= 0) {
+                close(dir_fd);
+            }
+        }
+
+        std::lock_guard guard{checkpoint_lock_};
+        if (checkpoint_state_.load(LOAD_ORDER) != CheckpointInProgress) {
+            // A remove invalidated the checkpoint while it was being written.
+            return false;
+        }
+        if (!is_written) {
+            DEBUG_LOG("Could not write checkpoint file " << checkpoint_file);
+            checkpoint_state_.store(NoCheckpoint, STORE_ORDER);
+            return false;
+        }
+
+        v_base_.v_metadata->checkpoint_block_watermark = pending_checkpoint_watermark_;
+        internal::pmem_persist(v_base_.v_metadata, sizeof(ViperFileMetadata));
+        v_base_.v_metadata->is_checkpoint_valid = true;
+        internal::pmem_persist(v_base_.v_metadata, sizeof(ViperFileMetadata));
+        checkpoint_state_.store(CheckpointValid, STORE_ORDER);
+        return true;
+    }
+}
+
+template <typename K, typename V, typename IndexT>
+bool Viper<K, V, IndexT>::load_checkpoint() {
+    learned::LearnedIndex<K>* index = get_checkpoint_index();
+    if (index == nullptr || !v_base_.is_file_based || !v_base_.v_metadata->is_checkpoint_valid) {
+        return false;
+    }
+
+    const std::filesystem::path checkpoint_file = pool_dir_ / "checkpoint";
+    const int fd = ::open(checkpoint_file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    ViperCheckpointHeader header{};
+    learned::IndexCheckpoint<K> checkpoint;
+    bool is_read = internal::read_fully(fd, &header, sizeof(header)) &&
+        header.magic == VIPER_CHECKPOINT_MAGIC && header.key_size == sizeof(K);
+    if (is_read) {
+        checkpoint.keys.resize(header.num_entries);
+        checkpoint.offsets.resize(header.num_entries);
+        checkpoint.segments.resize(header.num_segments);
+        is_read = internal::read_fully(fd, checkpoint.keys.data(), header.num_entries * sizeof(K)) &&
+            internal::read_fully(fd, checkpoint.offsets.data(), header.num_entries * sizeof(KVOffset)) &&
+            internal::read_fully(fd, checkpoint.segments.data(), header.num_segments * sizeof(learned::LinearSegment));
+    }
+    close(fd);
+    if (!is_read) {
+        DEBUG_LOG("Ignoring invalid checkpoint file " << checkpoint_file);
+        return false;
+    }
+
+    const size_t num_entries = std::count_if(checkpoint.offsets.begin(), checkpoint.offsets.end(),
+                                             [](const KVOffset& offset) { return !offset.is_tombstone(); });
+    current_size_.store(num_entries, STORE_ORDER);
+
+    if constexpr (!std::is_same_v<IndexT, learned::LearnedIndex<K>>) {
+        // The hash index cannot be restored from the checkpoint, but it can be bulk-loaded from its sorted entries.
+        std::vector<std::pair<K, KVOffset>> entries;
+        entries.reserve(num_entries);
+        for (size_t i = 0; i < checkpoint.keys.size(); ++i) {
+            if (!checkpoint.offsets[i].is_tombstone()) {
+                entries.emplace_back(checkpoint.keys[i], checkpoint.offsets[i]);
+            }
+        }
+        if constexpr (internal::IsCCEH<IndexT>::value) {
+            if (v_config_.enable_learned_hash) {
+                map_.TrainHash(entries);
+            }
+        }
+        map_.BulkLoad(entries, get_key_check_fn(), num_recovery_threads_);
+    }
+
+    index->Restore(std::move(checkpoint));
+    checkpoint_state_.store(CheckpointValid, STORE_ORDER);
+    DEBUG_LOG("Restored " << num_entries << " keys from checkpoint.");
+    return true;
+}
+
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::invalidate_checkpoint() {
+    std::lock_guard guard{checkpoint_lock_};
+    if (checkpoint_state_.load(LOAD_ORDER) == CheckpointValid) {
+        v_base_.v_metadata->is_checkpoint_valid = false;
+        internal::pmem_persist(v_base_.v_metadata, sizeof(ViperFileMetadata));
+    }
+    checkpoint_state_.store(NoCheckpoint, STORE_ORDER);
+}
+
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::lower_checkpoint_watermark(const block_size_t block_number) {
+    // A reused block is older than the watermark, so its new records would not be recovered otherwise.
+    std::lock_guard guard{checkpoint_lock_};
+    const CheckpointState state = checkpoint_state_.load(LOAD_ORDER);
+    if (state == CheckpointValid && block_number < v_base_.v_metadata->checkpoint_block_watermark) {
+        v_base_.v_metadata->checkpoint_block_watermark = block_number;
+        internal::pmem_persist(v_base_.v_metadata, sizeof(ViperFileMetadata));
+    } else if (state == CheckpointInProgress && block_number < pending_checkpoint_watermark_) {
+        pending_checkpoint_watermark_ = block_number;
+    }
+}
+
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::get_new_access_information(Client* client) {
     // Get insert/delete count info
     client->info_sync(true);
 
@@ -865,8 +1458,8 @@ void Viper<K, V>::get_new_access_information(Client* client) {
     get_block_based_access(client);
 }
 
-template <typename K, typename V>
-void Viper<K, V>::get_new_var_size_access_information(Client* client) {
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::get_new_var_size_access_information(Client* client) {
     if constexpr (!std::is_same_v<K, std::string>) {
         throw std::runtime_error("Cannot update var pages for fixed-size entries.");
     }
@@ -878,15 +1471,21 @@ void Viper<K, V>::get_new_var_size_access_information(Client* client) {
     internal::pmem_persist(v_base_.v_metadata, sizeof(ViperFileMetadata));
 }
 
-template <typename K, typename V>
-void Viper<K, V>::get_block_based_access(Client* client) {
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::get_block_based_access(Client* client) {
     block_size_t client_block = -1;
     page_size_t client_page = 0;
-    if (!free_blocks_.try_dequeue(client_block)) {
+    bool has_free_block = false;
+    for (size_t i = 0; i < free_blocks_.size() && !has_free_block; ++i) {
+        has_free_block = free_blocks_[(client->numa_node_ + i) % free_blocks_.size()].try_dequeue(client_block);
+    }
+    if (!has_free_block) {
         // No free block available, get new one.
         const KVOffset new_block = get_new_block();
         client_block = new_block.block_number;
         client_page = new_block.page_number;
+    } else if (checkpoint_state_.load(LOAD_ORDER) != NoCheckpoint) {
+        lower_checkpoint_watermark(client_block);
     }
     assert(client_block != -1);
 
@@ -913,8 +1512,17 @@ void Viper<K, V>::get_block_based_access(Client* client) {
     internal::pmem_persist(v_base_.v_metadata, sizeof(ViperFileMetadata));
 }
 
-template <typename K, typename V>
-KeyValueOffset Viper<K, V>::get_new_block() {
+/** Returns the free block queue of the NUMA node that holds the block's memory. */
+template <typename K, typename V, typename IndexT>
+size_t Viper<K, V, IndexT>::get_block_node(const block_size_t block_number) {
+    if (free_blocks_.size() == 1) {
+        return 0;
+    }
+    return numa::NodeOfAddress(v_blocks_[block_number]) % free_blocks_.size();
+}
+
+template <typename K, typename V, typename IndexT>
+KeyValueOffset Viper<K, V, IndexT>::get_new_block() {
     offset_size_t raw_block_page = current_block_page_.load(LOAD_ORDER);
     KVOffset new_offset{};
     block_size_t client_block;
@@ -939,8 +1547,8 @@ KeyValueOffset Viper<K, V>::get_new_block() {
     return KVOffset{raw_block_page};
 }
 
-template <typename K, typename V>
-void Viper<K, V>::trigger_resize() {
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::trigger_resize() {
     bool expected_resizing = false;
     const bool should_resize = is_resizing_.compare_exchange_strong(expected_resizing, true);
     if (!should_resize) {
@@ -958,8 +1566,8 @@ void Viper<K, V>::trigger_resize() {
     resize_thread_->detach();
 }
 
-template <typename K, typename V>
-void Viper<K, V>::trigger_reclaim(size_t num_reclaim_ops) {
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::trigger_reclaim(size_t num_reclaim_ops) {
     bool expected_reclaiming = false;
     const bool should_reclaim = is_reclaiming_.compare_exchange_strong(expected_reclaiming, true);
     if (!should_reclaim) {
@@ -976,11 +1584,30 @@ void Viper<K, V>::trigger_reclaim(size_t num_reclaim_ops) {
     reclaim_thread_->detach();
 }
 
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::trigger_index_shrink() {
+    bool expected_shrinking = false;
+    const bool should_shrink = is_shrinking_index_.compare_exchange_strong(expected_shrinking, true);
+    if (!should_shrink) {
+        return;
+    }
+
+    index_removes_.store(0);
+
+    std::thread shrink_thread{[this] {
+        map_.Shrink();
+        DEBUG_LOG("END INDEX SHRINKING");
+        is_shrinking_index_.store(false, STORE_ORDER);
+    }};
+    shrink_thread.detach();
+}
+
 
-template <typename K, typename V>
-inline typename Viper<K, V>::Client Viper<K, V>::get_client() {
+template <typename K, typename V, typename IndexT>
+inline typename Viper<K, V, IndexT>::Client Viper<K, V, IndexT>::get_client() {
     num_active_clients_++;
     Client client{*this};
+    client.numa_node_ = free_blocks_.size() == 1 ? 0 : numa::CurrentNode() % free_blocks_.size();
     if constexpr (std::is_same_v<K, std::string>) {
         get_new_var_size_access_information(&client);
     } else {
@@ -989,23 +1616,19 @@ inline typename Viper<K, V>::Client Viper<K, V>::get_client() {
     return client;
 }
 
-template <typename K, typename V>
-typename Viper<K, V>::ReadOnlyClient Viper<K, V>::get_read_only_client() {
+template <typename K, typename V, typename IndexT>
+typename Viper<K, V, IndexT>::ReadOnlyClient Viper<K, V, IndexT>::get_read_only_client() {
     return ReadOnlyClient{*this};
 }
 
-template <typename K, typename V>
-void Viper<K, V>::remove_client(Viper::Client* client) {
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::remove_client(Viper::Client* client) {
     client->info_sync(true);
     --num_active_clients_;
 }
 
-template <typename K, typename V>
-inline bool Viper<K, V>::check_key_equality(const K& key, const KVOffset offset_to_compare) {
-    if constexpr (!using_fp) {
-        throw std::runtime_error("Should not use key checker without fingerprints!");
-    }
-
+template <typename K, typename V, typename IndexT>
+inline bool Viper<K, V, IndexT>::check_key_equality(const K& key, const KVOffset offset_to_compare) {
     if (offset_to_compare.is_tombstone()) {
         return false;
     }
@@ -1019,8 +1642,19 @@ inline bool Viper<K, V>::check_key_equality(const K& key, const KVOffset offset_
     }
 }
 
-template <typename K, typename V>
-bool Viper<K, V>::Client::put(const K& key, const V& value, const bool delete_old) {
+template <typename K, typename V, typename IndexT>
+inline std::string_view Viper<K, V, IndexT>::get_stored_key(const KVOffset offset) {
+    const ReadOnlyClient client = get_read_only_client();
+    const auto& entry = client.get_const_entry_from_offset(offset);
+    if constexpr (std::is_pointer_v<typename KeyAccessor<K>::checker_type>) {
+        return std::string_view{reinterpret_cast<const char*>(entry.first), sizeof(K)};
+    } else {
+        return entry.first;
+    }
+}
+
+template <typename K, typename V, typename IndexT>
+bool Viper<K, V, IndexT>::Client::put_fixed_size(const K& key, const V& value, const bool delete_old) {
     v_page_->lock();
 
     // We now have the lock on this page
@@ -1046,17 +1680,17 @@ bool Viper<K, V>::Client::put(const K& key, const V& value, const bool delete_ol
     const KVOffset kv_offset{v_block_number_, v_page_number_, free_slot_idx};
     KVOffset old_offset;
 
-    if constexpr (using_fp) {
-        auto key_check_fn = [&](auto key, auto offset) { return this->viper_.check_key_equality(key, offset); };
-        old_offset = this->viper_.map_.Insert(key, kv_offset, key_check_fn);
-    } else {
-        old_offset = this->viper_.map_.Insert(key, kv_offset);
+    auto key_check_fn = this->viper_.get_key_check_fn();
+    old_offset = this->viper_.map_.Insert(key, kv_offset, key_check_fn);
+
+    if (this->viper_.ordered_index_ != nullptr) {
+        this->viper_.ordered_index_->Insert(key, kv_offset);
     }
 
     const bool is_new_item = old_offset.is_tombstone();
     if (!is_new_item && delete_old) {
         // Need to free slot at old location for this key
-        free_occupied_slot(old_offset, key);
+        free_occupied_slot(old_offset);
     }
 
     v_page_->unlock();
@@ -1068,8 +1702,8 @@ bool Viper<K, V>::Client::put(const K& key, const V& value, const bool delete_ol
     return is_new_item;
 }
 
-template <>
-bool Viper<std::string, std::string>::Client::put(const std::string& key, const std::string& value, const bool delete_old) {
+template <typename K, typename V, typename IndexT>
+bool Viper<K, V, IndexT>::Client::put_var_size(const K& key, const V& value, const bool delete_old) {
     v_page_->lock();
     VPage* start_v_page = v_page_;
 
@@ -1156,29 +1790,41 @@ bool Viper<std::string, std::string>::Client::put(const std::string& key, const
     KVOffset old_offset = KVOffset::Tombstone();
 
     // Store data in DRAM map.
-    auto key_check_fn = [&](auto key, auto offset) { return this->viper_.check_key_equality(key, offset); };
+    auto key_check_fn = this->viper_.get_key_check_fn();
     old_offset = this->viper_.map_.Insert(key, var_offset, key_check_fn);
     is_new_item = old_offset.is_tombstone();
+    if (this->viper_.ordered_index_ != nullptr) {
+        this->viper_.ordered_index_->Insert(key, var_offset);
+    }
     size_delta_++;
 
     start_v_page->unlock();
 
     // Need to free slot at old location for this key
     if (!is_new_item && delete_old) {
-        free_occupied_slot(old_offset, key);
+        free_occupied_slot(old_offset);
     }
 
     info_sync();
     return is_new_item;
 }
 
+template <typename K, typename V, typename IndexT>
+bool Viper<K, V, IndexT>::Client::put(const K& key, const V& value, const bool delete_old) {
+    if constexpr (std::is_same_v<K, std::string>) {
+        return put_var_size(key, value, delete_old);
+    } else {
+        return put_fixed_size(key, value, delete_old);
+    }
+}
+
 /**
  * Insert a `value` for a given `key`.
  * Returns true if the item in new, i.e., the key was not present in Viper,
  * or false if it replaces an existing value.
  */
-template <typename K, typename V>
-bool Viper<K, V>::Client::put(const K& key, const V& value) {
+template <typename K, typename V, typename IndexT>
+bool Viper<K, V, IndexT>::Client::put(const K& key, const V& value) {
     return put(key, value, true);
 }
 
@@ -1188,12 +1834,9 @@ bool Viper<K, V>::Client::put(const K& key, const V& value) {
  * If the item was found, `value` will contain the found entry.
  * If it was not found, `value` is not modified and will contain whatever was present before the call.
  */
-template <typename K, typename V>
-bool Viper<K, V>::Client::get(const K& key, V* value) {
-    auto key_check_fn = [&](auto key, auto offset) {
-        if constexpr (using_fp) { return this->viper_.check_key_equality(key, offset); }
-        else { return cceh::CCEH<K>::dummy_key_check(key, offset); }
-    };
+template <typename K, typename V, typename IndexT>
+bool Viper<K, V, IndexT>::Client::get(const K& key, V* value) {
+    auto key_check_fn = this->viper_.get_key_check_fn();
 
     while (true) {
         KVOffset kv_offset = this->viper_.map_.Get(key, key_check_fn);
@@ -1212,12 +1855,9 @@ bool Viper<K, V>::Client::get(const K& key, V* value) {
  * If the item was found, `value` will contain the found entry.
  * If it was not found, `value` is not modified and will contain whatever was present before the call.
  */
-template <typename K, typename V>
-bool Viper<K, V>::ReadOnlyClient::get(const K& key, V* value) const {
-    auto key_check_fn = [&](auto key, auto offset) {
-        if constexpr (using_fp) { return this->viper_.check_key_equality(key, offset); }
-        else { return cceh::CCEH<K>::dummy_key_check(key, offset); }
-    };
+template <typename K, typename V, typename IndexT>
+bool Viper<K, V, IndexT>::ReadOnlyClient::get(const K& key, V* value) const {
+    auto key_check_fn = this->viper_.get_key_check_fn();
 
     while (true) {
         KVOffset kv_offset = this->viper_.map_.Get(key, key_check_fn);
@@ -1230,15 +1870,252 @@ bool Viper<K, V>::ReadOnlyClient::get(const K& key, V* value) const {
     }
 }
 
+/**
+ * Gets the values of `num_keys` keys, like calling `get` for each of them.
+ * `found[i]` is set to whether `keys[i]` was found and, if so, `values[i]` contains its value.
+ * Returns the number of found keys.
+ * Keys are processed in batches of `multi_get_batch_size`. The index lookups of a batch are done first, e.g., with
+ * CCEH's staged `MultiGet`. Then all records are prefetched before any value is copied, so that PMem reads overlap.
+ */
+template <typename K, typename V, typename IndexT>
+size_t Viper<K, V, IndexT>::ReadOnlyClient::multi_get(const K* keys, const size_t num_keys, V* values,
+                                                      bool* found) const {
+    auto key_check_fn = this->viper_.get_key_check_fn();
+    KVOffset offsets[multi_get_batch_size];
+    size_t num_found = 0;
+
+    for (size_t batch_start = 0; batch_start < num_keys; batch_start += multi_get_batch_size) {
+        const size_t batch_size = std::min(multi_get_batch_size, num_keys - batch_start);
+        const K* batch_keys = keys + batch_start;
+        if constexpr (internal::HasMultiGet<IndexT, K>::value) {
+            this->viper_.map_.MultiGet(batch_keys, batch_size, offsets, key_check_fn);
+        } else {
+            for (size_t i = 0; i < batch_size; ++i) {
+                offsets[i] = this->viper_.map_.Get(batch_keys[i], key_check_fn);
+            }
+        }
+
+        for (size_t i = 0; i < batch_size; ++i) {
+            prefetch_record(offsets[i]);
+        }
+
+        for (size_t i = 0; i < batch_size; ++i) {
+            KVOffset kv_offset = offsets[i];
+            bool is_found = false;
+            while (!kv_offset.is_tombstone()) {
+                if (get_const_value_from_offset(kv_offset, &values[batch_start + i])) {
+                    is_found = true;
+                    break;
+                }
+                // Record was modified concurrently, so its offset may be outdated.
+                kv_offset = this->viper_.map_.Get(batch_keys[i], key_check_fn);
+            }
+            found[batch_start + i] = is_found;
+            num_found += is_found;
+        }
+    }
+    return num_found;
+}
+
+/**
+ * Calls `scan_fn(key, value)` for all records with `start_key` <= key <= `end_key` in key order.
+ * `scan_fn` returns true to continue or false to stop the scan.
+ * Returns the number of visited records.
+ * Requires an ordered `IndexT` or `ViperConfig::enable_ordered_index`. The scan is not a snapshot, i.e., concurrent modifications
+ * to keys in the range may or may not be visible.
+ */
+template <typename K, typename V, typename IndexT>
+template <typename ScanFn>
+size_t Viper<K, V, IndexT>::ReadOnlyClient::scan(const K& start_key, const K& end_key, ScanFn scan_fn) const {
+    if (!is_ordered_map && this->viper_.ordered_index_ == nullptr) {
+        throw std::runtime_error("Cannot scan without ordered index. Set enable_ordered_index in ViperConfig.");
+    }
+
+    auto key_check_fn = this->viper_.get_key_check_fn();
+
+    size_t num_visited = 0;
+    auto visit_fn = [&](const K& key, KVOffset kv_offset) {
+        V value;
+        while (!get_const_value_for_key(key, kv_offset, &value)) {
+            // Offset in ordered index may be outdated by a concurrent write. The hash index is authoritative.
+            kv_offset = this->viper_.map_.Get(key, key_check_fn);
+            if (kv_offset.is_tombstone()) {
+                return true;
+            }
+        }
+        num_visited++;
+        return scan_fn(key, value);
+    };
+
+    scan_index(start_key, end_key, visit_fn);
+    return num_visited;
+}
+
+template <typename K, typename V, typename IndexT>
+template <typename ScanFn>
+void Viper<K, V, IndexT>::ReadOnlyClient::scan_index(const K& start_key, const K& end_key, ScanFn scan_fn) const {
+    if constexpr (is_ordered_map) {
+        this->viper_.map_.Scan(start_key, end_key, scan_fn);
+    } else {
+        this->viper_.ordered_index_->Scan(start_key, end_key, scan_fn);
+    }
+}
+
+/**
+ * Calls `scan_fn(key, value)` for all records whose key starts with `prefix` in key order, see `scan`.
+ * Only for string keys.
+ */
+template <typename K, typename V, typename IndexT>
+template <typename ScanFn>
+size_t Viper<K, V, IndexT>::ReadOnlyClient::scan_prefix(const K& prefix, ScanFn scan_fn) const {
+    static_assert(std::is_same_v<K, std::string>, "Prefix scans are only supported for string keys.");
+
+    // All keys with the prefix are smaller than the prefix with its last non-0xFF byte incremented.
+    K end_key = prefix;
+    while (!end_key.empty() && static_cast<uint8_t>(end_key.back()) == 0xFF) {
+        end_key.pop_back();
+    }
+    if (end_key.empty()) {
+        end_key = learned::KeyTraits<K>::max_key();
+    } else {
+        end_key.back()++;
+    }
+
+    size_t num_visited = 0;
+    scan(prefix, end_key, [&](const K& key, const V& value) {
+        if (key.compare(0, prefix.size(), prefix) != 0) {
+            // Only the end key itself can be visited without the prefix.
+            return false;
+        }
+        num_visited++;
+        return scan_fn(key, value);
+    });
+    return num_visited;
+}
+
+/** Returns an iterator over all records. Call `seek` to position it. */
+template <typename K, typename V, typename IndexT>
+typename Viper<K, V, IndexT>::Iterator Viper<K, V, IndexT>::ReadOnlyClient::get_iterator() const {
+    return get_iterator(learned::KeyTraits<K>::max_key());
+}
+
+/** Returns an iterator over all records with key <= `upper_bound`. Call `seek` to position it. */
+template <typename K, typename V, typename IndexT>
+typename Viper<K, V, IndexT>::Iterator Viper<K, V, IndexT>::ReadOnlyClient::get_iterator(const K& upper_bound) const {
+    if (!is_ordered_map && this->viper_.ordered_index_ == nullptr) {
+        throw std::runtime_error("Cannot iterate without ordered index. Set enable_ordered_index in ViperConfig.");
+    }
+    return Iterator{*this, upper_bound};
+}
+
+template <typename K, typename V, typename IndexT>
+Viper<K, V, IndexT>::Iterator::Iterator(const ReadOnlyClient& client, const K& upper_bound) :
+    client_{client}, upper_bound_{upper_bound}, batch_pos_{0}, has_more_batches_{false}, is_valid_{false} {
+    batch_.reserve(batch_size);
+}
+
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::Iterator::seek(const K& key) {
+    fill_batch(key, true);
+    read_record();
+}
+
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::Iterator::next() {
+    if (!is_valid_) {
+        return;
+    }
+    batch_pos_++;
+    read_record();
+}
+
+template <typename K, typename V, typename IndexT>
+bool Viper<K, V, IndexT>::Iterator::valid() const {
+    return is_valid_;
+}
+
+template <typename K, typename V, typename IndexT>
+const K& Viper<K, V, IndexT>::Iterator::key() const {
+    return key_;
+}
+
+template <typename K, typename V, typename IndexT>
+const V& Viper<K, V, IndexT>::Iterator::value() const {
+    return value_;
+}
+
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::Iterator::fill_batch(const K& start_key, const bool include_start) {
+    batch_.clear();
+    batch_pos_ = 0;
+    client_.scan_index(start_key, upper_bound_, [&](const K& key, KVOffset kv_offset) {
+        if (!include_start && learned::KeyTraits<K>::equal(key, start_key)) {
+            return true;
+        }
+        batch_.emplace_back(key, kv_offset);
+        return batch_.size() < batch_size;
+    });
+    has_more_batches_ = batch_.size() == batch_size;
+
+    for (size_t batch_pos = 0; batch_pos < std::min(prefetch_distance, batch_.size()); ++batch_pos) {
+        prefetch_record(batch_pos);
+    }
+}
+
+/** Reads the record at the current batch position, skipping keys that were removed since the batch was read. */
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::Iterator::read_record() {
+    auto key_check_fn = client_.viper_.get_key_check_fn();
+
+    while (true) {
+        if (batch_pos_ == batch_.size()) {
+            if (!has_more_batches_) {
+                is_valid_ = false;
+                return;
+            }
+            const K last_key = batch_.back().first;
+            fill_batch(last_key, false);
+            continue;
+        }
+
+        prefetch_record(batch_pos_ + prefetch_distance);
+        const K& key = batch_[batch_pos_].first;
+        KVOffset kv_offset = batch_[batch_pos_].second;
+        bool is_found = true;
+        while (!client_.get_const_value_for_key(key, kv_offset, &value_)) {
+            // Offset in ordered index may be outdated by a concurrent write. The hash index is authoritative.
+            kv_offset = client_.viper_.map_.Get(key, key_check_fn);
+            if (kv_offset.is_tombstone()) {
+                is_found = false;
+                break;
+            }
+        }
+
+        if (is_found) {
+            key_ = key;
+            is_valid_ = true;
+            return;
+        }
+        batch_pos_++;
+    }
+}
+
+template <typename K, typename V, typename IndexT>
+inline void Viper<K, V, IndexT>::Iterator::prefetch_record(const size_t batch_pos) const {
+    if (batch_pos < batch_.size()) {
+        client_.prefetch_record(batch_[batch_pos].second);
+    }
+}
+
 /**
  * Get the `value` for a given `key`.
  * Returns true if the item was found or false if not.
  * If the item was found, `value` will contain the found entry.
  * If it was not found, `value` is not modified and will contain whatever was present before the call.
  */
-template <typename K, typename V>
-bool Viper<K, V>::Client::get(const K& key, V* value) const {
-    return static_cast<const Viper<K, V>::ReadOnlyClient*>(this)->get(key, value);
+template <typename K, typename V, typename IndexT>
+bool Viper<K, V, IndexT>::Client::get(const K& key, V* value) const {
+    return static_cast<const Viper<K, V, IndexT>::ReadOnlyClient*>(this)->get(key, value);
 }
 
 /**
@@ -1249,17 +2126,14 @@ bool Viper<K, V>::Client::get(const K& key, V* value) const {
  * e.g., through a call to `pmem_persist`.
  * If the modification is not atomic, Viper cannot guarantee correctness.
  */
-template <typename K, typename V>
+template <typename K, typename V, typename IndexT>
 template <typename UpdateFn>
-bool Viper<K, V>::Client::update(const K& key, UpdateFn update_fn) {
+bool Viper<K, V, IndexT>::Client::update(const K& key, UpdateFn update_fn) {
     if constexpr (std::is_same_v<K, std::string>) {
         throw std::runtime_error("In-place update not supported for variable length records!");
     }
 
-    auto key_check_fn = [&](auto key, auto offset) {
-        if constexpr (using_fp) { return this->viper_.check_key_equality(key, offset); }
-        else { return cceh::CCEH<K>::dummy_key_check(key, offset); }
-    };
+    auto key_check_fn = this->viper_.get_key_check_fn();
 
     while (true) {
         const KVOffset kv_offset = this->viper_.map_.Get(key, key_check_fn);
@@ -1284,41 +2158,41 @@ bool Viper<K, V>::Client::update(const K& key, UpdateFn update_fn) {
  * Delete the value for a given `key`.
  * Returns true if the item was deleted or false if not.
  */
-template <typename K, typename V>
-bool Viper<K, V>::Client::remove(const K& key) {
-    auto key_check_fn = [&](auto key, auto offset) {
-        if constexpr (using_fp) { return this->viper_.check_key_equality(key, offset); }
-        else { return cceh::CCEH<K>::dummy_key_check(key, offset); }
-    };
+template <typename K, typename V, typename IndexT>
+bool Viper<K, V, IndexT>::Client::remove(const K& key) {
+    auto key_check_fn = this->viper_.get_key_check_fn();
 
     const KVOffset kv_offset = this->viper_.map_.Get(key, key_check_fn);
     if (kv_offset.is_tombstone()) {
         return false;
     }
 
-    free_occupied_slot(kv_offset, key, true);
+    // The key is removed from the index before its record is freed. A concurrent checkpoint then either does not
+    // contain the key anymore or it is invalidated here.
+    this->viper_.map_.Delete(key, key_check_fn);
+    if (this->viper_.ordered_index_ != nullptr) {
+        this->viper_.ordered_index_->Delete(key);
+    }
+    if (this->viper_.checkpoint_state_.load() != NoCheckpoint) {
+        this->viper_.invalidate_checkpoint();
+    }
+
+    free_occupied_slot(kv_offset);
     num_reclaimable_ops_++;
+    info_sync();
     return true;
 }
 
-template <typename K, typename V>
-void Viper<K, V>::Client::free_occupied_slot(const KVOffset offset_to_delete, const K& key, const bool delete_offset) {
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::Client::free_occupied_slot(const KVOffset offset_to_delete) {
     const auto [block_number, page_number, data_offset] = offset_to_delete.get_offsets();
     while (this->viper_.is_v_blocks_resizing_.load(LOAD_ORDER)) {
         // Wait for vector's memmove to complete. Otherwise we might encounter a segfault.
     }
 
-    auto key_check_fn = [&](auto key, auto offset) {
-        if constexpr (using_fp) { return this->viper_.check_key_equality(key, offset); }
-        else { return cceh::CCEH<K>::dummy_key_check(key, offset); }
-    };
-
     if (v_block_number_ == block_number && v_page_number_ == page_number) {
         // Old record to delete is on the same page. We already hold the lock here.
         invalidate_record(v_page_, data_offset);
-        if (delete_offset) {
-            this->viper_.map_.Insert(key, IndexV::NONE(), key_check_fn);
-        }
         --size_delta_;
         return;
     }
@@ -1386,10 +2260,6 @@ void Viper<K, V>::Client::free_occupied_slot(const KVOffset offset_to_delete, co
         }
     }
 
-    if (delete_offset) {
-        this->viper_.map_.Insert(key, IndexV::NONE(), key_check_fn);
-    }
-
     if (has_lock) {
         if (deadlock_offset_inserted && encountered_own_offset) {
             // We inserted into the queue but manually deleted.
@@ -1411,8 +2281,8 @@ void Viper<K, V>::Client::free_occupied_slot(const KVOffset offset_to_delete, co
     --size_delta_;
 }
 
-template <typename K, typename V>
-inline void Viper<K, V>::Client::invalidate_record(VPage* v_page, const data_offset_size_t data_offset) {
+template <typename K, typename V, typename IndexT>
+inline void Viper<K, V, IndexT>::Client::invalidate_record(VPage* v_page, const data_offset_size_t data_offset) {
     if constexpr (std::is_same_v<K, std::string>) {
         char* raw_data = &v_page->data[data_offset];
         internal::VarSizeEntry* var_entry = reinterpret_cast<internal::VarSizeEntry*>(raw_data);
@@ -1428,8 +2298,8 @@ inline void Viper<K, V>::Client::invalidate_record(VPage* v_page, const data_off
     }
 }
 
-template <typename K, typename V>
-void Viper<K, V>::Client::update_access_information() {
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::Client::update_access_information() {
     if (strategy_ == PageStrategy::DimmBased) {
         if (v_block_number_ == end_v_block_number_) {
             // No more allocated pages, need new range
@@ -1455,14 +2325,14 @@ void Viper<K, V>::Client::update_access_information() {
     v_page_->init();
 }
 
-template <typename K, typename V>
-void Viper<K, V>::Client::update_var_size_page_information() {
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::Client::update_var_size_page_information() {
     update_access_information();
     v_page_->next_insert_offset = 0;
 }
 
-template <typename K, typename V>
-void Viper<K, V>::Client::info_sync(const bool force) {
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::Client::info_sync(const bool force) {
     if (force || ++op_count_ == 10000) {
         this->viper_.current_size_.fetch_add(size_delta_);
 
@@ -1474,20 +2344,29 @@ void Viper<K, V>::Client::info_sync(const bool force) {
             }
         }
 
+        if constexpr (internal::HasShrink<IndexT>::value) {
+            const size_t shrink_threshold = this->viper_.v_config_.index_shrink_threshold;
+            const size_t num_removes = this->viper_.index_removes_.fetch_add(num_reclaimable_ops_) + num_reclaimable_ops_;
+            if (shrink_threshold > 0 && num_removes > shrink_threshold) {
+                this->viper_.trigger_index_shrink();
+            }
+        }
+
         op_count_ = 0;
         size_delta_ = 0;
         num_reclaimable_ops_ = 0;
     }
 }
 
-template <typename K, typename V>
-Viper<K, V>::ReadOnlyClient::ReadOnlyClient(ViperT& viper) : viper_{viper} {}
+template <typename K, typename V, typename IndexT>
+Viper<K, V, IndexT>::ReadOnlyClient::ReadOnlyClient(ViperT& viper) : viper_{viper} {}
 
-template <typename K, typename V>
-Viper<K, V>::Client::Client(ViperT& viper) : ReadOnlyClient{viper} {
+template <typename K, typename V, typename IndexT>
+Viper<K, V, IndexT>::Client::Client(ViperT& viper) : ReadOnlyClient{viper} {
     op_count_ = 0;
     size_delta_ = 0;
     num_v_pages_processed_ = 0;
+    numa_node_ = 0;
     v_block_number_ = 0;
     v_page_number_ = 0;
     end_v_block_number_ = 0;
@@ -1495,17 +2374,17 @@ Viper<K, V>::Client::Client(ViperT& viper) : ReadOnlyClient{viper} {
     v_block_ = nullptr;
 }
 
-template <typename K, typename V>
-Viper<K, V>::Client::~Client() {
+template <typename K, typename V, typename IndexT>
+Viper<K, V, IndexT>::Client::~Client() {
     this->viper_.remove_client(this);
     if (v_block_ != nullptr) {
         v_block_->v_pages[0].version_lock &= NO_CLIENT_BIT;
     }
 }
 
-template <typename K, typename V>
+template <typename K, typename V, typename IndexT>
 inline const std::pair<typename KeyAccessor<K>::checker_type, typename ValueAccessor<V>::checker_type>
-Viper<K, V>::ReadOnlyClient::get_const_entry_from_offset(Viper::KVOffset offset) const {
+Viper<K, V, IndexT>::ReadOnlyClient::get_const_entry_from_offset(Viper::KVOffset offset) const {
     if constexpr (std::is_same_v<K, std::string>) {
         const auto[block, page, data_offset] = offset.get_offsets();
         const VPageBlock* v_block = this->viper_.v_blocks_[block];
@@ -1525,8 +2404,8 @@ Viper<K, V>::ReadOnlyClient::get_const_entry_from_offset(Viper::KVOffset offset)
     }
 }
 
-template <typename K, typename V>
-inline bool Viper<K, V>::ReadOnlyClient::get_const_value_from_offset(KVOffset offset, V* value) const {
+template <typename K, typename V, typename IndexT>
+inline bool Viper<K, V, IndexT>::ReadOnlyClient::get_const_value_from_offset(KVOffset offset, V* value) const {
     const auto [block, page, slot] = offset.get_offsets();
     const VPage& v_page = this->viper_.v_blocks_[block]->v_pages[page];
     const std::atomic<version_lock_t>& page_lock = v_page.version_lock;
@@ -1544,21 +2423,79 @@ inline bool Viper<K, V>::ReadOnlyClient::get_const_value_from_offset(KVOffset of
     return lock_val == page_lock.load(LOAD_ORDER);
 }
 
+/** Prefetches the page lock and the entry of the record at `offset`, unless it is a tombstone. */
+template <typename K, typename V, typename IndexT>
+inline void Viper<K, V, IndexT>::ReadOnlyClient::prefetch_record(const KVOffset offset) const {
+    if (offset.is_tombstone()) {
+        return;
+    }
+    const auto [block, page, data_offset] = offset.get_offsets();
+    const VPage& v_page = this->viper_.v_blocks_[block]->v_pages[page];
+    _mm_prefetch(reinterpret_cast<const char*>(&v_page.version_lock), _MM_HINT_T0);
+    _mm_prefetch(reinterpret_cast<const char*>(&v_page.data[data_offset]), _MM_HINT_T0);
+}
+
+template <typename K, typename V, typename IndexT>
+inline bool Viper<K, V, IndexT>::ReadOnlyClient::get_const_value_for_key(const K& key, KVOffset offset, V* value) const {
+    const auto [block, page, data_offset] = offset.get_offsets();
+    const VPage& v_page = this->viper_.v_blocks_[block]->v_pages[page];
+    const std::atomic<version_lock_t>& page_lock = v_page.version_lock;
+    version_lock_t lock_val = page_lock.load(LOAD_ORDER);
+    if (IS_LOCKED(lock_val)) {
+        return false;
+    }
+
+    const auto entry = this->get_const_entry_from_offset(offset);
+    bool is_record_of_key;
+    if constexpr (std::is_same_v<K, std::string>) {
+        const internal::VarEntryAccessor var_entry{&v_page.data[data_offset]};
+        is_record_of_key = var_entry.is_set && entry.first == key;
+        const std::string_view& str_val = entry.second;
+        value->assign(str_val.data(), str_val.size());
+    } else {
+        is_record_of_key = !v_page.free_slots[data_offset] && *(entry.first) == key;
+        *value = *(entry.second);
+    }
+    return is_record_of_key && lock_val == page_lock.load(LOAD_ORDER);
+}
+
 /** Return the total number of used bytes in PMem */
-template<typename K, typename V>
-size_t Viper<K, V>::ReadOnlyClient::get_total_used_pmem() const {
+template <typename K, typename V, typename IndexT>
+size_t Viper<K, V, IndexT>::ReadOnlyClient::get_total_used_pmem() const {
     // + PAGE_SIZE for metadata block
     return (this->viper_.v_base_.v_metadata->num_used_blocks * sizeof(VPageBlock)) + PAGE_SIZE;
 }
 
 /** Return the total number of allocated bytes in PMem */
-template<typename K, typename V>
-size_t Viper<K, V>::ReadOnlyClient::get_total_allocated_pmem() const {
+template <typename K, typename V, typename IndexT>
+size_t Viper<K, V, IndexT>::ReadOnlyClient::get_total_allocated_pmem() const {
     return this->viper_.v_base_.v_metadata->total_mapped_size;
 }
 
-template <typename K, typename V>
-inline bool Viper<K, V>::Client::get_value_from_offset(const KVOffset offset, V* value) {
+/** Return the statistics of the records, PMem, and index. Cheap enough to be polled. */
+template <typename K, typename V, typename IndexT>
+ViperStats Viper<K, V, IndexT>::ReadOnlyClient::get_stats() const {
+    ViperStats stats{};
+    stats.num_records = this->viper_.current_size_.load(std::memory_order_relaxed);
+    stats.used_pmem_bytes = get_total_used_pmem();
+    stats.allocated_pmem_bytes = get_total_allocated_pmem();
+    if constexpr (internal::HasStats<IndexT>::value) {
+        stats.index = this->viper_.map_.GetStats();
+    }
+    return stats;
+}
+
+template <typename K, typename V, typename IndexT>
+inline bool Viper<K, V, IndexT>::Client::get_value_from_offset(const KVOffset offset, V* value) {
+    if constexpr (std::is_same_v<K, std::string>) {
+        return get_var_size_value_from_offset(offset, value);
+    } else {
+        return get_fixed_size_value_from_offset(offset, value);
+    }
+}
+
+template <typename K, typename V, typename IndexT>
+inline bool Viper<K, V, IndexT>::Client::get_fixed_size_value_from_offset(const KVOffset offset, V* value) {
     const auto [block, page, slot] = offset.get_offsets();
     const VPage& v_page = this->viper_.v_blocks_[block]->v_pages[page];
     const std::atomic<version_lock_t>& page_lock = v_page.version_lock;
@@ -1570,8 +2507,8 @@ inline bool Viper<K, V>::Client::get_value_from_offset(const KVOffset offset, V*
     return lock_val == page_lock.load(LOAD_ORDER);
 }
 
-template <>
-inline bool Viper<std::string, std::string>::Client::get_value_from_offset(const KVOffset offset, std::string* value) {
+template <typename K, typename V, typename IndexT>
+inline bool Viper<K, V, IndexT>::Client::get_var_size_value_from_offset(const KVOffset offset, V* value) {
     const auto [block, page, data_offset] = offset.get_offsets();
     const VPageBlock* v_block = this->viper_.v_blocks_[block];
     const VPage& v_page = v_block->v_pages[page];
@@ -1592,8 +2529,17 @@ inline bool Viper<std::string, std::string>::Client::get_value_from_offset(const
     return lock_val == page_lock.load(LOAD_ORDER);
 }
 
-template <typename K, typename V>
-void Viper<K, V>::compact(Client& client, VPageBlock* v_block) {
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::compact(Client& client, VPageBlock* v_block) {
+    if constexpr (std::is_same_v<K, std::string>) {
+        compact_var_size(client, v_block);
+    } else {
+        compact_fixed_size(client, v_block);
+    }
+}
+
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::compact_fixed_size(Client& client, VPageBlock* v_block) {
     for (VPage& v_page : v_block->v_pages) {
         v_page.lock();
         auto& free_slots = v_page.free_slots;
@@ -1613,8 +2559,8 @@ void Viper<K, V>::compact(Client& client, VPageBlock* v_block) {
 
 }
 
-template <>
-void Viper<std::string, std::string>::compact(Client& client, VPageBlock* v_block) {
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::compact_var_size(Client& client, VPageBlock* v_block) {
     const size_t meta_size = sizeof(internal::VarSizeEntry::size_info);
 
     page_size_t current_page = 0;
@@ -1624,7 +2570,7 @@ void Viper<std::string, std::string>::compact(Client& client, VPageBlock* v_bloc
     uint16_t next_insert_off = v_page->next_insert_offset;
     bool is_last_page = next_insert_off != VPage::DATA_SIZE;
 
-    auto key_check_fn = [&](auto key, auto offset) { return check_key_equality(key, offset); };
+    auto key_check_fn = get_key_check_fn();
 
     while (true) {
         internal::VarEntryAccessor var_entry{raw_data};
@@ -1687,8 +2633,17 @@ void Viper<std::string, std::string>::compact(Client& client, VPageBlock* v_bloc
     v_page->unlock();
 }
 
-template <typename K, typename V>
-void Viper<K, V>::reclaim() {
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::reclaim() {
+    if constexpr (std::is_same_v<K, std::string>) {
+        reclaim_var_size();
+    } else {
+        reclaim_fixed_size();
+    }
+}
+
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::reclaim_fixed_size() {
     const size_t num_slots_per_block = num_pages_per_block * VPage::num_slots_per_page;
     const block_size_t max_block = KVOffset{current_block_page_.load(LOAD_ORDER)}.block_number;
 
@@ -1713,7 +2668,7 @@ void Viper<K, V>::reclaim() {
             compact(client, v_block);
             VPage& head_page = v_block->v_pages[0];
             head_page.version_lock = 0;
-            free_blocks_.enqueue(block_num);
+            free_blocks_[get_block_node(block_num)].enqueue(block_num);
             total_freed_blocks++;
         }
     }
@@ -1721,8 +2676,8 @@ void Viper<K, V>::reclaim() {
     DEBUG_LOG("TOTAL FREED BLOCKS: " << total_freed_blocks);
 }
 
-template <>
-void Viper<std::string, std::string>::reclaim() {
+template <typename K, typename V, typename IndexT>
+void Viper<K, V, IndexT>::reclaim_var_size() {
     const block_size_t max_block = KVOffset{current_block_page_.load(LOAD_ORDER)}.block_number;
     const double modified_threshold = v_config_.reclaim_free_percentage;
     size_t total_freed_blocks = 0;
@@ -1742,7 +2697,7 @@ void Viper<std::string, std::string>::reclaim() {
                 compact(client, v_block);
                 VPage& head_page = v_block->v_pages[0];
                 head_page.version_lock = 0;
-                free_blocks_.enqueue(block_num);
+                free_blocks_[get_block_node(block_num)].enqueue(block_num);
                 total_freed_blocks++;
                 break;
             }